@@ -0,0 +1,67 @@
+/* example envelope plugin: flat-top pulse of amplitude F1 on [t1, t2]
+ * with gaussian rise and fall of spreading sigma1 (microseconds)
+ *
+ * build: gcc -O2 -shared -fPIC -I../../source/common flattop.c -o libflattop.so -lm
+ * run:   ../../source/main input.json
+ */
+#include "qqevol_plugin.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    double F1;
+    double t1;
+    double t2;
+    double scale;   /* 1/sigma in 1/s */
+} flattop;
+
+static void* flattop_create(const qqevol_params* params, char* error, size_t error_size)
+{
+    if (!qqevol_has_param(params, "t1") || !qqevol_has_param(params, "t2") || !qqevol_has_param(params, "sigma1"))
+    {
+        snprintf(error, error_size, "flattop needs t1, t2 and sigma1");
+        return NULL;
+    }
+    flattop* state = (flattop*)malloc(sizeof(flattop));
+    state->F1    = qqevol_param(params, "F1", 1.0);
+    state->t1    = qqevol_param(params, "t1", 0.0);
+    state->t2    = qqevol_param(params, "t2", 0.0);
+    state->scale = 1.0e6/qqevol_param(params, "sigma1", 1.0);
+    return state;
+}
+
+static void flattop_evaluate(const void* state, const double* t, int n, double* env, double* env2)
+{
+    const flattop* p = (const flattop*)state;
+    for (int k = 0; k < n; k++)
+    {
+        double u = 0.0;
+        if (t[k] < p->t1)
+        {
+            u = (t[k] - p->t1)*p->scale;
+        }
+        else if (t[k] > p->t2)
+        {
+            u = (t[k] - p->t2)*p->scale;
+        }
+        env[k] = p->F1*exp(-0.5*u*u);
+    }
+}
+
+static void flattop_destroy(void* state)
+{
+    free(state);
+}
+
+static const qqevol_envelope plugin =
+{
+    QQEVOL_PLUGIN_ABI, "flattop", 0,
+    flattop_create, flattop_evaluate, flattop_destroy
+};
+
+const qqevol_envelope* qqevol_envelope_plugin(void)
+{
+    return &plugin;
+}
@@ -1,55 +1,91 @@
 #include <vector>
 #include <complex>
 #include <cmath>
+#include <algorithm>
+#include <numeric>
 #include <functional>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <memory>
 #include "algorithms.h"
+#include "kernels.h"
+#include "stepsize.h"
+#include "envstream.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include "potentials.h"
+#include "chebyshev.h"
+#include "explicitrk.h"
+#include "precision.h"
+#include "diagonal.h"
+#include "pipeline.h"
 
-//executes RK4 simulation for qbmode = off
-void EvolveRK4(const json& input, PotentialFunction potential, EnvelopeFunction envelope) 
+//read the system data (levels, couplings, initial state) from input
+SystemData LoadSystem(const json& input)
 {
-    //Assign base input data to local variables
-    std::string prefix = input["prefix"];
-    int Nstep          = input["Nstep"];
-    int D              = input["Dstates"];
-    int Nprint         = input["Nprint"];
-    double ti          = input["ti"];
-    double tf          = input["tf"];
-    //dynamically allocate memory for structured input data 
- 
-    std::vector<double> wl(D);
-    std::vector<std::complex<double>> psi0(D);
-    std::vector<std::complex<double>> wr(D*D);
-
-    //dynamically define local variables
-    std::vector<std::complex<double>> psiPrev(D, std::complex<double>(0.0, 0.0));
-    std::vector<std::complex<double>> psiCurr(D, std::complex<double>(0.0, 0.0));
-    std::vector<std::complex<double>> K0(D, 0.0);
-    std::vector<std::complex<double>> K1(D, 0.0);
-    std::vector<std::complex<double>> K2(D, 0.0);
-    std::vector<std::complex<double>> K3(D, 0.0);
-        
-    //allocate array for envelope function
-    std::vector<double> env(3,0);
-    std::vector<double> env2(3,0);
+    SystemData sys;
+    sys.D = input["Dstates"];
+    int D = sys.D;
+
+    sys.wl.resize(D);
+    sys.psi0.resize(D);
+    //couplings given as "wr_sparse" (krylov integrator) are not expanded to the dense matrix
+    bool dense = input.contains("wr");
+    if (dense)
+    {
+        sys.wr.resize(D*D);
+    }
+
+    //qbmode = on gives only the level spacing of the two levels
+    bool qubit = (input["qbmode"] == "on");
 
     for (int k = 0; k < D ; k++)
     {
-        psi0[k] = std::complex<double>(input["psi"][k],0.0);
-        psiPrev[k]   = psi0[k];
-        psiCurr[k]   = psi0[k]; 
+        sys.psi0[k] = std::complex<double>(input["psi"][k],0.0);
+        sys.wl[k]   = qubit ? ((k == 0) ? 0.0 : (double)input["wl"][0]) : (double)input["wl"][k];
 
-        wl[k]   = input["wl"][k];
+        for (int j = 0; j < D && dense; j++)
+        {
+            sys.wr[k*D + j] = std::complex<double>(input["wr"][k][j],0.0);
+        }
+    }
 
-        for (int j = 0; j < D ; j++)
+    //real symmetric couplings give anti-Hermitian potentials: only their upper triangle is built and multiplied
+    //("wr_packed" = false keeps the full matrices)
+    sys.packed = dense && input.value("wr_packed", true);
+    for (int k = 0; k < D && sys.packed; k++)
+    {
+        for (int j = k + 1; j < D; j++)
         {
-            wr[k*D + j] = std::complex<double>(input["wr"][k][j],0.0);
+            if (sys.wr[k*D + j] != sys.wr[j*D + k])
+            {
+                sys.packed = false;
+                break;
+            }
         }
     }
+    for (int k = 0; k < D && sys.packed; k++)
+    {
+        sys.wrPacked.insert(sys.wrPacked.end(), sys.wr.begin() + k*D + k, sys.wr.begin() + (k + 1)*D);
+    }
+    return sys;
+}
 
-    //allocate vector for time array
+//multiply psi by exp(sign i wl t/hbar): interaction picture (+1) from laboratory frame at time t, and back (-1)
+void FramePhase(const SystemData& sys, double t, double sign, std::vector<std::complex<double>>& psi)
+{
+    for (int k = 0; k < sys.D; k++)
+    {
+        double angle = sign*sys.wl[k]*t/hbar;
+        psi[k] *= std::complex<double>(std::cos(angle), std::sin(angle));
+    }
+}
+
+//uniform time grid of Nstep steps between ti and tf
+std::vector<double> TimeGrid(double ti, double tf, int Nstep)
+{
     std::vector<double> t(Nstep+1);
     //compute time step
     double dt = (tf-ti)/(double)(Nstep);
@@ -58,122 +94,293 @@ void EvolveRK4(const json& input, PotentialFunction potential, EnvelopeFunction
     {
         t[i] = ti + i*dt;
     }
+    return t;
+}
 
-    std::vector<std::vector<std::complex<double>>> psiOut;
+//time grid of about Nstep steps between ti and tf with a grid point on each of the sorted edges:
+//the steps are shared among the segments between edges in proportion to their length (at least one each)
+std::vector<double> TimeGrid(double ti, double tf, int Nstep, const std::vector<double>& edges)
+{
+    std::vector<double> bounds(1, ti);
+    bounds.insert(bounds.end(), edges.begin(), edges.end());
+    bounds.push_back(tf);
+    int segments = (int)bounds.size() - 1;
 
-    //allocate potential matrix
-    std::vector<std::vector<std::complex<double>>> Vmatrices(3, std::vector<std::complex<double>>(D*D));
+    //largest remainder rounding of the proportional shares
+    std::vector<int> steps(segments);
+    std::vector<std::pair<double, int>> remainders(segments);
+    int assigned = 0;
+    for (int s = 0; s < segments; s++)
+    {
+        double share = Nstep*(bounds[s+1]-bounds[s])/(tf-ti);
+        steps[s] = std::max(1, (int)share);
+        remainders[s] = {share - (int)share, s};
+        assigned += steps[s];
+    }
+    std::sort(remainders.begin(), remainders.end(), std::greater<std::pair<double, int>>());
+    for (int r = 0; r < segments && assigned < Nstep; r++, assigned++)
+    {
+        steps[remainders[r].second]++;
+    }
 
-    //allocate output time and envelope array
-    std::vector<double> tOut;
-    std::vector<double> envOut;
-    
-    //initialize arrays
-   
-    tOut.push_back(ti);
-    psiOut.push_back(psi0);
-    //compute envelope at initial time for output
-    potential(input, D, t[0], dt,  wl,  wr,  envelope,  Vmatrices , env, env2);
-    envOut.push_back(env[0] + env2[0]);
+    std::vector<double> t(1, ti);
+    for (int s = 0; s < segments; s++)
+    {
+        double dt = (bounds[s+1]-bounds[s])/(double)steps[s];
+        for (int i = 1; i < steps[s]; i++)
+        {
+            t.push_back(bounds[s] + i*dt);
+        }
+        t.push_back(bounds[s+1]);
+    }
+    return t;
+}
 
-    for (int i = 1; i < Nstep+1 ; i++)
+void SplitParts(const std::vector<std::complex<double>>& psi, SplitState& parts)
+{
+    parts.re.resize(psi.size());
+    parts.im.resize(psi.size());
+    for (size_t k = 0; k < psi.size(); k++)
+    {
+        parts.re[k] = psi[k].real();
+        parts.im[k] = psi[k].imag();
+    }
+}
+
+void JoinParts(const SplitState& parts, std::vector<std::complex<double>>& psi)
+{
+    psi.resize(parts.re.size());
+    for (size_t k = 0; k < psi.size(); k++)
+    {
+        psi[k] = std::complex<double>(parts.re[k], parts.im[k]);
+    }
+}
+
+void StageKernel(int D, const std::complex<double>* V, const SplitState& x, SplitState& K)
+{
+    Kernels().stage(D, reinterpret_cast<const double*>(V), x.re.data(), x.im.data(), K.re.data(), K.im.data());
+}
+
+void PackedStageKernel(int D, const std::complex<double>* V, const SplitState& x, SplitState& K)
+{
+    Kernels().stagePacked(D, reinterpret_cast<const double*>(V), x.re.data(), x.im.data(), K.re.data(), K.im.data());
+}
+
+int StageElements(const SystemData& sys)
+{
+    return sys.packed ? sys.D*(sys.D + 1)/2 : sys.D*sys.D;
+}
+
+//sqrt(norm2), warning (and 1) if it is not finite or zero
+static double CheckedNorm(double norm2, int step)
+{
+    double norm = std::sqrt(norm2);
+    if (norm == 0.0 || std::isnan(norm) || std::isinf(norm)) {
+        std::cerr << "Warning: invalid norm at step " << step << "\n";
+        norm = 1.0;
+    }
+    return norm;
+}
+
+//psi <- psi/norm
+static void DivideState(SplitState& psi, double norm)
+{
+    for (size_t k = 0; k < psi.re.size(); k++)
+    {
+        psi.re[k] /= norm;
+        psi.im[k] /= norm;
+    }
+}
+
+void NormalizeState(SplitState& psi, int step)
+{
+    double norm2 = 0.0;
+    for (size_t k = 0; k < psi.re.size(); k++)
+    {
+        norm2 += psi.re[k]*psi.re[k] + psi.im[k]*psi.im[k];
+    }
+    DivideState(psi, CheckedNorm(norm2, step));
+}
+
+//RK4 integration of psi along the time grid t, saving every Nprint steps (and the last one) in out
+void PropagateRK4(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& t, std::vector<std::complex<double>>& psi, int Nprint, RunOutput* out, StaticSegments* segments, PotentialPipeline* pipeline)
+{
+    int D     = sys.D;
+    int Nstep = (int)(t.size()) - 1;
+
+    //state and stages by parts (psi is updated at the saved rows, the segments and the end). The stages are fused
+    //(see FusedStage): K holds the last stage, A the weighted sum of the stages, and the state is psiPrev/norm,
+    //normalized as the next step reads it
+    SplitState psiPrev;
+    SplitParts(psi, psiPrev);
+    SplitState K = psiPrev;
+    SplitState A = psiPrev;
+    double norm = 1.0;
+
+    //allocate array for envelope function
+    std::vector<double> env(3,0);
+    std::vector<double> env2(3,0);
+
+    //allocate potential matrix (upper triangle for packed couplings)
+    std::vector<std::vector<std::complex<double>>> Vmatrices(3, std::vector<std::complex<double>>(StageElements(sys)));
+    std::vector<std::complex<double>>& wr = sys.packed ? sys.wrPacked : sys.wr;
+    auto stage = sys.packed ? Kernels().stagePackedFused : Kernels().stageFused;
+
+    //"precision" = "mixed": the potential matrices and their products in complex<float>, but for every
+    //precision_resync-th step (0: none), which is taken in double
+    bool mixed = (input.value("precision", std::string("double")) == "mixed");
+    int resync = input.value("precision_resync", 0);
+    std::vector<std::vector<std::complex<float>>> floatMatrices;
+    if (mixed)
+    {
+        floatMatrices.assign(3, std::vector<std::complex<float>>(StageElements(sys)));
+    }
+    auto floatStage = sys.packed ? Kernels().stagePackedFusedFloat : Kernels().stageFusedFloat;
+
+    //"diagonal_drive" = "exact": psi carries the phase of the diagonal drive, RK4 sees only the couplings
+    std::unique_ptr<DiagonalDrive> diagonal;
+    if (input.value("diagonal_drive", std::string("rk4")) == "exact")
     {
-        //update potential
-        potential(input, D, t[i-1], dt,  wl,  wr,  envelope,  Vmatrices , env, env2);
+        diagonal.reset(new DiagonalDrive(input, sys));
+    }
+
+    //initialize output with the starting state and the envelope at initial time
+    if (out != nullptr && out->t.empty() && Nstep > 0)
+    {
+        potential(input, D, t[0], t[1]-t[0], sys.wl, wr, envelope, Vmatrices, env, env2);
+        out->t.push_back(t[0]);
+        out->env.push_back(env[0] + env2[0]);
+        out->psi.push_back(psi);
+    }
 
-        //compute K0
-        for (int j = 0; j < D; ++j) 
+    //the producers of the pipeline take over the envelope from here
+    if (pipeline != nullptr)
+    {
+        pipeline->Start();
+    }
+
+    for (int i = 1; i < Nstep+1 ; i++)
+    {
+        //segments of constant drive are crossed by one Chebyshev step up to the next saved row
+        if (segments != nullptr && segments->Contains(i))
         {
-            K0[j] = std::complex<double>(0.0, 0.0);
-            for (int k = 0; k < D; ++k) 
+            ScopedTimer segmentTimer(PHASE_STAGES);
+            double envelope;
+            DivideState(psiPrev, norm);
+            JoinParts(psiPrev, psi);
+            i = segments->Advance(t, i, Nprint, psi, envelope);
+            SplitParts(psi, psiPrev);
+            norm = 1.0;
+            segmentTimer.Stop();
+            if (out != nullptr && (i % Nprint == 0 || i == Nstep))
             {
-                K0[j] += Vmatrices[0][j*D + k] * psiPrev[k];
+                QQ_TIMER(PHASE_OUTPUT);
+                out->psi.push_back(psi);
+                out->env.push_back(envelope);
+                out->t.push_back(t[i]);
             }
+            continue;
         }
 
-        for (int j = 0; j < D; ++j) {
+        double dt = t[i] - t[i-1];
+        bool single = SinglePrecisionStep(mixed, resync, i);
 
-            K1[j] = std::complex<double>(0.0, 0.0);
-            for (int k = 0; k < D; ++k) 
-            {
-                psiCurr[k] = psiPrev[k] + 0.5 * dt * K0[k];
-                K1[j] += Vmatrices[1][j * D + k] * psiCurr[k];
-            }
+        if (pipeline != nullptr)
+        {
+            QQ_TIMER(PHASE_PIPELINE_WAIT);
+            pipeline->Take(Vmatrices, floatMatrices, env, env2);
         }
 
-        for (int j = 0; j < D; ++j) 
+        //update potential (only the diagonal drive on the steps built by the pipeline)
+        if (pipeline == nullptr || diagonal)
         {
-            K2[j] = std::complex<double>(0.0, 0.0);
-            for (int k = 0; k < D; ++k) 
+            QQ_TIMER(PHASE_POTENTIAL);
+            PerfScope potentialCounters(PHASE_POTENTIAL);
+            if (pipeline == nullptr)
             {
-                psiCurr[k] = psiPrev[k] + 0.5 * dt * K1[k];
-                K2[j] += Vmatrices[1][j * D + k] * psiCurr[k];
+                SetFloatDrive(single ? &floatMatrices : nullptr);
+                potential(input, D, t[i-1], dt,  sys.wl,  wr,  envelope,  Vmatrices , env, env2);
+                SetFloatDrive(nullptr);
             }
-        }
-
-        //compute K3
-    
-        for (int j = 0; j < D; ++j) 
-        {
-            K3[j] = std::complex<double>(0.0, 0.0);
-            for (int k = 0; k < D; ++k) 
+            if (diagonal)
             {
-                psiCurr[k] = psiPrev[k] + dt * K2[k];
-                K3[j] += Vmatrices[2][j * D + k] * psiCurr[k];
+                diagonal->Apply(t[i-1], dt, env, env2, Vmatrices);
             }
         }
 
-        // New psi state
-        for (int j = 0; j < D; ++j) 
+        ScopedTimer stagesTimer(PHASE_STAGES);
+        PerfScope stagesCounters(PHASE_STAGES);
+        //stages: each input formed as it is read by the product, the weighted sum and the new state with its norm
+        //as the stages are written
+        FusedStage f = {FUSED_START, psiPrev.re.data(), psiPrev.im.data(), 1.0/norm, K.re.data(), K.im.data(), 0.0,
+                        K.re.data(), K.im.data(), A.re.data(), A.im.data(), 0.0};
+        auto product = [&](int node)
         {
-            psiPrev[j] += (dt / 6.0) * (K0[j] + 2.0 * K1[j] + 2.0 * K2[j] + K3[j]);
-        }
+            if (single)
+            {
+                return floatStage(D, reinterpret_cast<const float*>(floatMatrices[node].data()), f);
+            }
+            return stage(D, reinterpret_cast<const double*>(Vmatrices[node].data()), f);
+        };
+        product(0);
+        f.output = FUSED_ACCUMULATE;
+        f.c      = 0.5*dt;
+        f.w      = 2.0;
+        product(1);
+        product(1);
+        f.output = FUSED_FINISH;
+        f.c      = dt;
+        f.w      = dt/6.0;
+        double norm2 = product(2);
+        stagesCounters.Stop();
+        stagesTimer.Stop();
 
         // Normalization
-        
-        double norm = std::sqrt(
-        std::accumulate(
-                psiPrev.begin(), psiPrev.end(), 0.0,
-                [](double sum, const std::complex<double>& z) {
-                    return sum + std::norm(z); // somma dei quadrati dei moduli
-                }
-            )
-        );
-        if (norm == 0.0 || std::isnan(norm) || std::isinf(norm)) {
-            std::cerr << "Warning: invalid norm at step " << i << "\n";
-            norm = 1.0;
-        }
-        for (int j = 0; j < D; ++j) 
-        {
-            psiPrev[j] /= norm;
-        }
+        ScopedTimer normTimer(PHASE_NORMALIZATION);
+        norm = CheckedNorm(norm2, i);
+        normTimer.Stop();
 
         // Save every Nprint
-        if (i % Nprint == 0 || i == Nstep) 
+        if (out != nullptr && (i % Nprint == 0 || i == Nstep))
         {
-            psiOut.push_back(psiPrev);
-            envOut.push_back(env[2]);
-            tOut.push_back(t[i]);
+            QQ_TIMER(PHASE_OUTPUT);
+            PerfScope outputCounters(PHASE_OUTPUT);
+            DivideState(psiPrev, norm);
+            norm = 1.0;
+            JoinParts(psiPrev, psi);
+            out->psi.push_back(psi);
+            if (diagonal)
+            {
+                diagonal->ToState(out->psi.back());
+            }
+            out->env.push_back(env[2]);
+            out->t.push_back(t[i]);
         }
 
     }
+    DivideState(psiPrev, norm);
+    JoinParts(psiPrev, psi);
+}
 
-    std::cout << "Calculation completed...\n";
-
+//write the saved rows to prefix.txt
+void WriteOutput(const std::string& prefix, int D, const RunOutput& out)
+{
+    QQ_TIMER(PHASE_OUTPUT);
+    PerfScope outputCounters(PHASE_OUTPUT);
 
-    std::string outfile = prefix + ".txt"; 
+    std::string outfile = prefix + ".txt";
 
     std::cout << "Writing output file...\n";
-    
+
     //print out result
     FILE* f = std::fopen(outfile.c_str(), "w");
 if (!f) { std::cerr<<"fopen failed\n"; }
 else {
 
-    for (int i = 0; i < (int)(tOut.size()); ++i) {
-        std::fprintf(f, "%g %g ", tOut[i], envOut[i]);
+    for (int i = 0; i < (int)(out.t.size()); ++i) {
+        std::fprintf(f, "%g %g ", out.t[i], out.env[i]);
         for (int k = 0; k < D; ++k) {
-            std::fprintf(f, "%g+%gj ", std::real(psiOut[i][k]), std::imag(psiOut[i][k]));
+            std::fprintf(f, "%g+%gj ", std::real(out.psi[i][k]), std::imag(out.psi[i][k]));
         }
         std::fprintf(f, "\n");
     }
@@ -181,5 +388,148 @@ else {
 }
 
     std::cout << "Output file written correctly...\n";
+}
+
+//envelope of the run (batched, edge aware) and its time grid of the given or automatic number of steps;
+//the elements of others (if given) receive other envelopes of the run, one for each other thread that evaluates it
+std::vector<double> PrepareRun(const json& input, PotentialFunction potential, EnvelopeFunction& envelope, SystemData& sys, std::vector<EnvelopeFunction>* others)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    double ti = input["ti"];
+    double tf = input["tf"];
+
+    //steps end exactly on the jumps of the envelope, which see the envelope from inside ("segment_edges" = false disables it)
+    std::vector<double> edges;
+    if (input.value("segment_edges", true))
+    {
+        edges = EnvelopeEdges(input);
+    }
+    EnvelopeFunction scalar = envelope;
+    std::vector<EnvelopeFunction> none;
+    std::vector<EnvelopeFunction>& other = (others != nullptr) ? *others : none;
+    for (EnvelopeFunction& e : other)
+    {
+        e = scalar;
+    }
+
+    //envelope evaluated a block of steps at a time ("envelope_block" = 0 evaluates it step by step);
+    //the other envelopes share the block function but stream on their own
+    if (input.value("envelope_block", 1) > 0)
+    {
+        EnvelopeBlockFunction block = ResolveEnvelopeBlock(input, envelope);
+        envelope = StreamEnvelope(input, block);
+        for (EnvelopeFunction& e : other)
+        {
+            e = StreamEnvelope(input, block);
+        }
+    }
+    if (!edges.empty())
+    {
+        envelope = EdgeAwareEnvelope(envelope, scalar, edges);
+        for (EnvelopeFunction& e : other)
+        {
+            e = EdgeAwareEnvelope(e, scalar, edges);
+        }
+    }
+    setupTimer.Stop();
+
+    //number of steps, given or chosen from the frequencies of the problem
+    int Nstep = ResolveNstep(input, potential, envelope, sys, edges);
+
+    std::vector<double> t = edges.empty() ? TimeGrid(ti, tf, Nstep) : TimeGrid(ti, tf, Nstep, edges);
+    Nstep = (int)t.size() - 1;
+    if (!edges.empty())
+    {
+        std::cout << "Time grid aligned to " << edges.size() << " envelope edges: " << edges.size()+1 << " segments, " << Nstep << " steps\n";
+        RunReport()["segments"] = {{"edges", edges.size()}, {"steps", Nstep}};
+    }
+    return t;
+}
+
+//executes RK4 simulation for qbmode = off
+void EvolveRK4(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    //Assign base input data to local variables
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+
+    SystemData sys = LoadSystem(input);
+    int D = sys.D;
+    setupTimer.Stop();
+
+    //"potential_pipeline" = n: producers 2..n of the pipeline stream envelopes of their own
+    EnvelopeFunction scalar = envelope;
+    std::vector<EnvelopeFunction> producerEnvelopes(std::max(0, PipelineProducers(input) - 1));
+    std::vector<double> t = PrepareRun(input, potential, envelope, sys, &producerEnvelopes);
+    int Nstep = (int)t.size() - 1;
+
+    //"rk_compare" = true: rk4, rk6 and rk8 on this grid, compared on cost and accuracy
+    if (input.value("rk_compare", false))
+    {
+        CompareExplicitRK(input, potential, envelope, scalar, sys, t, Nprint);
+    }
+
+    //"precision" = "mixed": deviation from double precision on the steps around the largest envelope
+    bool mixed = (input.value("precision", std::string("double")) == "mixed");
+    if (mixed)
+    {
+        CalibratePrecision(input, potential, envelope, sys, t);
+    }
+
+    std::vector<std::complex<double>> psi = sys.psi0;
+    RunOutput out;
+
+    //"segment_propagator" = "chebyshev": segments of constant drive in one Chebyshev step each
+    std::unique_ptr<StaticSegments> segments;
+    if (input.value("segment_propagator", std::string("rk4")) == "chebyshev")
+    {
+        segments.reset(new StaticSegments(input, sys, t, EnvelopeEdges(input)));
+    }
+
+    //"potential_pipeline" = n > 0: the potentials built ahead of the integrator by n threads, the first one on the
+    //envelope of the run
+    std::unique_ptr<PotentialPipeline> pipeline;
+    if (PipelineProducers(input) > 0)
+    {
+        producerEnvelopes.insert(producerEnvelopes.begin(), envelope);
+        pipeline.reset(new PotentialPipeline(input, potential, producerEnvelopes, sys, t, segments.get()));
+        RunReport()["pipeline"] = {{"producers", pipeline->Producers()}, {"depth", pipeline->Depth()}};
+    }
+
+    PropagateRK4(input, potential, envelope, sys, t, psi, Nprint, &out, segments.get(), pipeline.get());
+
+    std::cout << "Calculation completed...\n";
+
+    //work of the stage kernels as executed: 4 matvecs of D^2 complex multiply-adds (8 flops each, 16 bytes for each
+    //stored element of V) and the fused vector operations: the inputs s y + c p (7 vectors read), the stages and
+    //their weighted sum (8 vectors read or written) and the new state with its norm (3 vectors); 8 bytes for each
+    //element of V on the steps of mixed precision
+    double doubleSteps = 1.0;
+    if (mixed)
+    {
+        int resync  = input.value("precision_resync", 0);
+        doubleSteps = (resync > 0) ? 1.0/resync : 0.0;
+    }
+    double stageFlops = 32.0*D*D + 40.0*D;
+    double stageBytes = (16.0*doubleSteps + 8.0*(1.0 - doubleSteps))*4.0*StageElements(sys) + 16.0*18.0*D;
+    RunReport()["integrator"] = "rk4";
+    RunReport()["Dstates"]    = D;
+    RunReport()["steps"]      = Nstep;
+    //steps of the automatic Nstep probe and of the precision calibration run through the same kernels
+    double kernelSteps = (double)Nstep + RunReport().value("/nstep_auto/probe_steps"_json_pointer, 0.0)
+                       + 2.0*RunReport().value("/precision/window_steps"_json_pointer, 0.0);
+    if (segments)
+    {
+        std::cout << "Constant drive on " << segments->Count() << " segments: " << segments->Steps() << " steps replaced by "
+                  << segments->Terms() << " Chebyshev terms\n";
+        RunReport()["static_segments"] = {{"segments", segments->Count()}, {"steps", segments->Steps()}, {"chebyshev_terms", segments->Terms()}};
+        kernelSteps -= segments->Steps();
+    }
+    //the comparison runs share the phases of the run
+    ReportKernelWork("rk4_stages", PhaseName(PHASE_STAGES), kernelSteps + RunReport().value("/rk_comparison/work/steps"_json_pointer, 0.0),
+                     stageFlops*kernelSteps + RunReport().value("/rk_comparison/work/flops"_json_pointer, 0.0),
+                     stageBytes*kernelSteps + RunReport().value("/rk_comparison/work/bytes"_json_pointer, 0.0));
 
+    WriteOutput(prefix, D, out);
 }
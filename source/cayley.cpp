@@ -0,0 +1,352 @@
+#include "cayley.h"
+#include "potentials.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+//largest system solved by LU with "cayley_solver" = "auto"
+static const int directMaxD = 16;
+//GMRES: Krylov vectors before a restart and iterations before giving up
+static const int restart = 40;
+static const int maxIterations = 1000;
+
+//work of the linear solves of a run
+struct CayleyStats
+{
+    long solves = 0;
+    long iterations = 0;    //GMRES iterations (matvecs with A)
+    long unconverged = 0;   //GMRES solves stopped at maxIterations
+};
+
+//complex Givens rotation (c real) that zeroes b in (a, b)
+static void Rotation(std::complex<double> a, std::complex<double> b, double& c, std::complex<double>& s)
+{
+    double rho = std::hypot(std::abs(a), std::abs(b));
+    if (std::abs(a) == 0.0)
+    {
+        c = 0.0;
+        s = 1.0;
+        return;
+    }
+    c = std::abs(a)/rho;
+    s = (a/std::abs(a))*std::conj(b)/rho;
+}
+
+//solves A x = b by restarted GMRES preconditioned on the right by the diagonal of A, from the initial guess in x,
+//down to a residual of tol |b|; returns false if maxIterations are not enough
+static bool SolveGMRES(int D, const ComplexMatrix& A, const std::vector<std::complex<double>>& b, std::vector<std::complex<double>>& x, double tol, CayleyStats& stats)
+{
+    double bnorm = 0.0;
+    for (const auto& value : b)
+    {
+        bnorm += std::norm(value);
+    }
+    bnorm = std::sqrt(bnorm);
+    if (bnorm == 0.0)
+    {
+        std::fill(x.begin(), x.end(), 0.0);
+        return true;
+    }
+
+    std::vector<std::complex<double>> diagonal(D);
+    for (int i = 0; i < D; i++)
+    {
+        diagonal[i] = A[i*D + i];
+    }
+    //Arnoldi basis, Hessenberg matrix (column k in H[k]) and rotated right-hand side
+    static thread_local std::vector<std::vector<std::complex<double>>> V;
+    V.resize(restart + 1);
+    for (auto& v : V)
+    {
+        v.resize(D);
+    }
+    std::vector<std::vector<std::complex<double>>> H(restart, std::vector<std::complex<double>>(restart + 1));
+    std::vector<double> c(restart);
+    std::vector<std::complex<double>> s(restart);
+    std::vector<std::complex<double>> g(restart + 1);
+    std::vector<std::complex<double>> z(D);
+
+    int iterations = 0;
+    while (true)
+    {
+        //residual of the current x
+        std::vector<std::complex<double>>& r = V[0];
+        MatrixVector(D, A, x, r);
+        double beta = 0.0;
+        for (int i = 0; i < D; i++)
+        {
+            r[i] = b[i] - r[i];
+            beta += std::norm(r[i]);
+        }
+        beta = std::sqrt(beta);
+        if (beta <= tol*bnorm || iterations >= maxIterations)
+        {
+            stats.iterations += iterations;
+            return beta <= tol*bnorm;
+        }
+        for (int i = 0; i < D; i++)
+        {
+            r[i] /= beta;
+        }
+        std::fill(g.begin(), g.end(), 0.0);
+        g[0] = beta;
+
+        int k = 0;
+        while (k < restart && iterations < maxIterations)
+        {
+            //w = A M^-1 v_k, orthogonalized on the basis (modified Gram-Schmidt)
+            for (int i = 0; i < D; i++)
+            {
+                z[i] = V[k][i]/diagonal[i];
+            }
+            std::vector<std::complex<double>>& w = V[k+1];
+            MatrixVector(D, A, z, w);
+            for (int j = 0; j <= k; j++)
+            {
+                std::complex<double> overlap = 0.0;
+                for (int i = 0; i < D; i++)
+                {
+                    overlap += std::conj(V[j][i])*w[i];
+                }
+                H[k][j] = overlap;
+                for (int i = 0; i < D; i++)
+                {
+                    w[i] -= overlap*V[j][i];
+                }
+            }
+            double norm = 0.0;
+            for (int i = 0; i < D; i++)
+            {
+                norm += std::norm(w[i]);
+            }
+            norm = std::sqrt(norm);
+            H[k][k+1] = norm;
+            if (norm > 0.0)
+            {
+                for (int i = 0; i < D; i++)
+                {
+                    w[i] /= norm;
+                }
+            }
+
+            //least squares by the rotations of the previous columns and a new one
+            for (int j = 0; j < k; j++)
+            {
+                std::complex<double> upper = H[k][j];
+                H[k][j]   = c[j]*upper + s[j]*H[k][j+1];
+                H[k][j+1] = -std::conj(s[j])*upper + c[j]*H[k][j+1];
+            }
+            Rotation(H[k][k], H[k][k+1], c[k], s[k]);
+            H[k][k]   = c[k]*H[k][k] + s[k]*H[k][k+1];
+            H[k][k+1] = 0.0;
+            g[k+1] = -std::conj(s[k])*g[k];
+            g[k]   = c[k]*g[k];
+            k++;
+            iterations++;
+            if (std::abs(g[k]) <= tol*bnorm || norm == 0.0)
+            {
+                break;
+            }
+        }
+
+        //x += M^-1 V y with H y = g
+        std::vector<std::complex<double>> y(k);
+        for (int j = k-1; j >= 0; j--)
+        {
+            std::complex<double> sum = g[j];
+            for (int l = j+1; l < k; l++)
+            {
+                sum -= H[l][j]*y[l];
+            }
+            y[j] = sum/H[j][j];
+        }
+        for (int i = 0; i < D; i++)
+        {
+            std::complex<double> sum = 0.0;
+            for (int j = 0; j < k; j++)
+            {
+                sum += V[j][i]*y[j];
+            }
+            x[i] += sum/diagonal[i];
+        }
+    }
+}
+
+bool CheckCayley(const json& input)
+{
+    if (input.contains("cayley_order") && (!input["cayley_order"].is_number_integer() || (input["cayley_order"] != 2 && input["cayley_order"] != 4)))
+    {
+        std::cerr << "The specified cayley_order " << input["cayley_order"] << " is not supported, expected 2 or 4!\n";
+        return false;
+    }
+    if (input.contains("cayley_solver") && input["cayley_solver"] != "auto" && input["cayley_solver"] != "lu" && input["cayley_solver"] != "gmres")
+    {
+        std::cerr << "The specified cayley_solver " << input["cayley_solver"] << " is not supported, expected 'auto', 'lu' or 'gmres'!\n";
+        return false;
+    }
+    return true;
+}
+
+void EvolveCayley(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+    int order          = input.value("cayley_order", 4);
+    std::string solver = input.value("cayley_solver", std::string("auto"));
+    double tol         = input.value("cayley_tol", 1.0e-14);
+
+    SystemData sys = LoadSystem(input);
+    int D = sys.D;
+    bool direct = (solver == "lu") || (solver == "auto" && D <= directMaxD);
+    setupTimer.Stop();
+
+    //the drive is sampled inside the steps by the scalar envelope: the grid comes from a copy
+    EnvelopeFunction streamed = envelope;
+    std::vector<double> t = PrepareRun(input, potential, streamed, sys);
+    int Nstep = (int)t.size() - 1;
+
+    //drive factor d(s) and envelope from the potential of a single level with unit coupling (-i d(s))
+    std::vector<double> unitWl(1, 0.0);
+    std::vector<std::complex<double>> unitWr(1, std::complex<double>(1.0, 0.0));
+    std::vector<std::vector<std::complex<double>>> Vdrive(3, std::vector<std::complex<double>>(1));
+    std::vector<double> env(3, 0.0);
+    std::vector<double> env2(3, 0.0);
+    auto drive = [&](double s)
+    {
+        QQ_TIMER(PHASE_POTENTIAL);
+        potential(input, 1, s, 0.0, unitWl, unitWr, envelope, Vdrive, env, env2);
+        return -Vdrive[0][0].imag();
+    };
+
+    //substeps of a step: one (order 2) or the triple jump of Yoshida, symmetric so that the order rises to 4
+    std::vector<double> fractions(1, 1.0);
+    if (order == 4)
+    {
+        double gamma1 = 1.0/(2.0 - std::cbrt(2.0));
+        fractions = {gamma1, 1.0 - 2.0*gamma1, gamma1};
+    }
+
+    std::vector<std::complex<double>> psi = sys.psi0;
+    std::vector<std::complex<double>> rhs(D);
+    std::vector<std::complex<double>> phase(D);
+    ComplexMatrix A(D*D);
+    std::vector<int> pivot;
+    CayleyStats stats;
+    RunOutput out;
+    drive(t[0]);
+    out.t.push_back(t[0]);
+    out.env.push_back(env[2]);
+    out.psi.push_back(psi);
+
+    for (int i = 1; i < Nstep+1; i++)
+    {
+        double h = t[i] - t[i-1];
+        double start = t[i-1];
+        for (double fraction : fractions)
+        {
+            double tau = fraction*h;
+            double s = start + 0.5*tau;
+            double d = drive(s);
+            start += tau;
+
+            ScopedTimer stagesTimer(PHASE_STAGES);
+            PerfScope stagesCounters(PHASE_STAGES);
+            //A = I - tau/2 V at the midpoint, V_jk = -i d wr_jk exp(i (wl_j - wl_k) s/hbar); rhs = (2I - A) psi
+            for (int j = 0; j < D; j++)
+            {
+                double angle = sys.wl[j]*s/hbar;
+                phase[j] = std::complex<double>(std::cos(angle), std::sin(angle));
+            }
+            std::complex<double> scale(0.0, 0.5*tau*d);
+            for (int j = 0; j < D; j++)
+            {
+                std::complex<double> row = scale*phase[j];
+                rhs[j] = 2.0*psi[j];
+                for (int k = 0; k < D; k++)
+                {
+                    A[j*D + k] = row*sys.wr[j*D + k]*std::conj(phase[k]);
+                    rhs[j] -= A[j*D + k]*psi[k];
+                }
+                A[j*D + j] += 1.0;
+                rhs[j] -= psi[j];
+            }
+
+            if (direct)
+            {
+                if (!LUFactor(D, A, pivot))
+                {
+                    std::cerr << "Warning: singular Cayley system at step " << i << "\n";
+                    continue;
+                }
+                LUSolve(D, A, pivot, rhs);
+                psi.swap(rhs);
+            }
+            else
+            {
+                //first-order guess psi + tau V psi = 2 rhs - psi
+                std::vector<std::complex<double>> x(D);
+                for (int j = 0; j < D; j++)
+                {
+                    x[j] = 2.0*rhs[j] - psi[j];
+                }
+                if (!SolveGMRES(D, A, rhs, x, tol, stats))
+                {
+                    stats.unconverged++;
+                }
+                psi.swap(x);
+            }
+            stats.solves++;
+        }
+
+        if (i % Nprint == 0 || i == Nstep)
+        {
+            QQ_TIMER(PHASE_OUTPUT);
+            drive(t[i]);
+            out.psi.push_back(psi);
+            out.env.push_back(env[2]);
+            out.t.push_back(t[i]);
+        }
+    }
+
+    std::cout << "Calculation completed...\n";
+
+    //nothing renormalizes the state: its norm shows the error of the solves alone
+    double normError = 0.0;
+    for (const auto& row : out.psi)
+    {
+        double norm = 0.0;
+        for (const auto& value : row)
+        {
+            norm += std::norm(value);
+        }
+        normError = std::max(normError, std::abs(std::sqrt(norm) - 1.0));
+    }
+    std::cout << "Cayley steps: order " << order << ", " << stats.solves << " " << (direct ? "LU" : "GMRES") << " solves";
+    if (!direct)
+    {
+        std::cout << ", " << (double)stats.iterations/std::max(1L, stats.solves) << " iterations per solve";
+    }
+    std::cout << ", largest norm error " << normError << "\n";
+    if (stats.unconverged > 0)
+    {
+        std::cerr << "Warning: " << stats.unconverged << " GMRES solves did not reach cayley_tol\n";
+    }
+
+    RunReport()["integrator"] = "cayley";
+    RunReport()["Dstates"]    = D;
+    RunReport()["steps"]      = Nstep;
+    RunReport()["cayley"]     = {{"order", order}, {"solver", direct ? "lu" : "gmres"}, {"tol", tol},
+                                 {"solves", stats.solves}, {"gmres_iterations", stats.iterations},
+                                 {"unconverged", stats.unconverged}, {"norm_error", normError}};
+    //assembly of A and rhs (D^2 complex products), then LU (8/3 D^3 flops) or GMRES iterations (a matvec each)
+    double solveFlops = direct ? 8.0/3.0*D*D*D + 8.0*D*D : 8.0*D*D*(double)stats.iterations/std::max(1L, stats.solves);
+    double solveBytes = direct ? 16.0*D*D : 16.0*D*D*(double)stats.iterations/std::max(1L, stats.solves);
+    ReportKernelWork("cayley_solves", PhaseName(PHASE_STAGES), (double)Nstep, (solveFlops + 20.0*D*D)*stats.solves, (solveBytes + 32.0*D*D)*stats.solves);
+
+    WriteOutput(prefix, D, out);
+}
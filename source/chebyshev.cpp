@@ -0,0 +1,205 @@
+#include "chebyshev.h"
+#include "envelopes.h"
+#include "potentials.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+//values beyond which the backward recurrence is rescaled
+static const double besselRescale = 1.0e200;
+
+//J_0(alpha), ..., J_K(alpha) up to the last order with |J_k| above tol, by Miller's backward recurrence
+//J_{k-1} = 2k/alpha J_k - J_{k+1} normalized with J_0 + 2 (J_2 + J_4 + ...) = 1
+static std::vector<double> BesselSeries(double alpha, double tol)
+{
+    if (alpha == 0.0)
+    {
+        return std::vector<double>(1, 1.0);
+    }
+    //beyond alpha the orders decay like the Airy function over a width alpha^(1/3)
+    int start = (int)(alpha + 15.0*std::cbrt(alpha) + 30.0);
+    std::vector<double> J(start + 2, 0.0);
+    J[start] = 1.0e-30;
+    for (int k = start; k > 0; k--)
+    {
+        J[k-1] = 2.0*k/alpha*J[k] - J[k+1];
+        if (std::abs(J[k-1]) > besselRescale)
+        {
+            for (int m = k-1; m <= start; m++)
+            {
+                J[m] /= besselRescale;
+            }
+        }
+    }
+    double sum = J[0];
+    for (int k = 2; k <= start; k += 2)
+    {
+        sum += 2.0*J[k];
+    }
+    int K = start;
+    while (K > 0 && std::abs(J[K]/sum) < tol)
+    {
+        K--;
+    }
+    J.resize(K + 1);
+    for (double& value : J)
+    {
+        value /= sum;
+    }
+    return J;
+}
+
+int ChebyshevPropagate(int D, const ComplexMatrix& H, double tau, std::vector<std::complex<double>>& psi, double tol)
+{
+    //spectrum in [center - radius, center + radius] by the Gershgorin discs
+    double lower = 0.0;
+    double upper = 0.0;
+    for (int i = 0; i < D; i++)
+    {
+        double reach = 0.0;
+        for (int j = 0; j < D; j++)
+        {
+            if (j != i)
+            {
+                reach += std::abs(H[i*D + j]);
+            }
+        }
+        double diagonal = H[i*D + i].real();
+        lower = (i == 0) ? diagonal - reach : std::min(lower, diagonal - reach);
+        upper = (i == 0) ? diagonal + reach : std::max(upper, diagonal + reach);
+    }
+    double center = 0.5*(upper + lower);
+    double radius = 0.5*(upper - lower);
+    std::complex<double> shift(std::cos(center*tau), -std::sin(center*tau));
+    if (radius == 0.0)
+    {
+        for (auto& value : psi)
+        {
+            value *= shift;
+        }
+        return 0;
+    }
+
+    //exp(-i H tau) = exp(-i center tau) (J_0 + 2 sum_k (-i)^k J_k(radius tau) T_k(Hs)), Hs = (H - center)/radius
+    std::vector<double> J = BesselSeries(radius*tau, tol);
+    int terms = (int)J.size();
+
+    std::vector<std::complex<double>> previous = psi;
+    std::vector<std::complex<double>> current(D);
+    std::vector<std::complex<double>> next(D);
+    std::vector<std::complex<double>> result(D);
+    auto scaled = [&](const std::vector<std::complex<double>>& x, std::vector<std::complex<double>>& y)
+    {
+        for (int i = 0; i < D; i++)
+        {
+            std::complex<double> sum = -center*x[i];
+            for (int j = 0; j < D; j++)
+            {
+                sum += H[i*D + j]*x[j];
+            }
+            y[i] = sum/radius;
+        }
+    };
+
+    const std::complex<double> minusI(0.0, -1.0);
+    for (int i = 0; i < D; i++)
+    {
+        result[i] = J[0]*previous[i];
+    }
+    if (terms > 1)
+    {
+        scaled(previous, current);
+        std::complex<double> coefficient = 2.0*J[1]*minusI;
+        for (int i = 0; i < D; i++)
+        {
+            result[i] += coefficient*current[i];
+        }
+    }
+    std::complex<double> power = minusI;
+    for (int k = 2; k < terms; k++)
+    {
+        //T_k = 2 Hs T_{k-1} - T_{k-2}
+        scaled(current, next);
+        power *= minusI;
+        std::complex<double> coefficient = 2.0*J[k]*power;
+        for (int i = 0; i < D; i++)
+        {
+            next[i] = 2.0*next[i] - previous[i];
+            result[i] += coefficient*next[i];
+        }
+        previous.swap(current);
+        current.swap(next);
+    }
+    for (int i = 0; i < D; i++)
+    {
+        psi[i] = shift*result[i];
+    }
+    return terms;
+}
+
+StaticSegments::StaticSegments(const json& input, const SystemData& sys, const std::vector<double>& t, const std::vector<double>& edges)
+    : sys_(sys), tol_(input.value("chebyshev_tol", 1.0e-14))
+{
+    int D = sys.D;
+    double ti = t.front();
+    double tf = t.back();
+    double margin = 1.0e-12*(tf-ti);
+    segmentOf_.assign(t.size(), -1);
+
+    std::vector<double> bounds(1, ti);
+    bounds.insert(bounds.end(), edges.begin(), edges.end());
+    bounds.push_back(tf);
+    for (int s = 0; s + 1 < (int)bounds.size(); s++)
+    {
+        double envelope;
+        double drive;
+        if (!StaticDrive(input, bounds[s], bounds[s+1], envelope, drive))
+        {
+            continue;
+        }
+        //grid points inside the segment (its ends if the grid is aligned to the edges)
+        Segment segment;
+        segment.first = (int)(std::lower_bound(t.begin(), t.end(), bounds[s] - margin) - t.begin());
+        segment.last  = (int)(std::upper_bound(t.begin(), t.end(), bounds[s+1] + margin) - t.begin()) - 1;
+        if (segment.first >= segment.last)
+        {
+            continue;
+        }
+        segment.envelope = envelope;
+        if (drive != 0.0)
+        {
+            segment.H.assign(D*D, 0.0);
+            for (int i = 0; i < D; i++)
+            {
+                for (int j = 0; j < D; j++)
+                {
+                    segment.H[i*D + j] = drive*sys.wr[i*D + j];
+                }
+                segment.H[i*D + i] += sys.wl[i]/hbar;
+            }
+        }
+        for (int i = segment.first; i < segment.last; i++)
+        {
+            segmentOf_[i] = (int)segments_.size();
+        }
+        segments_.push_back(segment);
+    }
+}
+
+int StaticSegments::Advance(const std::vector<double>& t, int i, int Nprint, std::vector<std::complex<double>>& psi, double& envelope)
+{
+    const Segment& segment = segments_[segmentOf_[i-1]];
+    int start = i-1;
+    int end = std::min(segment.last, (start/Nprint + 1)*Nprint);
+
+    //without drive the interaction-picture state does not change; otherwise exp(-i H dt) in the laboratory frame
+    if (!segment.H.empty())
+    {
+        FramePhase(sys_, t[start], -1.0, psi);
+        terms_ += ChebyshevPropagate(sys_.D, segment.H, t[end] - t[start], psi, tol_);
+        FramePhase(sys_, t[end], 1.0, psi);
+    }
+    steps_ += end - start;
+    envelope = segment.envelope;
+    return end;
+}
@@ -5,11 +5,62 @@
 #include <functional>
 #include <complex>
 #include <vector>
+#include <string>
 
 using json = nlohmann::json;
 using EnvelopeFunction  = std::function<void(const json&, double*, std::vector<double>& , std::vector<double>&)>;
 using PotentialFunction = std::function<void(const json& , int, double, double , std::vector<double>& , std::vector<std::complex<double>>& , EnvelopeFunction , std::vector<std::vector<std::complex<double>>>& , std::vector<double>&, std::vector<double>&)>;
 using SimulationFunction = std::function<void(const json&, PotentialFunction, EnvelopeFunction)>;
 
+//system data read from input: levels, couplings (row-major D*D) and initial state; symmetric couplings are also
+//kept as their upper triangle (rows from the diagonal packed one after the other), on which the RK stages work
+struct SystemData
+{
+    int D;
+    std::vector<double> wl;
+    std::vector<std::complex<double>> wr;
+    std::vector<std::complex<double>> psi0;
+    bool packed = false;
+    std::vector<std::complex<double>> wrPacked;
+};
+
+//complex vector by its real and imaginary parts: state and stages of the explicit integrators, which are turned
+//into std::complex only for the output and the Chebyshev segments
+struct SplitState
+{
+    std::vector<double> re;
+    std::vector<double> im;
+};
+
+//rows saved during a run: time, envelope and state
+struct RunOutput
+{
+    std::vector<double> t;
+    std::vector<double> env;
+    std::vector<std::vector<std::complex<double>>> psi;
+};
+
+class StaticSegments;
+class PotentialPipeline;
+
+SystemData LoadSystem(const json& input);
+void FramePhase(const SystemData& sys, double t, double sign, std::vector<std::complex<double>>& psi);
+std::vector<double> TimeGrid(double ti, double tf, int Nstep);
+std::vector<double> TimeGrid(double ti, double tf, int Nstep, const std::vector<double>& edges);
+//psi by parts and back
+void SplitParts(const std::vector<std::complex<double>>& psi, SplitState& parts);
+void JoinParts(const SplitState& parts, std::vector<std::complex<double>>& psi);
+//K = V x (V row-major D*D): the matrix-vector product of a Runge-Kutta stage
+void StageKernel(int D, const std::complex<double>* V, const SplitState& x, SplitState& K);
+//K = V x for the anti-Hermitian V given by its packed upper triangle (SystemData::packed)
+void PackedStageKernel(int D, const std::complex<double>* V, const SplitState& x, SplitState& K);
+//elements of the potential matrices of the stages: D*D, or D(D+1)/2 for packed couplings
+int StageElements(const SystemData& sys);
+//psi <- psi/|psi|, warning (and leaving psi as it is) if the norm is not finite or zero
+void NormalizeState(SplitState& psi, int step);
+void PropagateRK4(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& t, std::vector<std::complex<double>>& psi, int Nprint, RunOutput* out, StaticSegments* segments = nullptr, PotentialPipeline* pipeline = nullptr);
+std::vector<double> PrepareRun(const json& input, PotentialFunction potential, EnvelopeFunction& envelope, SystemData& sys, std::vector<EnvelopeFunction>* others = nullptr);
+void WriteOutput(const std::string& prefix, int D, const RunOutput& out);
+
 void EvolveRK4(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
 #endif
@@ -0,0 +1,18 @@
+#ifndef CAYLEY_H
+#define CAYLEY_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include "linalg.h"
+
+using json = nlohmann::json;
+
+//check the options of the cayley integrator: "cayley_order" (2 or 4) and "cayley_solver" ("auto", "lu" or "gmres")
+bool CheckCayley(const json& input);
+
+//executes the simulation with Cayley (Crank-Nicolson) steps psi <- (I - h/2 V)^-1 (I + h/2 V) psi, V = -i H
+//at the midpoint of the step, which are unitary for the anti-Hermitian V: the norm is kept without renormalizing.
+//Order 2, or 4 by the symmetric composition of three steps; the linear systems are solved by LU for small
+//systems and by GMRES (diagonal preconditioning) for large ones
+void EvolveCayley(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
+#endif
@@ -0,0 +1,50 @@
+#ifndef CHEBYSHEV_H
+#define CHEBYSHEV_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include "linalg.h"
+#include <vector>
+
+using json = nlohmann::json;
+
+//psi <- exp(-i H tau) psi for the Hermitian H (rad/s) by its Chebyshev expansion on the Gershgorin bound
+//of the spectrum, truncated where the Bessel coefficients fall below tol; returns the number of terms
+int ChebyshevPropagate(int D, const ComplexMatrix& H, double tau, std::vector<std::complex<double>>& psi, double tol);
+
+//segments of the time grid (between envelope edges) where the drive factor is constant (see StaticDrive):
+//there the laboratory Hamiltonian wl/hbar + drive wr does not depend on time and one Chebyshev step
+//replaces the RK4 steps up to the next saved row; segments without drive are skipped exactly
+class StaticSegments
+{
+public:
+    StaticSegments(const json& input, const SystemData& sys, const std::vector<double>& t, const std::vector<double>& edges);
+
+    //step i (from t[i-1]) lies in a static segment
+    bool Contains(int i) const { return i-1 < (int)segmentOf_.size() && segmentOf_[i-1] >= 0; }
+
+    //advance psi from t[i-1] to the end of the segment or the row saved every Nprint steps, whichever comes first;
+    //returns the grid index reached and the envelope there
+    int Advance(const std::vector<double>& t, int i, int Nprint, std::vector<std::complex<double>>& psi, double& envelope);
+
+    int Count() const { return (int)segments_.size(); }
+    int Steps() const { return steps_; }
+    long Terms() const { return terms_; }
+
+private:
+    struct Segment
+    {
+        int first;          //grid indices of the ends
+        int last;
+        double envelope;
+        ComplexMatrix H;    //empty if there is no drive
+    };
+
+    const SystemData& sys_;
+    double tol_;
+    std::vector<Segment> segments_;
+    std::vector<int> segmentOf_;    //segment of the step starting at each grid point, -1 if not static
+    int steps_ = 0;                 //grid steps covered by the segments
+    long terms_ = 0;                //Chebyshev terms applied
+};
+#endif
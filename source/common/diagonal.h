@@ -0,0 +1,40 @@
+#ifndef DIAGONAL_H
+#define DIAGONAL_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include <complex>
+#include <vector>
+
+using json = nlohmann::json;
+
+//integrating factor of the diagonal drive -i d(t) wr_kk: the state is carried as phi_k = exp(i wr_kk Theta(t)) psi_k,
+//Theta(t) = int d(s) ds from the start of the run, and RK4 integrates only the off-diagonal couplings
+//V_jk exp(i (wr_jj - wr_kk) Theta). Theta is integrated step by step by the Filon rule: the envelope is the quadratic
+//through its samples at t, t+dt/2, t+dt and the carrier is integrated exactly, which is exact for square envelopes
+class DiagonalDrive
+{
+public:
+    DiagonalDrive(const json& input, const SystemData& sys);
+
+    //potential matrices of the step [t, t+dt] (envelope samples env, env2 as left by the potential) turned into
+    //those of phi; advances Theta to t+dt
+    void Apply(double t, double dt, const std::vector<double>& env, const std::vector<double>& env2, std::vector<std::vector<std::complex<double>>>& Vmatrices);
+
+    //psi from phi at the end of the last step
+    void ToState(std::vector<std::complex<double>>& phi) const;
+
+private:
+    int D_;
+    double w1_;
+    double w2_;
+    bool twoCarriers_;
+    std::vector<double> diagonal_;              //wr_kk
+    double theta_ = 0.0;                        //Theta at the end of the last step
+    std::vector<double> cosines_;               //parts of the phases exp(i wr_kk Theta) at a point of the step
+    std::vector<double> sines_;
+};
+
+//check "diagonal_drive" ("rk4" or "exact"; exact needs the rk4 integrator, one carrier per envelope and no Chebyshev segments)
+bool CheckDiagonalDrive(const json& input);
+#endif
@@ -2,11 +2,16 @@
 #define ENVELOPES_H
 
 #include "json.hpp"
+#include "vecmath.h"
 #include <functional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 using json = nlohmann::json;
 using EnvelopeFunction = std::function<void(const json&, double*, std::vector<double>&, std::vector<double>&)>;
+//batched envelope: env and env2 at the n time points tvec[0..n-1]
+using EnvelopeBlockFunction = std::function<void(const json&, const double*, int, double*, double*)>;
 
 void off(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2);
 void constant(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2);
@@ -14,4 +19,24 @@ void impulse(const json& input, double* tvec, std::vector<double>& env, std::vec
 void gauss(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2);
 void double_impulse(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2);
 void double_gauss(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2);
-#endif
\ No newline at end of file
+
+void off_block(const json& input, const double* tvec, int n, double* env, double* env2);
+void constant_block(const json& input, const double* tvec, int n, double* env, double* env2);
+void impulse_block(const json& input, const double* tvec, int n, double* env, double* env2);
+void gauss_block(const json& input, const double* tvec, int n, double* env, double* env2);
+void double_impulse_block(const json& input, const double* tvec, int n, double* env, double* env2);
+void double_gauss_block(const json& input, const double* tvec, int n, double* env, double* env2);
+
+//times in (ti, tf) where the envelope of the input jumps (edges of square pulses), sorted
+std::vector<double> EnvelopeEdges(const json& input);
+
+//true if the drive factor envelope*cos(w t) is constant on the segment (a, b) between edges: no pulse active,
+//or square envelopes with zero carrier frequency; envelope (as saved in the output) and drive are their values there
+bool StaticDrive(const json& input, double a, double b, double& envelope, double& drive);
+
+//batched envelopes by envelope name (new envelope modes register here)
+std::unordered_map<std::string, EnvelopeBlockFunction>& EnvelopeBlocks();
+
+//batched version of the envelope "name", or a loop over the scalar envelope if it has none
+EnvelopeBlockFunction FindEnvelopeBlock(const std::string& name, EnvelopeFunction scalar);
+#endif
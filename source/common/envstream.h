@@ -0,0 +1,72 @@
+#ifndef ENVSTREAM_H
+#define ENVSTREAM_H
+
+#include "json.hpp"
+#include "envelopes.h"
+#include <memory>
+#include <vector>
+
+using json = nlohmann::json;
+
+//envelope values of the next steps, evaluated a block at a time by a batched envelope.
+//Steps are served in order from the buffer of the half-step grid t, t+dt/2, t+dt, t+3dt/2, ...;
+//when the requested times leave the grid (new dt, jump in time) the buffer is refilled from there.
+class EnvelopeStream
+{
+public:
+    EnvelopeStream(const json& input, EnvelopeBlockFunction block, int blockSteps);
+
+    //envelope at tvec[0..2] = t, t+dt/2, t+dt
+    void Fetch(double* tvec, std::vector<double>& env, std::vector<double>& env2);
+
+private:
+    void Fill(double t, double dt);
+
+    const json& input_;
+    EnvelopeBlockFunction block_;
+    int blockSteps_;
+    double t0_;
+    double dt_;
+    std::vector<double> times_;
+    std::vector<double> env_;
+    std::vector<double> env2_;
+};
+
+//envelope sampled on a uniform grid over [ti, tf] and evaluated by cubic Lagrange interpolation
+//on the 4 nearest samples; the grid is refined until the estimated interpolation error
+//is below tol times the largest envelope
+class EnvelopeTable
+{
+public:
+    //returns nullptr if the tolerance cannot be reached (e.g. discontinuous envelopes)
+    static std::shared_ptr<EnvelopeTable> Build(const json& input, EnvelopeBlockFunction block, double ti, double tf, double tol);
+
+    void Evaluate(const double* tvec, int n, double* env, double* env2) const;
+
+    int    Points() const     { return (int)env_.size(); }
+    double ErrorBound() const { return errorBound_; }
+    double MeasuredError() const { return measuredError_; }
+
+private:
+    double t0_;
+    double h_;
+    std::vector<double> env_;
+    std::vector<double> env2_;
+    double errorBound_;
+    double measuredError_;
+};
+
+//batched version of the input envelope, through a precomputed EnvelopeTable if "envelope_table" is true
+EnvelopeBlockFunction ResolveEnvelopeBlock(const json& input, EnvelopeFunction scalar);
+
+//envelope function served by an EnvelopeStream of block; each integration thread needs its own
+EnvelopeFunction StreamEnvelope(const json& input, EnvelopeBlockFunction block);
+
+//times tvec of a step with the ends lying on an edge (see EnvelopeEdges) moved just inside the step,
+//where the envelope takes its limit from inside; returns false if no end lies on an edge
+bool InsideEdgeTimes(const std::vector<double>& edges, const double* tvec, double* inside);
+
+//envelope whose values at the ends of a step lying on an edge are the limits from inside the step,
+//evaluated by scalar at the InsideEdgeTimes
+EnvelopeFunction EdgeAwareEnvelope(EnvelopeFunction envelope, EnvelopeFunction scalar, const std::vector<double>& edges);
+#endif
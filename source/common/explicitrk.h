@@ -0,0 +1,39 @@
+#ifndef EXPLICITRK_H
+#define EXPLICITRK_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+//Butcher tableau of a fixed-step explicit Runge-Kutta method
+struct ButcherTableau
+{
+    std::string name;
+    int order;
+    std::vector<double> c;                  //nodes
+    std::vector<std::vector<double>> a;     //stage coefficients, row i has i entries
+    std::vector<double> b;                  //weights
+    //potential evaluations of a step, as (start, length) fractions of the step: each gives V at start,
+    //start+length/2 and start+length, together covering all the nodes (the first one is the step itself)
+    std::vector<std::pair<double, double>> windows;
+};
+
+//tableau of the explicit integrator "rk6" (Butcher, 7 stages) or "rk8" (Cooper-Verner, 11 stages); nullptr for others
+const ButcherTableau* FindTableau(const std::string& name);
+
+//integration of psi along the time grid t by the explicit method of tableau, with the stage kernel and the
+//normalization of PropagateRK4, saving every Nprint steps (and the last one) in out. The first window of a step
+//is evaluated with envelope, the others (inside the step) with scalar
+void PropagateExplicitRK(const json& input, PotentialFunction potential, EnvelopeFunction envelope, EnvelopeFunction scalar, const ButcherTableau& tableau, SystemData& sys, const std::vector<double>& t, std::vector<std::complex<double>>& psi, int Nprint, RunOutput* out);
+
+//runs rk4, rk6 and rk8 on the grid t and against rk8 on the grid of halved steps: prints and adds to the run report
+//("rk_comparison") the time, population error and the steps and time extrapolated to the error "rk_compare_tol"
+void CompareExplicitRK(const json& input, PotentialFunction potential, EnvelopeFunction envelope, EnvelopeFunction scalar, SystemData& sys, const std::vector<double>& t, int Nprint);
+
+//executes the simulation with the explicit method named by "integrator" ("rk6" or "rk8"); with "rk_compare" = true
+//the methods are compared first (see CompareExplicitRK)
+void EvolveExplicitRK(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
+#endif
@@ -0,0 +1,45 @@
+#ifndef EXPRENV_H
+#define EXPRENV_H
+
+#include "json.hpp"
+#include "envelopes.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+//envelope given as a formula of the time t, e.g. "F1*exp(-((t-t1)/s)^2/2)*sin(pi*t/T)^2".
+//Other names are numbers of the input file (or the constants pi and e) and are fixed when the formula
+//is compiled; constant subexpressions are folded and the rest becomes a short register bytecode
+//whose instructions are executed on blocks of time points.
+//Operators: + - * / ^ and parentheses; functions: exp log sqrt abs sin cos tan sinh cosh tanh atan
+//step (1 for x >= 0, 0 otherwise), min(x,y), max(x,y), pow(x,y)
+class ExprProgram
+{
+public:
+    //returns nullptr (after printing the reason) if the formula is not valid
+    static std::shared_ptr<ExprProgram> Compile(const std::string& text, const json& input);
+
+    void Evaluate(const double* tvec, int n, double* out) const;
+
+    int Instructions() const { return (int)code_.size(); }
+    int Registers() const    { return registers_; }
+
+    struct Instruction
+    {
+        int op;
+        int dst;
+        int a;
+        int b;
+        double c;
+    };
+
+private:
+    std::vector<Instruction> code_;
+    int registers_ = 1;
+};
+
+//compile the "expr" envelope and register its batched version; sets scalar on success
+bool LoadExprEnvelope(const json& input, EnvelopeFunction& scalar);
+#endif
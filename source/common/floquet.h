@@ -0,0 +1,21 @@
+#ifndef FLOQUET_H
+#define FLOQUET_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include "linalg.h"
+
+using json = nlohmann::json;
+
+//check the input of the floquet integrator: a period (default 2 pi/w1) that fits at least once in [ti, tf]
+//and is a whole number of cycles of every carrier (w2 too if secondCarrier), so that the drive repeats in the laboratory frame
+bool CheckPeriod(const json& input, bool secondCarrier);
+
+//interaction-picture propagator U(t.back(), t.front()) by RK4 on the D columns at once along the grid t
+void PeriodPropagator(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& t, ComplexMatrix& U);
+
+//executes the simulation of a periodic drive: one period is integrated into its propagator,
+//which then advances the state Nprint periods at a time (powers by squaring); also writes
+//the Floquet quasi-energies to prefix_floquet.txt
+void EvolveFloquet(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
+#endif
@@ -0,0 +1,78 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <string>
+#include <vector>
+
+//stage of an RK4 step fused with the vector operations around it: the input x = s y + c p is formed as it is
+//interleaved for the product, and the output is K = V x with A = K (FUSED_START) or A += w K (FUSED_ACCUMULATE),
+//or, for FUSED_FINISH, the new state y = s y + w (A + K) in place of K, whose squared norm is returned. p may be K
+//(the input is formed before any output), it is not read if c is zero
+enum FusedOutput
+{
+    FUSED_START,
+    FUSED_ACCUMULATE,
+    FUSED_FINISH
+};
+
+struct FusedStage
+{
+    FusedOutput output;
+    double* yr;
+    double* yi;
+    double s;
+    const double* pr;
+    const double* pi;
+    double c;
+    double* Kr;
+    double* Ki;
+    double* Ar;
+    double* Ai;
+    double w;
+};
+
+//hot kernels compiled once per instruction set (kernels.cpp is built as kernels_sse2.o, kernels_avx2.o and
+//kernels_avx512.o) and selected at startup from the CPUID of the node. Complex arrays are interleaved (re, im)
+//unless given by their real and imaginary parts.
+struct KernelTable
+{
+    const char* isa;
+    //K = V x for the D x D row-major matrix V (stages of the explicit integrators), x and K in split real and
+    //imaginary parts
+    void (*stage)(int D, const double* V, const double* xr, const double* xi, double* Kr, double* Ki);
+    //the same for the anti-Hermitian V given by its upper triangle, rows from the diagonal packed one after the other
+    void (*stagePacked)(int D, const double* V, const double* xr, const double* xi, double* Kr, double* Ki);
+    //the stage f, the norm of the new state for FUSED_FINISH (0 otherwise)
+    double (*stageFused)(int D, const double* V, const FusedStage& f);
+    double (*stagePackedFused)(int D, const double* V, const FusedStage& f);
+    //the same on complex<float> matrices, with x rounded to float and the products summed in float
+    double (*stageFusedFloat)(int D, const float* V, const FusedStage& f);
+    double (*stagePackedFusedFloat)(int D, const float* V, const FusedStage& f);
+    //V_ij = -i drive wr_ij p_i conj(p_j) (potential matrix at one point of the step)
+    void (*drive)(int D, double drive, const double* wr, const double* p, double* V);
+    //the same on the packed upper triangles of wr and V
+    void (*drivePacked)(int D, double drive, const double* wr, const double* p, double* V);
+    //both rounded to complex<float> matrices
+    void (*driveFloat)(int D, double drive, const double* wr, const double* p, float* V);
+    void (*drivePackedFloat)(int D, double drive, const double* wr, const double* p, float* V);
+    //y = exp(x) and s, c = sin(x), cos(x) of n values, with the looser polynomials if fast (see vecmath.h)
+    void (*exp)(const double* x, double* y, int n, bool fast);
+    void (*sincos)(const double* x, double* s, double* c, int n, bool fast);
+};
+
+namespace kernels_sse2   { extern const KernelTable table; }
+namespace kernels_avx2   { extern const KernelTable table; }
+namespace kernels_avx512 { extern const KernelTable table; }
+
+//kernels of the selected instruction set: the widest one supported by the cpu unless forced by SelectKernels
+const KernelTable& Kernels();
+
+//select the instruction set by name ("auto", "sse2", "avx2" or "avx512"); false if unknown or not supported by the cpu
+bool SelectKernels(const std::string& name);
+
+//true if the instruction set was forced by SelectKernels
+bool KernelsForced();
+
+//instruction sets supported by the cpu, from the narrowest
+std::vector<std::string> SupportedKernels();
+#endif
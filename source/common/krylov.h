@@ -0,0 +1,63 @@
+#ifndef KRYLOV_H
+#define KRYLOV_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include <complex>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using json = nlohmann::json;
+
+//y = A x for vectors of the dimension of the system
+using MatVecFunction = std::function<void(const std::complex<double>*, std::complex<double>*)>;
+
+//work and error of the Krylov exponentials of a run
+struct KrylovStats
+{
+    long exponentials = 0;      //exp(-i tau A) psi requested
+    long substeps = 0;          //pieces of tau actually applied (more than one if the subspace was too small)
+    long matvecs = 0;
+    double errorEstimate = 0.0; //sum of the a posteriori estimates of the pieces
+};
+
+//psi <- exp(-i tau A) psi for the Hermitian A given by its matvec, in the Lanczos subspace of psi.
+//The subspace grows until the estimate tau beta_m |e_m^T exp(-i tau T_m) e_1| |psi| of the truncation error
+//is below tol; if maxDimension is reached first, tau is split and the pieces are applied one after the other.
+//Returns false if a piece still misses tol after 60 halvings
+bool KrylovExp(int D, MatVecFunction apply, double tau, std::vector<std::complex<double>>& psi, int maxDimension, double tol, KrylovStats& stats);
+
+//laboratory Hamiltonian levels wl/hbar + drive wr (rad/s), with wr stored dense (row-major)
+//or in compressed sparse rows of its nonzero entries
+class LabHamiltonian
+{
+public:
+    //wr from "wr" (dense, must be symmetric) or "wr_sparse" (list of [i, j, value], each coupling once);
+    //layout from "wr_layout" ("dense", "sparse" or "auto": sparse below a quarter of nonzero entries).
+    //Returns nullptr (after printing the reason) if the couplings are not valid
+    static std::shared_ptr<LabHamiltonian> Load(const json& input, const SystemData& sys);
+
+    //y = (level wl/hbar + drive wr) x
+    void Apply(double level, double drive, const std::complex<double>* x, std::complex<double>* y) const;
+
+    bool Sparse() const   { return sparse_; }
+    long Nonzeros() const { return (long)values_.size(); }
+
+private:
+    int D_ = 0;
+    bool sparse_ = false;
+    std::vector<double> levels_;                //wl/hbar
+    std::vector<std::complex<double>> dense_;   //D*D row-major if not sparse
+    std::vector<long> rowStart_;                //CSR: entries of row i in [rowStart_[i], rowStart_[i+1])
+    std::vector<int> column_;
+    std::vector<std::complex<double>> values_;  //nonzero entries (also kept in the dense layout, to count them)
+};
+
+//check the couplings of the krylov integrator before the run (see LabHamiltonian::Load)
+bool CheckCouplings(const json& input);
+
+//executes the simulation with commutator-free fourth-order Magnus steps in the laboratory frame,
+//exp(-i h B2) exp(-i h B1) with B1, B2 combinations of H at the two Gauss points, each applied by KrylovExp
+void EvolveKrylov(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
+#endif
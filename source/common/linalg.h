@@ -0,0 +1,41 @@
+#ifndef LINALG_H
+#define LINALG_H
+
+#include <complex>
+#include <vector>
+
+//dense complex D*D matrix stored row-major, like the couplings wr of SystemData
+using ComplexMatrix = std::vector<std::complex<double>>;
+
+ComplexMatrix IdentityMatrix(int D);
+
+//C = A*B (C must not alias A or B)
+void MatrixMultiply(int D, const ComplexMatrix& A, const ComplexMatrix& B, ComplexMatrix& C);
+
+//y = A*x (y must not alias x)
+void MatrixVector(int D, const ComplexMatrix& A, const std::vector<std::complex<double>>& x, std::vector<std::complex<double>>& y);
+
+//A^n by repeated squaring: about 2 log2(n) products
+ComplexMatrix MatrixPower(int D, const ComplexMatrix& A, long n);
+
+//largest entry of |A^H A - I|
+double UnitarityError(int D, const ComplexMatrix& U);
+
+//eigenvalues (ascending) and eigenvectors (columns of vectors) of the Hermitian matrix H, by cyclic Jacobi rotations
+void HermitianEigen(int D, const ComplexMatrix& H, std::vector<double>& values, ComplexMatrix& vectors);
+
+//unitary factor of the polar decomposition A = U P: U = A (A^H A)^-1/2, the unitary matrix closest to A
+//(A must be invertible)
+void PolarUnitary(int D, const ComplexMatrix& A, ComplexMatrix& U);
+
+//eigenphases (arguments of the eigenvalues, in (-pi, pi]) and eigenvectors (columns) of the unitary matrix U,
+//from the Hermitian eigenproblem of a combination of its commuting Hermitian and anti-Hermitian parts
+void UnitaryEigen(int D, const ComplexMatrix& U, std::vector<double>& phases, ComplexMatrix& vectors);
+
+//A = P L U in place by Gaussian elimination with partial pivoting (L unit lower, rows swapped as in pivot);
+//returns false if A is singular
+bool LUFactor(int D, ComplexMatrix& A, std::vector<int>& pivot);
+
+//b <- A^-1 b with the factors of LUFactor
+void LUSolve(int D, const ComplexMatrix& LU, const std::vector<int>& pivot, std::vector<std::complex<double>>& b);
+#endif
@@ -0,0 +1,64 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include "json.hpp"
+#include "timers.h"
+
+using json = nlohmann::json;
+
+//opt-in hardware performance counters (Linux perf_event_open), opened per thread at first use.
+//If the counters are not permitted or not available the scopes do nothing and the report says why.
+
+//maximum number of events read by a sample
+const int PERF_MAX_EVENTS = 12;
+
+//counter values of the calling thread, scaled for multiplexing
+struct PerfSample
+{
+    bool valid = false;
+    double values[PERF_MAX_EVENTS] = {};
+};
+
+void EnablePerfCounters(bool enable);
+bool PerfCountersEnabled();
+
+//take a sample of the calling thread's counters (invalid sample if counters are disabled or unavailable)
+PerfSample ReadPerfCounters();
+
+//add the counts elapsed since start to the calling thread's accumulator of phase
+void AddPerfDelta(TimerPhase phase, const PerfSample& start);
+
+//per-phase counts and IPC aggregated over threads, or the reason why counters are unavailable
+json PerfReport();
+
+//accumulates the counter deltas between construction and destruction (or Stop) into phase
+class PerfScope
+{
+public:
+    explicit PerfScope(TimerPhase phase) : phase_(phase)
+    {
+        if (PerfCountersEnabled())
+        {
+            start_ = ReadPerfCounters();
+        }
+    }
+    ~PerfScope() { Stop(); }
+
+    void Stop()
+    {
+        if (start_.valid)
+        {
+            AddPerfDelta(phase_, start_);
+            start_.valid = false;
+        }
+    }
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    TimerPhase phase_;
+    PerfSample start_;
+};
+
+#endif
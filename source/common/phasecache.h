@@ -0,0 +1,47 @@
+#ifndef PHASECACHE_H
+#define PHASECACHE_H
+
+#include "json.hpp"
+#include <complex>
+#include <vector>
+
+using json = nlohmann::json;
+
+//phasors exp(i w t) at the points t, t+dt/2, t+dt of a step, for the levels (w = (wl_i - wl_0)/hbar) and the carriers.
+//On consecutive steps of equal dt they are advanced by the rotors exp(i w dt/2), two multiplications per phasor;
+//they are computed exactly at the first step, after any other step and at reseeds of growing interval (up to 256 steps),
+//where the drift of the recurrence from the exact values is measured
+class PhaseCache
+{
+public:
+    void Update(const std::vector<double>& wl, const double* carriers, int nCarriers, double t, double dt);
+
+    //exp(i (wl_i - wl_0) t_k/hbar) for i = 0..D-1 at point k (0, 1, 2)
+    const std::complex<double>* Levels(int k) const { return &phasors_[k*n_]; }
+    //exp(i w_c t_k) of carrier c at point k
+    std::complex<double> Carrier(int k, int c) const { return phasors_[k*n_ + levels_ + c]; }
+
+private:
+    void Seed(double t, double dt, double rotorDt);
+
+    int levels_ = 0;
+    int n_ = 0;
+    std::vector<double> freq_;
+    std::vector<std::complex<double>> phasors_;    //3 points of n_ phasors
+    std::vector<std::complex<double>> rotors_;
+    std::vector<std::complex<double>> advanced_;
+    double t_ = 0.0;
+    double dt_ = 0.0;
+    double tStart_ = 0.0;     //first step of the current run of consecutive steps
+    long steps_ = 0;
+    int interval_ = 0;
+    int sinceSeed_ = 0;
+    bool seeded_ = false;
+};
+
+//cache of the calling thread (used by the potentials with "phase_cache" = true)
+PhaseCache& ThreadPhaseCache();
+
+//exact reseeds, restarts (steps not following the previous one) and largest drift over all threads
+json PhaseCacheReport();
+#endif
@@ -0,0 +1,97 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include <atomic>
+#include <complex>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+//potential of one RK4 step as left by the potential function: the matrices at t, t+dt/2, t+dt (their complex<float>
+//roundings on the steps of mixed precision) and the envelope samples
+struct StepPotential
+{
+    std::vector<std::vector<std::complex<double>>> Vmatrices;
+    std::vector<std::vector<std::complex<float>>> floatMatrices;
+    std::vector<double> env;
+    std::vector<double> env2;
+};
+
+//lock-free ring of steps between one producer and one consumer: the producer fills the free slot at head and
+//publishes it, the consumer takes the slot at tail and releases it. The counters only grow, each is written by
+//one side, and their release stores order the slot contents
+class StepRing
+{
+public:
+    StepRing(int size, const StepPotential& prototype) : slots_(size, prototype) {}
+
+    //producer: the slot to fill, nullptr if the ring is full
+    StepPotential* Free()
+    {
+        long head = head_.load(std::memory_order_relaxed);
+        return (head - tail_.load(std::memory_order_acquire) < (long)slots_.size()) ? &slots_[head % slots_.size()] : nullptr;
+    }
+    void Publish() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    //consumer: the next filled slot, nullptr if the ring is empty
+    StepPotential* Filled()
+    {
+        long tail = tail_.load(std::memory_order_relaxed);
+        return (head_.load(std::memory_order_acquire) != tail) ? &slots_[tail % slots_.size()] : nullptr;
+    }
+    void Release() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+    std::vector<StepPotential> slots_;
+    alignas(64) std::atomic<long> head_{0};
+    alignas(64) std::atomic<long> tail_{0};
+};
+
+//potentials of the RK4 steps of a run built ahead of the integrator ("potential_pipeline" = number of producer
+//threads): each producer owns a ring of "pipeline_depth" steps, and the steps are dealt to the producers in turns of
+//pipeline_depth consecutive ones, over which their envelope streams and phase caches run on. The potentials depend
+//only on time, so the steps are those of the grid t that do not lie in the static segments
+class PotentialPipeline
+{
+public:
+    //envelopes: one for each producer, used only by it once the pipeline is started
+    PotentialPipeline(const json& input, PotentialFunction potential, const std::vector<EnvelopeFunction>& envelopes, SystemData& sys, const std::vector<double>& t, const StaticSegments* segments);
+    ~PotentialPipeline();
+
+    void Start();
+
+    //potential of the next step, swapped into the arrays of the caller (sized as the slots); waits for it if needed
+    void Take(std::vector<std::vector<std::complex<double>>>& Vmatrices, std::vector<std::vector<std::complex<float>>>& floatMatrices, std::vector<double>& env, std::vector<double>& env2);
+
+    int Producers() const { return (int)rings_.size(); }
+    int Depth() const { return depth_; }
+
+private:
+    void Produce(int producer);
+
+    const json& input_;
+    PotentialFunction potential_;
+    std::vector<EnvelopeFunction> envelopes_;
+    SystemData& sys_;
+    const std::vector<double>& t_;
+    const StaticSegments* segments_;
+    int depth_;
+    bool mixed_;
+    int resync_;
+    std::vector<std::unique_ptr<StepRing>> rings_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> stop_{false};
+    long taken_ = 0;
+};
+
+//number of producer threads of "potential_pipeline" (0: the potentials are built by the integrating thread)
+int PipelineProducers(const json& input);
+
+//check "potential_pipeline" and "pipeline_depth" (non-negative and positive integers); the pipeline needs the rk4
+//integrator without richardson
+bool CheckPipeline(const json& input);
+#endif
@@ -0,0 +1,13 @@
+#ifndef PLUGINENV_H
+#define PLUGINENV_H
+
+#include "json.hpp"
+#include "envelopes.h"
+#include <string>
+
+using json = nlohmann::json;
+
+//load the envelope plugin at path (see qqevol_plugin.h) and register its batched version under
+//the name input["envelope"]; sets scalar and twoEnvelopes on success
+bool LoadPluginEnvelope(const json& input, const std::string& path, EnvelopeFunction& scalar, bool& twoEnvelopes);
+#endif
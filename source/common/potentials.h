@@ -2,14 +2,25 @@
 #define POTENTIALS_H
 
 #include "json.hpp"
+#include "phasecache.h"
 #include <functional>
 #include <complex>
 #include <vector>
 
 using json = nlohmann::json;
+
+//reduced Planck constant in meV*s (wl are given in meV)
+const double hbar = 6.582119569e-13;
+
 using EnvelopeFunction = std::function<void(const json&, double*, std::vector<double>&, std::vector<double>&)>;
 using PotentialFunction = std::function<void(const json& , int, double, double , std::vector<double>& , std::vector<std::complex<double>>& , EnvelopeFunction , std::vector<std::vector<std::complex<double>>>&, std::vector<double>&, std::vector<double>&)>;
 
+//complex<float> matrices filled by ApplyDrive and ApplyDriveCached on this thread in place of Vmatrices ("precision" =
+//"mixed"), nullptr to fill Vmatrices again
+void SetFloatDrive(std::vector<std::vector<std::complex<float>>>* target);
+void ApplyDrive(int D, const double* tvec, const double* drive, const std::vector<double>& wl, const std::vector<std::complex<double>>& wr, std::vector<std::vector<std::complex<double>>>& Vmatrices);
+//ApplyDrive with the phase factors p_i*conj(p_j) of the levels of cache ("phase_cache" = true)
+void ApplyDriveCached(int D, const double* drive, const std::vector<std::complex<double>>& wr, const PhaseCache& cache, std::vector<std::vector<std::complex<double>>>& Vmatrices);
 void UpdatePotential(const json& input, int D, double t, double dt, std::vector<double>& wl, std::vector<std::complex<double>>& wr, EnvelopeFunction envelope, std::vector<std::vector<std::complex<double>>>& Vmatrices , std::vector<double>& env, std::vector<double>& env2);
 void UpdatePotential2(const json& input, int D, double t, double dt, std::vector<double>& wl, std::vector<std::complex<double>>& wr, EnvelopeFunction envelope, std::vector<std::vector<std::complex<double>>>& Vmatrices , std::vector<double>& env, std::vector<double>& env2);
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include <vector>
+
+using json = nlohmann::json;
+
+//check "precision" ("double" or "mixed"; mixed needs the rk4 integrator without richardson and "diagonal_drive" =
+//"rk4"), "precision_resync" and "precision_window" (non-negative integers)
+bool CheckPrecision(const json& input);
+
+//step i of a run of mixed precision is taken in single precision, but for every resync-th one (resync > 0)
+inline bool SinglePrecisionStep(bool mixed, int resync, int i)
+{
+    return mixed && (resync <= 0 || i % resync != 0);
+}
+
+//"precision" = "mixed" against double on "precision_window" steps of the grid t around the largest envelope, from
+//the initial state: the largest deviation of the populations and the window are printed and reported
+void CalibratePrecision(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& t);
+#endif
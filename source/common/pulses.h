@@ -0,0 +1,62 @@
+#ifndef PULSES_H
+#define PULSES_H
+
+#include "json.hpp"
+#include "envelopes.h"
+#include "potentials.h"
+#include <memory>
+#include <vector>
+
+using json = nlohmann::json;
+
+//shapes of the pulses of a train
+enum PulseShape {PULSE_SQUARE, PULSE_GAUSS, PULSE_HANN};
+
+//one pulse of the "pulses" list: envelope times cos(w t + phase), nonzero on [start, end]
+struct Pulse
+{
+    PulseShape shape;
+    double start;       //support of the pulse (gauss: center -/+ pulseCutoff sigma)
+    double end;
+    double center;
+    double sigma;       //gauss spreading in microseconds
+    double amplitude;
+    double w;           //carrier frequency
+    double phase;       //carrier phase (rad)
+};
+
+//train of pulses with an index of the pulses active in each bucket of time,
+//so that evaluating the drive costs the number of overlapping pulses, not the length of the train
+class PulseTrain
+{
+public:
+    //returns nullptr (after printing the reason) if the list is not valid
+    static std::shared_ptr<PulseTrain> Load(const json& input);
+
+    //sum of the envelopes (env) and of the drive factors envelope*cos(w t + phase) (drive, may be nullptr);
+    //the envelopes are taken at envTimes if given (see InsideEdgeTimes), the carriers always at tvec
+    void Evaluate(const double* tvec, int n, double* env, double* drive, const double* envTimes = nullptr) const;
+
+    //times where square pulses start or end, sorted
+    std::vector<double> Edges() const;
+
+    const std::vector<Pulse>& Pulses() const { return pulses_; }
+
+private:
+    //buckets of one level of the index, as wide as the shortest of its pulses
+    struct IndexLevel
+    {
+        double t0;                          //start of the first bucket
+        double inverseWidth;                //1/bucket width
+        std::vector<int> offsets;           //pulses of bucket b: pulses[offsets[b] .. offsets[b+1]-1]
+        std::vector<int> pulses;
+    };
+
+    std::vector<Pulse> pulses_;             //sorted by start
+    std::vector<IndexLevel> levels_;        //each holds the pulses spanning too many buckets of the one before
+};
+
+//load the "pulses" list: sets the envelope (sum of the pulse envelopes, saved in the output)
+//and the potential driving wr with the summed drive factors
+bool LoadPulseTrain(const json& input, EnvelopeFunction& envelope, PotentialFunction& potential);
+#endif
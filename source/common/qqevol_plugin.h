@@ -0,0 +1,81 @@
+/* C interface of qqEvol envelope plugins.
+ *
+ * A plugin is a shared library exporting
+ *
+ *     const qqevol_envelope* qqevol_envelope_plugin(void);
+ *
+ * and is selected with "envelope": "plugin:/path/libpulse.so" in the input file.
+ * At startup qqEvol passes every number of the input file to create(), then calls
+ * evaluate() on blocks of time points during the run: the plugin writes the envelope
+ * env (drive at frequency w1) and, if two_envelopes is set, env2 (drive at frequency w2).
+ * evaluate() can be called from several threads at once on the same state and must not modify it.
+ *
+ * Only plain C types cross the interface, so plugins can be built with any compiler, e.g.
+ *     gcc -O2 -shared -fPIC -I<qqEvol>/source/common pulse.c -o libpulse.so
+ */
+#ifndef QQEVOL_PLUGIN_H
+#define QQEVOL_PLUGIN_H
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* incremented on incompatible changes of the structures below */
+#define QQEVOL_PLUGIN_ABI 1
+
+/* numbers of the input file (integers converted to double), valid during create() */
+typedef struct
+{
+    int                count;
+    const char* const* names;
+    const double*      values;
+} qqevol_params;
+
+typedef struct
+{
+    int         abi_version;       /* QQEVOL_PLUGIN_ABI */
+    const char* name;              /* shown on screen */
+    int         two_envelopes;     /* 1 if env2 is used (the input file then needs w2) */
+
+    /* state of the envelope for these parameters, or NULL with a message in error[0..error_size-1] */
+    void* (*create)(const qqevol_params* params, char* error, size_t error_size);
+    /* env[k] and env2[k] at the times t[k], k = 0..n-1 (times in seconds) */
+    void  (*evaluate)(const void* state, const double* t, int n, double* env, double* env2);
+    void  (*destroy)(void* state);
+} qqevol_envelope;
+
+typedef const qqevol_envelope* (*qqevol_envelope_entry)(void);
+
+/* value of the parameter name, or fallback if the input file does not contain it */
+static inline double qqevol_param(const qqevol_params* params, const char* name, double fallback)
+{
+    for (int k = 0; k < params->count; k++)
+    {
+        if (strcmp(params->names[k], name) == 0)
+        {
+            return params->values[k];
+        }
+    }
+    return fallback;
+}
+
+/* 1 if the input file contains the parameter name */
+static inline int qqevol_has_param(const qqevol_params* params, const char* name)
+{
+    for (int k = 0; k < params->count; k++)
+    {
+        if (strcmp(params->names[k], name) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
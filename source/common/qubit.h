@@ -0,0 +1,17 @@
+#ifndef QUBIT_H
+#define QUBIT_H
+
+#include "json.hpp"
+#include "algorithms.h"
+
+using json = nlohmann::json;
+
+//two-level propagation along the time grid t: each step applies the closed-form SU(2) exponential
+//of the fourth-order Magnus expansion on the stencil t, t+dt/2, t+dt
+//    Omega = dt/6 (A0 + 4 A1/2 + A1) - dt^2/12 [A0, A1],  A = -i H
+//with H = c I + h.sigma in the interaction picture; saves every Nprint steps (and the last one) in out
+void PropagateQubit(const json& input, PotentialFunction potential, EnvelopeFunction envelope, const SystemData& sys, const std::vector<double>& t, std::vector<std::complex<double>>& psi, int Nprint, RunOutput* out);
+
+//executes the two-level simulation for qbmode = on
+void EvolveQubit(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
+#endif
@@ -0,0 +1,21 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "json.hpp"
+#include <string>
+
+using json = nlohmann::json;
+
+//global run report, filled during the run and written at exit
+json& RunReport();
+
+//declare the work done by a kernel measured by the timer phase "phase":
+//total floating point operations and bytes moved over the whole run
+void ReportKernelWork(const std::string& kernel, const std::string& phase, double steps, double flops, double bytes);
+
+//hash of the input data (64-bit FNV-1a of the canonical json dump) as hex string
+std::string InputHash(const json& input);
+
+//complete the run report with timings, rates, resources, host and build data and write it to prefix_report.json
+void WriteRunReport(const json& input, double wallSeconds);
+#endif
@@ -0,0 +1,13 @@
+#ifndef RICHARDSON_H
+#define RICHARDSON_H
+
+#include "json.hpp"
+#include "algorithms.h"
+
+using json = nlohmann::json;
+
+//executes the RK4 simulation at dt and dt/2 on two threads and saves the Richardson extrapolation
+//psi_dt/2 + (psi_dt/2 - psi_dt)/15 of each row (renormalized) in prefix.txt; the estimated population error
+//|P_dt/2 - P_dt|/15 of each row and level is written to prefix_err.txt
+void EvolveRichardson(const json& input, PotentialFunction potential, EnvelopeFunction envelope);
+#endif
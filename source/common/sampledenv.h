@@ -0,0 +1,46 @@
+#ifndef SAMPLEDENV_H
+#define SAMPLEDENV_H
+
+#include "json.hpp"
+#include "envelopes.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+//envelope sampled on a uniform time grid (e.g. an AWG waveform) read from "table_file":
+//a .npy array of float64/float32 values or raw little-endian float64 values, memory mapped.
+//Sample k is at time table_t0 + k*table_dt; the envelope is F1 times the interpolated samples
+//("table_interp": "linear" or "cubic" natural spline) and vanishes outside the sampled interval.
+class SampledEnvelope
+{
+public:
+    ~SampledEnvelope();
+
+    //returns nullptr (after printing the reason) if the file cannot be read
+    static std::shared_ptr<SampledEnvelope> Load(const json& input);
+
+    void Evaluate(const double* tvec, int n, double* env) const;
+
+    long Samples() const { return count_; }
+
+private:
+    SampledEnvelope() = default;
+    bool Map(const std::string& path);
+
+    void*  mapping_ = nullptr;
+    size_t mappingSize_ = 0;
+    const double* samples_ = nullptr;    //points into the mapping or into converted_
+    std::vector<double> converted_;      //float32 data converted to double
+    long   count_ = 0;
+    double t0_ = 0.0;
+    double dt_ = 0.0;
+    double scale_ = 1.0;
+    bool   cubic_ = false;
+    std::vector<double> second_;         //second derivatives of the natural cubic spline
+};
+
+//load the "table" envelope and register its batched version; sets scalar on success
+bool LoadSampledEnvelope(const json& input, EnvelopeFunction& scalar);
+#endif
@@ -0,0 +1,32 @@
+#ifndef STEPSIZE_H
+#define STEPSIZE_H
+
+#include "json.hpp"
+#include "algorithms.h"
+#include <vector>
+
+using json = nlohmann::json;
+
+//largest frequency of the problem and the time step it allows
+struct FrequencyBound
+{
+    double omegaMax;   //largest angular frequency (rad/s)
+    double envMax;     //largest envelope amplitude found on the time interval
+    double tPeak;      //time of the largest envelope amplitude
+    double dt;         //time step resolving omegaMax with the requested points per period
+};
+
+//bound from the level spacings of coupled levels, the carriers w1/w2, the drive strength and the pulse widths
+FrequencyBound EstimateFrequencyBound(const json& input, EnvelopeFunction envelope, const SystemData& sys);
+
+//largest population difference between the rows of a and b saved at the same times
+double PopulationDifference(const RunOutput& a, const RunOutput& b);
+
+//check the options of "Nstep" = "auto": "Nstep_tol" and "Nstep_ppp" (positive numbers), "Nstep_window" (a number
+//between 0 and 1) and "Nstep_probe" (boolean)
+bool CheckNstepAuto(const json& input);
+
+//number of steps: input "Nstep" if it is an integer, otherwise ("auto") the frequency bound
+//refined by a Richardson probe at dt and dt/2 on a window of the run, with steps ending on the edges of the run inside it
+int ResolveNstep(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& edges);
+#endif
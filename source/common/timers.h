@@ -0,0 +1,68 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include "json.hpp"
+#include <chrono>
+
+using json = nlohmann::json;
+
+//phases of a run measured by the scoped timers
+enum TimerPhase
+{
+    PHASE_SETUP,
+    PHASE_POTENTIAL,
+    PHASE_STAGES,
+    PHASE_NORMALIZATION,
+    PHASE_OUTPUT,
+    PHASE_PIPELINE_WAIT,
+    PHASE_COUNT
+};
+
+//name of a phase as written in the run report
+const char* PhaseName(TimerPhase phase);
+
+//add elapsed wall time to the calling thread's accumulator of phase
+void AddPhaseTime(TimerPhase phase, std::chrono::steady_clock::duration elapsed);
+
+//per-phase totals (seconds and number of scopes) aggregated over threads and per thread
+json PhaseReport();
+
+//measures the wall time between construction and destruction (or Stop) of the object;
+//without QQEVOL_TIMERS it does nothing
+class ScopedTimer
+{
+public:
+#ifdef QQEVOL_TIMERS
+    explicit ScopedTimer(TimerPhase phase) : phase_(phase), start_(std::chrono::steady_clock::now()), running_(true) {}
+    ~ScopedTimer() { Stop(); }
+
+    void Stop()
+    {
+        if (running_)
+        {
+            AddPhaseTime(phase_, std::chrono::steady_clock::now() - start_);
+            running_ = false;
+        }
+    }
+#else
+    explicit ScopedTimer(TimerPhase) {}
+    void Stop() {}
+#endif
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+#ifdef QQEVOL_TIMERS
+private:
+    TimerPhase phase_;
+    std::chrono::steady_clock::time_point start_;
+    bool running_;
+#endif
+};
+
+//timers are compiled out unless QQEVOL_TIMERS is defined (see Makefile TIMERS=on/off)
+#define QQ_TIMER_CONCAT_(a, b) a##b
+#define QQ_TIMER_CONCAT(a, b) QQ_TIMER_CONCAT_(a, b)
+#define QQ_TIMER(phase) ScopedTimer QQ_TIMER_CONCAT(qqTimer, __LINE__)(phase)
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef VECMATH_H
+#define VECMATH_H
+
+#include <string>
+
+//batched transcendental functions over double arrays, used by the potentials and the envelopes.
+//The kernels are compiled for AVX-512, AVX2+FMA and SSE2 and selected at startup (see kernels.h).
+//
+//Error bounds (measured against long double libm over 1e7 random arguments of each range):
+//  "accurate" (default)  exp:    1 ulp for x in [-708, 709] (1.2 ulp SSE2), 0 below -708
+//                        sincos: absolute error 1.2e-16 (1.5 ulp for |x| <= 1e7) up to |x| = 2^40, libm beyond;
+//                                the SSE2 kernels call libm for every argument
+//  "fast"                exp:    relative error below 1e-11
+//                        sincos: absolute error below 1e-11
+//the phases w*t of the potentials carry the rounding of their argument, ulp(w t) > 1e-11 once |w t| > 1e5
+enum VecMathMode
+{
+    VECMATH_ACCURATE,
+    VECMATH_FAST
+};
+
+//select the accuracy of the kernels by name ("accurate" or "fast"); false for other names
+bool SetVecMathMode(const std::string& name);
+VecMathMode GetVecMathMode();
+const char* VecMathModeName();
+
+//y[i] = exp(x[i]) for i < n (x and y may be the same array)
+void BlockExp(const double* x, double* y, int n);
+
+//s[i] = sin(x[i]), c[i] = cos(x[i]) for i < n
+void BlockSinCos(const double* x, double* s, double* c, int n);
+#endif
@@ -0,0 +1,144 @@
+#include "diagonal.h"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+//below this |w L| the moments are summed as series instead of the recurrence, which cancels
+static const double seriesLimit = 1.0;
+
+//M_n = int_0^L u^n exp(i w u) du for n = 0, 1, 2
+static void Moments(double w, double L, std::complex<double>* M)
+{
+    const std::complex<double> I(0.0, 1.0);
+    double x = w*L;
+    if (std::abs(x) < seriesLimit)
+    {
+        //M_n = L^(n+1) sum_k (i x)^k / (k! (n+k+1))
+        for (int n = 0; n < 3; n++)
+        {
+            std::complex<double> term = 1.0;
+            std::complex<double> sum = 0.0;
+            for (int k = 0; k < 40; k++)
+            {
+                sum += term/(double)(n + k + 1);
+                term *= I*x/(double)(k + 1);
+                if (std::abs(term) < 1.0e-18)
+                {
+                    break;
+                }
+            }
+            M[n] = sum*std::pow(L, n + 1);
+        }
+        return;
+    }
+    std::complex<double> E = std::exp(I*x);
+    M[0] = (E - 1.0)/(I*w);
+    M[1] = (L*E - M[0])/(I*w);
+    M[2] = (L*L*E - 2.0*M[1])/(I*w);
+}
+
+//int_t^(t+L) F(s) cos(w s) ds for the quadratic F through F0, Fm, F1 at t, t+h/2, t+h
+static double Filon(double t, double h, double L, double w, double F0, double Fm, double F1)
+{
+    double c0 = F0;
+    double c1 = (-3.0*F0 + 4.0*Fm - F1)/h;
+    double c2 = 2.0*(F0 - 2.0*Fm + F1)/(h*h);
+    std::complex<double> M[3];
+    Moments(w, L, M);
+    std::complex<double> carrier(std::cos(w*t), std::sin(w*t));
+    return (carrier*(c0*M[0] + c1*M[1] + c2*M[2])).real();
+}
+
+DiagonalDrive::DiagonalDrive(const json& input, const SystemData& sys)
+    : D_(sys.D), w1_(input.value("w1", 0.0)), w2_(0.0), twoCarriers_(input.contains("w2") && input["w2"].is_number()),
+      diagonal_(sys.D), cosines_(sys.D), sines_(sys.D)
+{
+    if (twoCarriers_)
+    {
+        w2_ = input["w2"];
+    }
+    for (int k = 0; k < D_; k++)
+    {
+        diagonal_[k] = sys.wr[k*D_ + k].real();
+    }
+}
+
+void DiagonalDrive::Apply(double t, double dt, const std::vector<double>& env, const std::vector<double>& env2, std::vector<std::vector<std::complex<double>>>& Vmatrices)
+{
+    //the potential of two carriers saves the sum of the envelopes in env[2]
+    double end1 = twoCarriers_ ? env[2] - env2[2] : env[2];
+    double half = Filon(t, dt, 0.5*dt, w1_, env[0], env[1], end1);
+    double full = Filon(t, dt, dt, w1_, env[0], env[1], end1);
+    if (twoCarriers_)
+    {
+        half += Filon(t, dt, 0.5*dt, w2_, env2[0], env2[1], env2[2]);
+        full += Filon(t, dt, dt, w2_, env2[0], env2[1], env2[2]);
+    }
+    double theta[3] = {theta_, theta_ + half, theta_ + full};
+
+    for (int m = 0; m < 3; m++)
+    {
+        for (int k = 0; k < D_; k++)
+        {
+            double angle = diagonal_[k]*theta[m];
+            cosines_[k] = std::cos(angle);
+            sines_[k]   = std::sin(angle);
+        }
+        //full matrices or their packed upper triangles (rows from the diagonal), multiplied by the real and
+        //imaginary parts of exp(i(a_i - a_j)) = (cos a_i cos a_j + sin a_i sin a_j) + i(sin a_i cos a_j - cos a_i sin a_j)
+        double* V = reinterpret_cast<double*>(Vmatrices[m].data());
+        bool packed = (int)Vmatrices[m].size() != D_*D_;
+        for (int i = 0; i < D_; i++)
+        {
+            int first = packed ? i : 0;
+            double ci = cosines_[i];
+            double si = sines_[i];
+            for (int j = first; j < D_; j++)
+            {
+                double pr = ci*cosines_[j] + si*sines_[j];
+                double pi = si*cosines_[j] - ci*sines_[j];
+                double vr = V[2*(j - first)];
+                double vi = V[2*(j - first) + 1];
+                V[2*(j - first)]     = vr*pr - vi*pi;
+                V[2*(j - first) + 1] = vr*pi + vi*pr;
+            }
+            V[2*(i - first)]     = 0.0;
+            V[2*(i - first) + 1] = 0.0;
+            V += 2*(D_ - first);
+        }
+    }
+    theta_ = theta[2];
+}
+
+void DiagonalDrive::ToState(std::vector<std::complex<double>>& phi) const
+{
+    for (int k = 0; k < D_; k++)
+    {
+        double angle = -diagonal_[k]*theta_;
+        phi[k] *= std::complex<double>(std::cos(angle), std::sin(angle));
+    }
+}
+
+bool CheckDiagonalDrive(const json& input)
+{
+    if (!input.contains("diagonal_drive"))
+    {
+        return true;
+    }
+    if (input["diagonal_drive"] != "rk4" && input["diagonal_drive"] != "exact")
+    {
+        std::cerr << "The specified diagonal_drive " << input["diagonal_drive"] << " is not supported, expected 'rk4' or 'exact'!\n";
+        return false;
+    }
+    if (input["diagonal_drive"] == "rk4")
+    {
+        return true;
+    }
+    std::string integrator = input.value("integrator", input["qbmode"] == "off" ? std::string("rk4") : std::string("qubit"));
+    if (integrator != "rk4" || input["envelope"] == "pulses" || input.value("segment_propagator", std::string("rk4")) != "rk4")
+    {
+        std::cerr << "'diagonal_drive' = 'exact' needs the 'rk4' integrator, an envelope other than 'pulses' and 'segment_propagator' = 'rk4'!\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#include "kernels.h"
+
+//table forced by SelectKernels, set before the run starts
+static const KernelTable* forcedTable = nullptr;
+
+static bool Supported(const KernelTable& table)
+{
+    __builtin_cpu_init();
+    if (&table == &kernels_avx512::table)
+    {
+        return __builtin_cpu_supports("x86-64-v4");
+    }
+    if (&table == &kernels_avx2::table)
+    {
+        return __builtin_cpu_supports("x86-64-v3");
+    }
+    return true;
+}
+
+//tables from the widest instruction set
+static const KernelTable* const tables[] = {&kernels_avx512::table, &kernels_avx2::table, &kernels_sse2::table};
+
+static const KernelTable* BestTable()
+{
+    for (const KernelTable* table : tables)
+    {
+        if (Supported(*table))
+        {
+            return table;
+        }
+    }
+    return &kernels_sse2::table;
+}
+
+const KernelTable& Kernels()
+{
+    static const KernelTable* best = BestTable();
+    return forcedTable ? *forcedTable : *best;
+}
+
+bool SelectKernels(const std::string& name)
+{
+    if (name == "auto")
+    {
+        forcedTable = nullptr;
+        return true;
+    }
+    for (const KernelTable* table : tables)
+    {
+        if (name == table->isa)
+        {
+            if (!Supported(*table))
+            {
+                return false;
+            }
+            forcedTable = table;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool KernelsForced()
+{
+    return forcedTable != nullptr;
+}
+
+std::vector<std::string> SupportedKernels()
+{
+    std::vector<std::string> names;
+    for (int i = 2; i >= 0; i--)
+    {
+        if (Supported(*tables[i]))
+        {
+            names.push_back(tables[i]->isa);
+        }
+    }
+    return names;
+}
@@ -1,6 +1,7 @@
 #include "envelopes.h"
 #include <iostream>
 #include <cmath> 
+#include <algorithm>
 #include <vector>
 
 # define M_PPI           3.14159265358979323846  /* pi */
@@ -75,7 +76,7 @@ void double_impulse(const json& input, double* tvec, std::vector<double>& env, s
     {
         if (tvec[k] < t3 || tvec[k] > t4)
         {
-            env[k] = 0.0;
+            env2[k] = 0.0;
         }
         else
         {
@@ -84,40 +85,248 @@ void double_impulse(const json& input, double* tvec, std::vector<double>& env, s
     }
 }
 
-//gussian potential centered in t1, strength F1 and amplitude sigma1
+//gussian potential centered in t1, strength F1 and amplitude sigma1 (the batched exponential of gauss_block)
 void gauss(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2)
 {
-    
-    double F1 = input["F1"];
-    double t1 = input["t1"];
-    double sigma1 = input["sigma1"];
+    gauss_block(input, tvec, 3, env.data(), env2.data());
+}
 
-    for (int k = 0; k < 3; k++)
+
+void double_gauss(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+{
+    double_gauss_block(input, tvec, 3, env.data(), env2.data());
+}
+
+
+void off_block(const json& input, const double* tvec, int n, double* env, double* env2)
+{
+    for (int k = 0; k < n; k++)
     {
-        env[k] = F1/(std::sqrt(2.0*M_PPI)*sigma1)*std::exp(-pow((tvec[k]-t1)*1.0e6/sigma1,2.0)/2.0);
+        env[k]  = 0.0;
+        env2[k] = 0.0;
     }
+}
 
+void constant_block(const json& input, const double* tvec, int n, double* env, double* env2)
+{
+    double F1 = input["F1"];
+    for (int k = 0; k < n; k++)
+    {
+        env[k]  = F1;
+        env2[k] = 0.0;
+    }
 }
 
+void impulse_block(const json& input, const double* tvec, int n, double* env, double* env2)
+{
+    double F1 = input["F1"];
+    double t1 = input["t1"];
+    double t2 = input["t2"];
 
-void double_gauss(const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    for (int k = 0; k < n; k++)
+    {
+        env[k]  = (tvec[k] < t1 || tvec[k] > t2) ? 0.0 : F1;
+        env2[k] = 0.0;
+    }
+}
+
+void double_impulse_block(const json& input, const double* tvec, int n, double* env, double* env2)
 {
-    
     double F1 = input["F1"];
     double t1 = input["t1"];
-    double sigma1 = input["sigma1"];
+    double t2 = input["t2"];
 
     double F2 = input["F2"];
-    double t2 = input["t2"];
-    double sigma2 = input["sigma2"];
+    double t3 = input["t3"];
+    double t4 = input["t4"];
+
+    for (int k = 0; k < n; k++)
+    {
+        env[k]  = (tvec[k] < t1 || tvec[k] > t2) ? 0.0 : F1;
+        env2[k] = (tvec[k] < t3 || tvec[k] > t4) ? 0.0 : F2;
+    }
+}
 
+//gaussian of amplitude F centered in tc with spreading sigma (microseconds) at the n times tvec
+static void GaussBlock(double F, double tc, double sigma, const double* tvec, int n, double* out)
+{
+    double amplitude = F/(std::sqrt(2.0*M_PPI)*sigma);
+    double scale     = 1.0e6/sigma;
+    for (int k = 0; k < n; k++)
+    {
+        double u = (tvec[k]-tc)*scale;
+        out[k] = -0.5*u*u;
+    }
+    BlockExp(out, out, n);
+    for (int k = 0; k < n; k++)
+    {
+        out[k] *= amplitude;
+    }
+}
 
-    for (int k = 0; k < 3; k++)
+void gauss_block(const json& input, const double* tvec, int n, double* env, double* env2)
+{
+    GaussBlock(input["F1"], input["t1"], input["sigma1"], tvec, n, env);
+    for (int k = 0; k < n; k++)
+    {
+        env2[k] = 0.0;
+    }
+}
+
+void double_gauss_block(const json& input, const double* tvec, int n, double* env, double* env2)
+{
+    GaussBlock(input["F1"], input["t1"], input["sigma1"], tvec, n, env);
+    GaussBlock(input["F2"], input["t2"], input["sigma2"], tvec, n, env2);
+}
+
+std::vector<double> EnvelopeEdges(const json& input)
+{
+    std::string envelope = input["envelope"];
+    double ti = input["ti"];
+    double tf = input["tf"];
+
+    std::vector<double> edges;
+    if (envelope == "impulse")
+    {
+        edges = {input["t1"], input["t2"]};
+    }
+    else if (envelope == "double_impulse")
+    {
+        edges = {input["t1"], input["t2"], input["t3"], input["t4"]};
+    }
+    else if (envelope == "pulses")
     {
-        env[k] = F1/(std::sqrt(2.0*M_PPI)*sigma1)*std::exp(-pow((tvec[k]-t1)*1.0e6/sigma1,2.0)/2.0);
-        env2[k] = F2/(std::sqrt(2.0*M_PPI)*sigma2)*std::exp(-pow((tvec[k]-t2)*1.0e6/sigma2,2.0)/2.0);
+        for (const auto& pulse : input["pulses"])
+        {
+            if (pulse.value("shape", std::string("square")) == "square")
+            {
+                edges.push_back(pulse["t_start"]);
+                edges.push_back(pulse["t_end"]);
+            }
+        }
+    }
+
+    //edges inside the run, without repetitions
+    double margin = 1.0e-12*(tf-ti);
+    edges.erase(std::remove_if(edges.begin(), edges.end(), [&](double e) { return e <= ti + margin || e >= tf - margin; }), edges.end());
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end(), [&](double a, double b) { return b - a <= margin; }), edges.end());
+    return edges;
+}
+
+bool StaticDrive(const json& input, double a, double b, double& envelope, double& drive)
+{
+    std::string name = input["envelope"];
+    double middle = 0.5*(a + b);
+    envelope = 0.0;
+    drive    = 0.0;
+
+    //square envelope of amplitude F on [start, end] with carrier w: zero outside, constant inside if w = 0
+    auto square = [&](double F, double start, double end, double w)
+    {
+        if (middle < start || middle > end)
+        {
+            return true;
+        }
+        envelope += F;
+        drive    += F;
+        return w == 0.0;
+    };
 
+    if (name == "off")
+    {
+        return true;
+    }
+    if (name == "const")
+    {
+        return square(input["F1"], a, b, input["w1"]);
+    }
+    if (name == "impulse")
+    {
+        return square(input["F1"], input["t1"], input["t2"], input["w1"]);
+    }
+    if (name == "double_impulse")
+    {
+        bool first = square(input["F1"], input["t1"], input["t2"], input["w1"]);
+        return square(input["F2"], input["t3"], input["t4"], input["w2"]) && first;
+    }
+    if (name == "pulses")
+    {
+        double w1 = input["w1"];
+        for (const auto& pulse : input["pulses"])
+        {
+            std::string shape = pulse.value("shape", std::string("square"));
+            if (shape != "square")
+            {
+                //shaped pulses vary wherever they overlap the segment (gauss ones vanish beyond 8 sigma)
+                double center = pulse.value("center", 0.0);
+                double reach  = 8.0*pulse.value("sigma", 0.0)*1.0e-6;
+                double start  = (shape == "gauss") ? center - reach : (double)pulse["t_start"];
+                double end    = (shape == "gauss") ? center + reach : (double)pulse["t_end"];
+                if (start < b && end > a)
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (middle < (double)pulse["t_start"] || middle > (double)pulse["t_end"])
+            {
+                continue;
+            }
+            double amplitude = pulse["amplitude"];
+            if (pulse.value("w", w1) != 0.0)
+            {
+                return false;
+            }
+            envelope += amplitude;
+            drive    += amplitude*std::cos(pulse.value("phase", 0.0));
+        }
+        return true;
     }
+    return false;
+}
 
+std::unordered_map<std::string, EnvelopeBlockFunction>& EnvelopeBlocks()
+{
+    static std::unordered_map<std::string, EnvelopeBlockFunction> blocks =
+    {
+        {"off",            off_block},
+        {"const",          constant_block},
+        {"impulse",        impulse_block},
+        {"gauss",          gauss_block},
+        {"double_impulse", double_impulse_block},
+        {"double_gauss",   double_gauss_block}
+    };
+    return blocks;
 }
 
+EnvelopeBlockFunction FindEnvelopeBlock(const std::string& name, EnvelopeFunction scalar)
+{
+    auto found = EnvelopeBlocks().find(name);
+    if (found != EnvelopeBlocks().end())
+    {
+        return found->second;
+    }
+
+    //evaluate the scalar envelope three time points at a time
+    return [scalar](const json& input, const double* tvec, int n, double* env, double* env2)
+    {
+        std::vector<double> e(3, 0.0);
+        std::vector<double> e2(3, 0.0);
+        for (int k = 0; k < n; k += 3)
+        {
+            double t3[3];
+            int m = std::min(3, n-k);
+            for (int j = 0; j < 3; j++)
+            {
+                t3[j] = tvec[k + std::min(j, m-1)];
+            }
+            scalar(input, t3, e, e2);
+            for (int j = 0; j < m; j++)
+            {
+                env[k+j]  = e[j];
+                env2[k+j] = e2[j];
+            }
+        }
+    };
+}
@@ -0,0 +1,240 @@
+#include "envstream.h"
+#include "report.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+//default number of steps evaluated by one call of the batched envelope
+static const int defaultBlockSteps = 512;
+
+EnvelopeStream::EnvelopeStream(const json& input, EnvelopeBlockFunction block, int blockSteps)
+    : input_(input), block_(block), blockSteps_(std::max(1, blockSteps)), t0_(0.0), dt_(0.0)
+{
+}
+
+void EnvelopeStream::Fill(double t, double dt)
+{
+    int points = 2*blockSteps_ + 1;
+    times_.resize(points);
+    env_.resize(points);
+    env2_.resize(points);
+
+    t0_ = t;
+    dt_ = dt;
+    for (int m = 0; m < points; m++)
+    {
+        times_[m] = t + m*0.5*dt;
+    }
+    block_(input_, times_.data(), points, env_.data(), env2_.data());
+}
+
+void EnvelopeStream::Fetch(double* tvec, std::vector<double>& env, std::vector<double>& env2)
+{
+    double dt = tvec[2] - tvec[0];
+    long m = -1;
+
+    //position of t on the buffered half-step grid, if dt is the buffered one
+    if (!times_.empty() && std::abs(dt - dt_) <= 1.0e-9*std::abs(dt_))
+    {
+        double position = (tvec[0] - t0_)/(0.5*dt_);
+        long nearest = std::lround(position);
+        if (std::abs(position - nearest) < 1.0e-6 && nearest >= 0 && nearest % 2 == 0 && nearest + 2 < (long)times_.size())
+        {
+            m = nearest;
+        }
+    }
+    if (m < 0)
+    {
+        Fill(tvec[0], dt);
+        m = 0;
+    }
+    for (int k = 0; k < 3; k++)
+    {
+        env[k]  = env_[m + k];
+        env2[k] = env2_[m + k];
+    }
+}
+
+std::shared_ptr<EnvelopeTable> EnvelopeTable::Build(const json& input, EnvelopeBlockFunction block, double ti, double tf, double tol)
+{
+    //cubic Lagrange remainder at the worst point of the central interval: 0.5625 h^4 |f''''| / 24,
+    //with h^4 f'''' estimated by the fourth differences of the samples (and a safety factor 2)
+    const double remainder = 2.0*0.5625/24.0;
+    const int maxIntervals = 1 << 22;
+
+    auto table = std::make_shared<EnvelopeTable>();
+    double previousBound = 0.0;
+    for (int intervals = 1024; intervals <= maxIntervals; intervals *= 2)
+    {
+        //samples from ti-h to tf+2h so every point of [ti, tf] has its 4-point stencil
+        int points = intervals + 4;
+        table->h_  = (tf-ti)/intervals;
+        table->t0_ = ti - table->h_;
+        std::vector<double> times(points);
+        for (int i = 0; i < points; i++)
+        {
+            times[i] = table->t0_ + i*table->h_;
+        }
+        table->env_.assign(points, 0.0);
+        table->env2_.assign(points, 0.0);
+        block(input, times.data(), points, table->env_.data(), table->env2_.data());
+
+        double amplitude = 0.0;
+        double bound = 0.0;
+        for (int i = 0; i < points; i++)
+        {
+            amplitude = std::max(amplitude, std::abs(table->env_[i]) + std::abs(table->env2_[i]));
+        }
+        for (int i = 0; i + 4 < points; i++)
+        {
+            for (const std::vector<double>* f : {&table->env_, &table->env2_})
+            {
+                const std::vector<double>& v = *f;
+                double delta4 = v[i] - 4.0*v[i+1] + 6.0*v[i+2] - 4.0*v[i+3] + v[i+4];
+                bound = std::max(bound, remainder*std::abs(delta4));
+            }
+        }
+
+        //check against the exact envelope at the interval midpoints
+        std::vector<double> midpoints(intervals);
+        for (int i = 0; i < intervals; i++)
+        {
+            midpoints[i] = ti + (i + 0.5)*table->h_;
+        }
+        std::vector<double> exact(intervals), exact2(intervals), interpolated(intervals), interpolated2(intervals);
+        block(input, midpoints.data(), intervals, exact.data(), exact2.data());
+        table->Evaluate(midpoints.data(), intervals, interpolated.data(), interpolated2.data());
+        double measured = 0.0;
+        for (int i = 0; i < intervals; i++)
+        {
+            measured = std::max(measured, std::abs(exact[i] - interpolated[i]) + std::abs(exact2[i] - interpolated2[i]));
+        }
+
+        table->errorBound_    = bound;
+        table->measuredError_ = measured;
+        if (std::max(bound, measured) <= tol*amplitude || amplitude == 0.0)
+        {
+            return table;
+        }
+        //halving h divides the bound by 16 for smooth envelopes: stop if it does not even drop by 4
+        if (previousBound > 0.0 && bound > 0.25*previousBound)
+        {
+            break;
+        }
+        previousBound = bound;
+    }
+    return nullptr;
+}
+
+void EnvelopeTable::Evaluate(const double* tvec, int n, double* env, double* env2) const
+{
+    int last = (int)env_.size() - 4;
+    double inverse = 1.0/h_;
+    for (int k = 0; k < n; k++)
+    {
+        double u = (tvec[k] - t0_)*inverse;
+        int i = (int)std::floor(u) - 1;
+        i = (i < 0) ? 0 : ((i > last) ? last : i);
+        double f = u - (i + 1);
+
+        double w0 = -f*(f-1.0)*(f-2.0)/6.0;
+        double w1 = (f+1.0)*(f-1.0)*(f-2.0)/2.0;
+        double w2 = -(f+1.0)*f*(f-2.0)/2.0;
+        double w3 = (f+1.0)*f*(f-1.0)/6.0;
+
+        env[k]  = w0*env_[i]  + w1*env_[i+1]  + w2*env_[i+2]  + w3*env_[i+3];
+        env2[k] = w0*env2_[i] + w1*env2_[i+1] + w2*env2_[i+2] + w3*env2_[i+3];
+    }
+}
+
+EnvelopeBlockFunction ResolveEnvelopeBlock(const json& input, EnvelopeFunction scalar)
+{
+    EnvelopeBlockFunction block = FindEnvelopeBlock(input["envelope"], scalar);
+    if (!input.value("envelope_table", false))
+    {
+        return block;
+    }
+
+    double ti  = input["ti"];
+    double tf  = input["tf"];
+    double tol = input.value("envelope_table_tol", 1.0e-9);
+    auto table = EnvelopeTable::Build(input, block, ti, tf, tol);
+    if (!table)
+    {
+        std::cerr << "Warning: the envelope cannot be tabulated within the tolerance " << tol
+                  << " (discontinuous envelope?), using the direct evaluation\n";
+        RunReport()["envelope_table"] = {{"used", false}, {"tolerance", tol}};
+        return block;
+    }
+
+    std::cout << "Envelope table of " << table->Points() << " points, estimated interpolation error "
+              << table->ErrorBound() << " (measured " << table->MeasuredError() << ")\n";
+    RunReport()["envelope_table"] = {{"used", true}, {"tolerance", tol}, {"points", table->Points()},
+                                     {"error_bound", table->ErrorBound()}, {"measured_error", table->MeasuredError()}};
+    return [table](const json&, const double* tvec, int n, double* env, double* env2)
+    {
+        table->Evaluate(tvec, n, env, env2);
+    };
+}
+
+EnvelopeFunction StreamEnvelope(const json& input, EnvelopeBlockFunction block)
+{
+    int blockSteps = input.value("envelope_block", defaultBlockSteps);
+    auto stream = std::make_shared<EnvelopeStream>(input, block, blockSteps);
+    return [stream](const json&, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    {
+        stream->Fetch(tvec, env, env2);
+    };
+}
+
+bool InsideEdgeTimes(const std::vector<double>& edges, const double* tvec, double* inside)
+{
+    inside[0] = tvec[0];
+    inside[1] = tvec[1];
+    inside[2] = tvec[2];
+    if (edges.empty())
+    {
+        return false;
+    }
+
+    //edges around the step, found from its midpoint
+    double tolerance = 1.0e-6*std::abs(tvec[2] - tvec[0]);
+    auto next = std::upper_bound(edges.begin(), edges.end(), tvec[1]);
+    bool moved = false;
+    if (next != edges.end() && std::abs(tvec[2] - *next) <= tolerance)
+    {
+        inside[2] = *next - tolerance;
+        moved = true;
+    }
+    if (next != edges.begin() && std::abs(tvec[0] - *(next-1)) <= tolerance)
+    {
+        inside[0] = *(next-1) + tolerance;
+        moved = true;
+    }
+    return moved;
+}
+
+EnvelopeFunction EdgeAwareEnvelope(EnvelopeFunction envelope, EnvelopeFunction scalar, const std::vector<double>& edges)
+{
+    return [envelope, scalar, edges](const json& input, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    {
+        envelope(input, tvec, env, env2);
+
+        double inside[3];
+        if (!InsideEdgeTimes(edges, tvec, inside))
+        {
+            return;
+        }
+        std::vector<double> e(3, 0.0);
+        std::vector<double> e2(3, 0.0);
+        scalar(input, inside, e, e2);
+        for (int k = 0; k < 3; k += 2)
+        {
+            if (inside[k] != tvec[k])
+            {
+                env[k]  = e[k];
+                env2[k] = e2[k];
+            }
+        }
+    };
+}
@@ -0,0 +1,333 @@
+#include "explicitrk.h"
+#include "potentials.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+//sqrt(21) of the Cooper-Verner coefficients
+static const double s21 = std::sqrt(21.0);
+
+//Butcher (1964): 7 stages, order 6, nodes 0, 1/3, 1/2, 2/3, 1
+static const ButcherTableau rk6 =
+{
+    "rk6", 6,
+    {0.0, 1.0/3.0, 2.0/3.0, 1.0/3.0, 0.5, 0.5, 1.0},
+    {
+        {},
+        {1.0/3.0},
+        {0.0, 2.0/3.0},
+        {1.0/12.0, 1.0/3.0, -1.0/12.0},
+        {-1.0/16.0, 9.0/8.0, -3.0/16.0, -3.0/8.0},
+        {0.0, 9.0/8.0, -3.0/8.0, -3.0/4.0, 0.5},
+        {9.0/44.0, -9.0/11.0, 63.0/44.0, 18.0/11.0, 0.0, -16.0/11.0}
+    },
+    {11.0/120.0, 0.0, 27.0/40.0, 27.0/40.0, -4.0/15.0, -4.0/15.0, 11.0/120.0},
+    {{0.0, 1.0}, {1.0/3.0, 1.0/3.0}}
+};
+
+//Cooper and Verner (1972): 11 stages, order 8, on the Lobatto nodes 0, (7-sqrt21)/14, 1/2, (7+sqrt21)/14, 1
+static const ButcherTableau rk8 =
+{
+    "rk8", 8,
+    {0.0, 0.5, 0.5, (7.0+s21)/14.0, (7.0+s21)/14.0, 0.5, (7.0-s21)/14.0, (7.0-s21)/14.0, 0.5, (7.0+s21)/14.0, 1.0},
+    {
+        {},
+        {0.5},
+        {0.25, 0.25},
+        {1.0/7.0, -(7.0+3.0*s21)/98.0, (21.0+5.0*s21)/49.0},
+        {(11.0+s21)/84.0, 0.0, (18.0+4.0*s21)/63.0, (21.0-s21)/252.0},
+        {(5.0+s21)/48.0, 0.0, (9.0+s21)/36.0, (-231.0+14.0*s21)/360.0, (63.0-7.0*s21)/80.0},
+        {(10.0-s21)/42.0, 0.0, (-432.0+92.0*s21)/315.0, (633.0-145.0*s21)/90.0, (-504.0+115.0*s21)/70.0, (63.0-13.0*s21)/35.0},
+        {1.0/14.0, 0.0, 0.0, 0.0, (14.0-3.0*s21)/126.0, (13.0-3.0*s21)/63.0, 1.0/9.0},
+        {1.0/32.0, 0.0, 0.0, 0.0, (91.0-21.0*s21)/576.0, 11.0/72.0, -(385.0+75.0*s21)/1152.0, (63.0+13.0*s21)/128.0},
+        {1.0/14.0, 0.0, 0.0, 0.0, 1.0/9.0, -(733.0+147.0*s21)/2205.0, (515.0+111.0*s21)/504.0, -(51.0+11.0*s21)/56.0, (132.0+28.0*s21)/245.0},
+        {0.0, 0.0, 0.0, 0.0, (-42.0+7.0*s21)/18.0, (-18.0+28.0*s21)/45.0, -(273.0+53.0*s21)/72.0, (301.0+53.0*s21)/72.0, (28.0-28.0*s21)/45.0, (49.0-7.0*s21)/18.0}
+    },
+    {9.0/180.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 49.0/180.0, 64.0/180.0, 49.0/180.0, 9.0/180.0},
+    {{0.0, 1.0}, {(7.0-s21)/14.0, s21/7.0}}
+};
+
+const ButcherTableau* FindTableau(const std::string& name)
+{
+    if (name == "rk6")
+    {
+        return &rk6;
+    }
+    if (name == "rk8")
+    {
+        return &rk8;
+    }
+    return nullptr;
+}
+
+//stage kernel work of a step: the matvecs plus the stage inputs and the final combination (as in EvolveRK4),
+//for potential matrices of the given stored elements
+static void StepWork(const ButcherTableau& tableau, int D, double elements, double& flops, double& bytes)
+{
+    double stages = (double)tableau.b.size();
+    double terms = 0.0;
+    for (const auto& row : tableau.a)
+    {
+        terms += std::count_if(row.begin(), row.end(), [](double x) { return x != 0.0; });
+    }
+    terms += std::count_if(tableau.b.begin(), tableau.b.end(), [](double x) { return x != 0.0; });
+    flops = 8.0*stages*D*D + 4.0*terms*D;
+    bytes = 16.0*(stages*elements + 2.0*terms*D);
+}
+
+void PropagateExplicitRK(const json& input, PotentialFunction potential, EnvelopeFunction envelope, EnvelopeFunction scalar, const ButcherTableau& tableau, SystemData& sys, const std::vector<double>& t, std::vector<std::complex<double>>& psi, int Nprint, RunOutput* out)
+{
+    int D      = sys.D;
+    int Nstep  = (int)(t.size()) - 1;
+    int stages = (int)tableau.b.size();
+    int windows = (int)tableau.windows.size();
+
+    //matrix of each stage: the point (start, middle or end) of the window that falls on its node
+    std::vector<std::pair<int, int>> source(stages, std::make_pair(0, 0));
+    for (int s = 0; s < stages; s++)
+    {
+        double distance = 1.0;
+        for (int w = 0; w < windows; w++)
+        {
+            for (int m = 0; m < 3; m++)
+            {
+                double node = tableau.windows[w].first + 0.5*m*tableau.windows[w].second;
+                if (std::abs(node - tableau.c[s]) < distance)
+                {
+                    distance = std::abs(node - tableau.c[s]);
+                    source[s] = std::make_pair(w, m);
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<std::vector<std::complex<double>>>> Vmatrices(windows, std::vector<std::vector<std::complex<double>>>(3, std::vector<std::complex<double>>(StageElements(sys))));
+    std::vector<std::complex<double>>& wr = sys.packed ? sys.wrPacked : sys.wr;
+    auto stage = sys.packed ? PackedStageKernel : StageKernel;
+    //state and stages by parts (psi is updated at the saved rows and the end)
+    SplitState state;
+    SplitParts(psi, state);
+    std::vector<SplitState> K(stages, state);
+    SplitState x = state;
+    std::vector<double> env(3, 0);
+    std::vector<double> env2(3, 0);
+    std::vector<double> innerEnv(3, 0);
+    std::vector<double> innerEnv2(3, 0);
+
+    if (out != nullptr && out->t.empty() && Nstep > 0)
+    {
+        potential(input, D, t[0], t[1]-t[0], sys.wl, wr, envelope, Vmatrices[0], env, env2);
+        out->t.push_back(t[0]);
+        out->env.push_back(env[0] + env2[0]);
+        out->psi.push_back(psi);
+    }
+
+    for (int i = 1; i < Nstep+1; i++)
+    {
+        double dt = t[i] - t[i-1];
+
+        //the step itself on the grid of envelope, the other windows inside it
+        {
+            QQ_TIMER(PHASE_POTENTIAL);
+            PerfScope potentialCounters(PHASE_POTENTIAL);
+            potential(input, D, t[i-1], dt, sys.wl, wr, envelope, Vmatrices[0], env, env2);
+            for (int w = 1; w < windows; w++)
+            {
+                potential(input, D, t[i-1] + tableau.windows[w].first*dt, tableau.windows[w].second*dt, sys.wl, wr, scalar, Vmatrices[w], innerEnv, innerEnv2);
+            }
+        }
+
+        ScopedTimer stagesTimer(PHASE_STAGES);
+        PerfScope stagesCounters(PHASE_STAGES);
+        for (int s = 0; s < stages; s++)
+        {
+            const std::complex<double>* V = Vmatrices[source[s].first][source[s].second].data();
+            if (s == 0)
+            {
+                stage(D, V, state, K[0]);
+                continue;
+            }
+            x = state;
+            for (int j = 0; j < s; j++)
+            {
+                if (tableau.a[s][j] == 0.0)
+                {
+                    continue;
+                }
+                double coefficient = tableau.a[s][j]*dt;
+                for (int k = 0; k < D; ++k)
+                {
+                    x.re[k] += coefficient*K[j].re[k];
+                    x.im[k] += coefficient*K[j].im[k];
+                }
+            }
+            stage(D, V, x, K[s]);
+        }
+        for (int s = 0; s < stages; s++)
+        {
+            if (tableau.b[s] == 0.0)
+            {
+                continue;
+            }
+            double weight = tableau.b[s]*dt;
+            for (int k = 0; k < D; ++k)
+            {
+                state.re[k] += weight*K[s].re[k];
+                state.im[k] += weight*K[s].im[k];
+            }
+        }
+        stagesCounters.Stop();
+        stagesTimer.Stop();
+
+        ScopedTimer normTimer(PHASE_NORMALIZATION);
+        NormalizeState(state, i);
+        normTimer.Stop();
+
+        if (out != nullptr && (i % Nprint == 0 || i == Nstep))
+        {
+            QQ_TIMER(PHASE_OUTPUT);
+            PerfScope outputCounters(PHASE_OUTPUT);
+            JoinParts(state, psi);
+            out->psi.push_back(psi);
+            out->env.push_back(env[2]);
+            out->t.push_back(t[i]);
+        }
+    }
+    JoinParts(state, psi);
+}
+
+//largest difference of the populations of two runs over their saved rows
+static double PopulationError(const RunOutput& a, const RunOutput& b)
+{
+    double error = 0.0;
+    for (size_t row = 0; row < a.psi.size() && row < b.psi.size(); row++)
+    {
+        for (size_t k = 0; k < a.psi[row].size(); k++)
+        {
+            error = std::max(error, std::abs(std::norm(a.psi[row][k]) - std::norm(b.psi[row][k])));
+        }
+    }
+    return error;
+}
+
+void CompareExplicitRK(const json& input, PotentialFunction potential, EnvelopeFunction envelope, EnvelopeFunction scalar, SystemData& sys, const std::vector<double>& t, int Nprint)
+{
+    int D     = sys.D;
+    int Nstep = (int)t.size() - 1;
+    double tol = input.value("rk_compare_tol", 1.0e-8);
+    std::cout << "Comparing the explicit integrators on " << Nstep << " steps...\n";
+
+    //reference: rk8 on the grid with every step halved, saved on the same rows
+    std::vector<double> fine(1, t[0]);
+    for (int i = 1; i <= Nstep; i++)
+    {
+        fine.push_back(0.5*(t[i-1] + t[i]));
+        fine.push_back(t[i]);
+    }
+    RunOutput reference;
+    std::vector<std::complex<double>> psi = sys.psi0;
+    PropagateExplicitRK(input, potential, envelope, scalar, rk8, sys, fine, psi, 2*Nprint, &reference);
+    double flops;
+    double bytes;
+    StepWork(rk8, D, StageElements(sys), flops, bytes);
+    double workSteps = 2.0*Nstep;
+    double workFlops = 2.0*Nstep*flops;
+    double workBytes = 2.0*Nstep*bytes;
+
+    json& comparison = RunReport()["rk_comparison"];
+    comparison["tol"] = tol;
+    comparison["reference"] = "rk8 at dt/2";
+    std::string cheapest;
+    double cheapestSeconds = 0.0;
+    std::printf("%-8s %8s %12s %14s %14s %14s\n", "method", "stages", "seconds", "pop. error", "steps at tol", "seconds at tol");
+    for (const std::string name : {"rk4", "rk6", "rk8"})
+    {
+        const ButcherTableau* tableau = FindTableau(name);
+        int stages = tableau ? (int)tableau->b.size() : 4;
+        int order  = tableau ? tableau->order : 4;
+
+        RunOutput run;
+        psi = sys.psi0;
+        auto start = std::chrono::steady_clock::now();
+        if (tableau)
+        {
+            PropagateExplicitRK(input, potential, envelope, scalar, *tableau, sys, t, psi, Nprint, &run);
+            StepWork(*tableau, D, StageElements(sys), flops, bytes);
+        }
+        else
+        {
+            PropagateRK4(input, potential, envelope, sys, t, psi, Nprint, &run);
+            flops = 32.0*D*D + 26.0*D;
+            bytes = 16.0*(4.0*StageElements(sys) + 15.0*D);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        workSteps += Nstep;
+        workFlops += Nstep*flops;
+        workBytes += Nstep*bytes;
+
+        //error ~ dt^order: steps (and time) that would reach tol
+        double error = PopulationError(run, reference);
+        double stepsAtTol = (error > 0.0) ? std::ceil(Nstep*std::pow(error/tol, 1.0/order)) : 1.0;
+        double secondsAtTol = seconds/Nstep*stepsAtTol;
+        std::printf("%-8s %8d %12.4g %14.4g %14.0f %14.4g\n", name.c_str(), stages, seconds, error, stepsAtTol, secondsAtTol);
+        comparison["methods"][name] = {{"order", order}, {"stages", stages}, {"matvecs", (double)stages*Nstep},
+                                       {"seconds", seconds}, {"population_error", error},
+                                       {"steps_at_tol", stepsAtTol}, {"seconds_at_tol", secondsAtTol}};
+        if (cheapest.empty() || secondsAtTol < cheapestSeconds)
+        {
+            cheapest = name;
+            cheapestSeconds = secondsAtTol;
+        }
+    }
+    std::cout << "Cheapest explicit integrator for a population error of " << tol << ": " << cheapest << "\n";
+    comparison["cheapest"] = cheapest;
+    comparison["work"] = {{"steps", workSteps}, {"flops", workFlops}, {"bytes", workBytes}};
+}
+
+void EvolveExplicitRK(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+    const ButcherTableau& tableau = *FindTableau(input["integrator"]);
+
+    SystemData sys = LoadSystem(input);
+    int D = sys.D;
+    setupTimer.Stop();
+
+    //the windows inside the steps are evaluated by the scalar envelope
+    EnvelopeFunction scalar = envelope;
+    std::vector<double> t = PrepareRun(input, potential, envelope, sys);
+    int Nstep = (int)t.size() - 1;
+
+    if (input.value("rk_compare", false))
+    {
+        CompareExplicitRK(input, potential, envelope, scalar, sys, t, Nprint);
+    }
+
+    std::vector<std::complex<double>> psi = sys.psi0;
+    RunOutput out;
+    PropagateExplicitRK(input, potential, envelope, scalar, tableau, sys, t, psi, Nprint, &out);
+
+    std::cout << "Calculation completed...\n";
+
+    double stepFlops;
+    double stepBytes;
+    StepWork(tableau, D, StageElements(sys), stepFlops, stepBytes);
+    RunReport()["integrator"] = tableau.name;
+    RunReport()["Dstates"]    = D;
+    RunReport()["steps"]      = Nstep;
+    //the RK4 steps of the automatic Nstep probe and the comparison runs share the phases of the run
+    double probeSteps  = RunReport().value("/nstep_auto/probe_steps"_json_pointer, 0.0);
+    double kernelSteps = Nstep + probeSteps + RunReport().value("/rk_comparison/work/steps"_json_pointer, 0.0);
+    double kernelFlops = stepFlops*Nstep + (32.0*D*D + 26.0*D)*probeSteps + RunReport().value("/rk_comparison/work/flops"_json_pointer, 0.0);
+    double kernelBytes = stepBytes*Nstep + 16.0*(4.0*StageElements(sys) + 15.0*D)*probeSteps + RunReport().value("/rk_comparison/work/bytes"_json_pointer, 0.0);
+    ReportKernelWork(tableau.name + "_stages", PhaseName(PHASE_STAGES), kernelSteps, kernelFlops, kernelBytes);
+
+    WriteOutput(prefix, D, out);
+}
@@ -0,0 +1,535 @@
+#include "exprenv.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+
+# define M_PPI           3.14159265358979323846  /* pi */
+
+//time points executed together by each instruction
+static const int chunk = 256;
+
+//bytecode operations: _RC takes a constant second operand, _CR a constant first operand;
+//subtraction and division by constants become OP_ADD_RC and OP_MUL_RC, OP_POWI keeps its exponent in b
+enum ExprOp
+{
+    OP_T, OP_CONST,
+    OP_ADD, OP_ADD_RC,
+    OP_SUB, OP_SUB_CR,
+    OP_MUL, OP_MUL_RC,
+    OP_DIV, OP_DIV_CR,
+    OP_POW, OP_POW_RC, OP_POW_CR, OP_SQUARE, OP_POWI,
+    OP_MIN, OP_MIN_RC, OP_MAX, OP_MAX_RC,
+    OP_NEG, OP_EXP, OP_LOG, OP_SQRT, OP_ABS, OP_SIN, OP_COS, OP_TAN,
+    OP_SINH, OP_COSH, OP_TANH, OP_ATAN, OP_STEP
+};
+
+//syntax tree of the formula
+struct ExprNode
+{
+    enum Kind {NUMBER, TIME, UNARY, BINARY} kind;
+    double value;          //NUMBER
+    char oper;             //BINARY: + - * / ^ m(in) M(ax) p(ow); UNARY: function op
+    int function;
+    std::unique_ptr<ExprNode> left;
+    std::unique_ptr<ExprNode> right;
+};
+
+static std::unique_ptr<ExprNode> Number(double value)
+{
+    std::unique_ptr<ExprNode> node(new ExprNode());
+    node->kind  = ExprNode::NUMBER;
+    node->value = value;
+    return node;
+}
+
+static double ApplyUnary(int function, double x)
+{
+    switch (function)
+    {
+        case OP_NEG:  return -x;
+        case OP_EXP:  return std::exp(x);
+        case OP_LOG:  return std::log(x);
+        case OP_SQRT: return std::sqrt(x);
+        case OP_ABS:  return std::abs(x);
+        case OP_SIN:  return std::sin(x);
+        case OP_COS:  return std::cos(x);
+        case OP_TAN:  return std::tan(x);
+        case OP_SINH: return std::sinh(x);
+        case OP_COSH: return std::cosh(x);
+        case OP_TANH: return std::tanh(x);
+        case OP_ATAN: return std::atan(x);
+        case OP_STEP: return (x >= 0.0) ? 1.0 : 0.0;
+        default:      return x;
+    }
+}
+
+static double ApplyBinary(char oper, double x, double y)
+{
+    switch (oper)
+    {
+        case '+': return x + y;
+        case '-': return x - y;
+        case '*': return x * y;
+        case '/': return x / y;
+        case 'm': return std::min(x, y);
+        case 'M': return std::max(x, y);
+        default:  return std::pow(x, y);
+    }
+}
+
+static std::unique_ptr<ExprNode> Unary(int function, std::unique_ptr<ExprNode> arg)
+{
+    //fold constants
+    if (arg->kind == ExprNode::NUMBER)
+    {
+        return Number(ApplyUnary(function, arg->value));
+    }
+    std::unique_ptr<ExprNode> node(new ExprNode());
+    node->kind     = ExprNode::UNARY;
+    node->function = function;
+    node->left     = std::move(arg);
+    return node;
+}
+
+static std::unique_ptr<ExprNode> Binary(char oper, std::unique_ptr<ExprNode> left, std::unique_ptr<ExprNode> right)
+{
+    if (left->kind == ExprNode::NUMBER && right->kind == ExprNode::NUMBER)
+    {
+        return Number(ApplyBinary(oper, left->value, right->value));
+    }
+    std::unique_ptr<ExprNode> node(new ExprNode());
+    node->kind  = ExprNode::BINARY;
+    node->oper  = oper;
+    node->left  = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+//recursive descent parser:
+//  sum     = product {(+|-) product}
+//  product = unary {(*|/) unary}
+//  unary   = -unary | +unary | power
+//  power   = primary [^ unary]
+//  primary = number | name | name(sum[,sum]) | (sum)
+struct ExprParser
+{
+    const std::string& text;
+    const json& input;
+    size_t pos;
+    std::string error;
+
+    void Skip()
+    {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+        {
+            pos++;
+        }
+    }
+
+    bool Accept(char c)
+    {
+        Skip();
+        if (pos < text.size() && text[pos] == c)
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    std::unique_ptr<ExprNode> Fail(const std::string& message)
+    {
+        if (error.empty())
+        {
+            error = message + " at position " + std::to_string(pos+1);
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<ExprNode> Sum()
+    {
+        std::unique_ptr<ExprNode> node = Product();
+        while (node)
+        {
+            if (Accept('+'))
+            {
+                std::unique_ptr<ExprNode> right = Product();
+                if (!right) return nullptr;
+                node = Binary('+', std::move(node), std::move(right));
+            }
+            else if (Accept('-'))
+            {
+                std::unique_ptr<ExprNode> right = Product();
+                if (!right) return nullptr;
+                node = Binary('-', std::move(node), std::move(right));
+            }
+            else
+            {
+                break;
+            }
+        }
+        return node;
+    }
+
+    std::unique_ptr<ExprNode> Product()
+    {
+        std::unique_ptr<ExprNode> node = UnaryTerm();
+        while (node)
+        {
+            if (Accept('*'))
+            {
+                std::unique_ptr<ExprNode> right = UnaryTerm();
+                if (!right) return nullptr;
+                node = Binary('*', std::move(node), std::move(right));
+            }
+            else if (Accept('/'))
+            {
+                std::unique_ptr<ExprNode> right = UnaryTerm();
+                if (!right) return nullptr;
+                node = Binary('/', std::move(node), std::move(right));
+            }
+            else
+            {
+                break;
+            }
+        }
+        return node;
+    }
+
+    std::unique_ptr<ExprNode> UnaryTerm()
+    {
+        if (Accept('-'))
+        {
+            std::unique_ptr<ExprNode> arg = UnaryTerm();
+            if (!arg) return nullptr;
+            return Unary(OP_NEG, std::move(arg));
+        }
+        if (Accept('+'))
+        {
+            return UnaryTerm();
+        }
+        return Power();
+    }
+
+    std::unique_ptr<ExprNode> Power()
+    {
+        std::unique_ptr<ExprNode> node = Primary();
+        if (node && Accept('^'))
+        {
+            //right associative, and -x^2 = -(x^2) through UnaryTerm
+            std::unique_ptr<ExprNode> exponent = UnaryTerm();
+            if (!exponent) return nullptr;
+            node = Binary('^', std::move(node), std::move(exponent));
+        }
+        return node;
+    }
+
+    std::unique_ptr<ExprNode> Primary()
+    {
+        Skip();
+        if (pos >= text.size())
+        {
+            return Fail("unexpected end of the formula");
+        }
+        if (Accept('('))
+        {
+            std::unique_ptr<ExprNode> node = Sum();
+            if (!node) return nullptr;
+            if (!Accept(')')) return Fail("expected ')'");
+            return node;
+        }
+        char c = text[pos];
+        if (std::isdigit((unsigned char)c) || c == '.')
+        {
+            const char* begin = text.c_str() + pos;
+            char* end;
+            double value = std::strtod(begin, &end);
+            if (end == begin) return Fail("invalid number");
+            pos += end - begin;
+            return Number(value);
+        }
+        if (std::isalpha((unsigned char)c) || c == '_')
+        {
+            size_t begin = pos;
+            while (pos < text.size() && (std::isalnum((unsigned char)text[pos]) || text[pos] == '_'))
+            {
+                pos++;
+            }
+            std::string name = text.substr(begin, pos-begin);
+            if (Accept('('))
+            {
+                return Call(name);
+            }
+            return Name(name, begin);
+        }
+        return Fail(std::string("unexpected character '") + c + "'");
+    }
+
+    std::unique_ptr<ExprNode> Call(const std::string& name)
+    {
+        static const std::unordered_map<std::string, int> unary =
+        {
+            {"exp", OP_EXP}, {"log", OP_LOG}, {"sqrt", OP_SQRT}, {"abs", OP_ABS},
+            {"sin", OP_SIN}, {"cos", OP_COS}, {"tan", OP_TAN}, {"sinh", OP_SINH},
+            {"cosh", OP_COSH}, {"tanh", OP_TANH}, {"atan", OP_ATAN}, {"step", OP_STEP}
+        };
+        static const std::unordered_map<std::string, char> binary =
+        {
+            {"min", 'm'}, {"max", 'M'}, {"pow", '^'}
+        };
+
+        std::unique_ptr<ExprNode> first = Sum();
+        if (!first) return nullptr;
+        auto foundUnary = unary.find(name);
+        if (foundUnary != unary.end())
+        {
+            if (!Accept(')')) return Fail("expected ')' after the argument of '" + name + "'");
+            return Unary(foundUnary->second, std::move(first));
+        }
+        auto foundBinary = binary.find(name);
+        if (foundBinary != binary.end())
+        {
+            if (!Accept(',')) return Fail("expected ',' in '" + name + "'");
+            std::unique_ptr<ExprNode> second = Sum();
+            if (!second) return nullptr;
+            if (!Accept(')')) return Fail("expected ')' after the arguments of '" + name + "'");
+            return Binary(foundBinary->second, std::move(first), std::move(second));
+        }
+        return Fail("unknown function '" + name + "'");
+    }
+
+    std::unique_ptr<ExprNode> Name(const std::string& name, size_t begin)
+    {
+        if (name == "t")
+        {
+            std::unique_ptr<ExprNode> node(new ExprNode());
+            node->kind = ExprNode::TIME;
+            return node;
+        }
+        if (name == "pi") return Number(M_PPI);
+        if (name == "e")  return Number(std::exp(1.0));
+        if (input.contains(name) && input[name].is_number())
+        {
+            return Number(input[name]);
+        }
+        pos = begin;
+        return Fail("unknown name '" + name + "' (not a number of the input file)");
+    }
+};
+
+//emit the code computing node into register reg, using the registers above reg for intermediate values
+static void Emit(const ExprNode& node, int reg, std::vector<ExprProgram::Instruction>& code, int& registers)
+{
+    registers = std::max(registers, reg+1);
+    switch (node.kind)
+    {
+        case ExprNode::NUMBER:
+            code.push_back({OP_CONST, reg, 0, 0, node.value});
+            return;
+        case ExprNode::TIME:
+            code.push_back({OP_T, reg, 0, 0, 0.0});
+            return;
+        case ExprNode::UNARY:
+            Emit(*node.left, reg, code, registers);
+            code.push_back({node.function, reg, reg, 0, 0.0});
+            return;
+        case ExprNode::BINARY:
+            break;
+    }
+
+    const ExprNode& left  = *node.left;
+    const ExprNode& right = *node.right;
+    char oper = node.oper;
+
+    if (oper == '^' && right.kind == ExprNode::NUMBER)
+    {
+        Emit(left, reg, code, registers);
+        double p = right.value;
+        if (p == 2.0)
+        {
+            code.push_back({OP_SQUARE, reg, reg, 0, 0.0});
+        }
+        else if (p == std::floor(p) && std::abs(p) <= 64.0)
+        {
+            code.push_back({OP_POWI, reg, reg, (int)p, 0.0});
+        }
+        else
+        {
+            code.push_back({OP_POW_RC, reg, reg, 0, p});
+        }
+        return;
+    }
+
+    //commutative operations keep the constant as second operand
+    bool commutative = (oper == '+' || oper == '*' || oper == 'm' || oper == 'M');
+    if (right.kind == ExprNode::NUMBER || (commutative && left.kind == ExprNode::NUMBER))
+    {
+        const ExprNode& variable = (right.kind == ExprNode::NUMBER) ? left : right;
+        double c = (right.kind == ExprNode::NUMBER) ? right.value : left.value;
+        Emit(variable, reg, code, registers);
+        switch (oper)
+        {
+            case '+': code.push_back({OP_ADD_RC, reg, reg, 0, c}); break;
+            case '-': code.push_back({OP_ADD_RC, reg, reg, 0, -c}); break;
+            case '*': code.push_back({OP_MUL_RC, reg, reg, 0, c}); break;
+            case '/': code.push_back({OP_MUL_RC, reg, reg, 0, 1.0/c}); break;
+            case 'm': code.push_back({OP_MIN_RC, reg, reg, 0, c}); break;
+            case 'M': code.push_back({OP_MAX_RC, reg, reg, 0, c}); break;
+        }
+        return;
+    }
+    if (left.kind == ExprNode::NUMBER)
+    {
+        Emit(right, reg, code, registers);
+        switch (oper)
+        {
+            case '-': code.push_back({OP_SUB_CR, reg, reg, 0, left.value}); break;
+            case '/': code.push_back({OP_DIV_CR, reg, reg, 0, left.value}); break;
+            case '^': code.push_back({OP_POW_CR, reg, reg, 0, left.value}); break;
+        }
+        return;
+    }
+
+    Emit(left, reg, code, registers);
+    Emit(right, reg+1, code, registers);
+    int op = OP_ADD;
+    switch (oper)
+    {
+        case '+': op = OP_ADD; break;
+        case '-': op = OP_SUB; break;
+        case '*': op = OP_MUL; break;
+        case '/': op = OP_DIV; break;
+        case 'm': op = OP_MIN; break;
+        case 'M': op = OP_MAX; break;
+        case '^': op = OP_POW; break;
+    }
+    code.push_back({op, reg, reg, reg+1, 0.0});
+}
+
+std::shared_ptr<ExprProgram> ExprProgram::Compile(const std::string& text, const json& input)
+{
+    ExprParser parser{text, input, 0, ""};
+    std::unique_ptr<ExprNode> tree = parser.Sum();
+    parser.Skip();
+    if (tree && parser.pos < text.size())
+    {
+        parser.Fail("unexpected '" + text.substr(parser.pos, 1) + "'");
+        tree = nullptr;
+    }
+    if (!tree)
+    {
+        std::cerr << "Invalid formula \"" << text << "\": " << parser.error << "!\n";
+        return nullptr;
+    }
+
+    std::shared_ptr<ExprProgram> program(new ExprProgram());
+    Emit(*tree, 0, program->code_, program->registers_);
+    return program;
+}
+
+void ExprProgram::Evaluate(const double* tvec, int n, double* out) const
+{
+    //register file of the thread, chunk values per register
+    thread_local std::vector<double> file;
+    if ((int)file.size() < registers_*chunk)
+    {
+        file.resize(registers_*chunk);
+    }
+
+    for (int start = 0; start < n; start += chunk)
+    {
+        int m = std::min(chunk, n-start);
+        const double* t = tvec + start;
+
+        for (const Instruction& ins : code_)
+        {
+            double* d = file.data() + ins.dst*chunk;
+            const double* a = file.data() + ins.a*chunk;
+            const double* b = file.data() + ins.b*chunk;
+            const double c = ins.c;
+            switch (ins.op)
+            {
+                case OP_T:      for (int k = 0; k < m; k++) d[k] = t[k];                      break;
+                case OP_CONST:  for (int k = 0; k < m; k++) d[k] = c;                         break;
+                case OP_ADD:    for (int k = 0; k < m; k++) d[k] = a[k] + b[k];               break;
+                case OP_ADD_RC: for (int k = 0; k < m; k++) d[k] = a[k] + c;                  break;
+                case OP_SUB:    for (int k = 0; k < m; k++) d[k] = a[k] - b[k];               break;
+                case OP_SUB_CR: for (int k = 0; k < m; k++) d[k] = c - a[k];                  break;
+                case OP_MUL:    for (int k = 0; k < m; k++) d[k] = a[k] * b[k];               break;
+                case OP_MUL_RC: for (int k = 0; k < m; k++) d[k] = a[k] * c;                  break;
+                case OP_DIV:    for (int k = 0; k < m; k++) d[k] = a[k] / b[k];               break;
+                case OP_DIV_CR: for (int k = 0; k < m; k++) d[k] = c / a[k];                  break;
+                case OP_POW:    for (int k = 0; k < m; k++) d[k] = std::pow(a[k], b[k]);      break;
+                case OP_POW_RC: for (int k = 0; k < m; k++) d[k] = std::pow(a[k], c);         break;
+                case OP_POW_CR: for (int k = 0; k < m; k++) d[k] = std::pow(c, a[k]);         break;
+                case OP_SQUARE: for (int k = 0; k < m; k++) d[k] = a[k] * a[k];               break;
+                case OP_POWI:
+                {
+                    //integer power by repeated squaring
+                    int p = std::abs(ins.b);
+                    for (int k = 0; k < m; k++)
+                    {
+                        double base = a[k];
+                        double result = 1.0;
+                        for (int e = p; e > 0; e >>= 1)
+                        {
+                            if (e & 1) result *= base;
+                            base *= base;
+                        }
+                        d[k] = (ins.b < 0) ? 1.0/result : result;
+                    }
+                    break;
+                }
+                case OP_MIN:    for (int k = 0; k < m; k++) d[k] = std::min(a[k], b[k]);      break;
+                case OP_MIN_RC: for (int k = 0; k < m; k++) d[k] = std::min(a[k], c);         break;
+                case OP_MAX:    for (int k = 0; k < m; k++) d[k] = std::max(a[k], b[k]);      break;
+                case OP_MAX_RC: for (int k = 0; k < m; k++) d[k] = std::max(a[k], c);         break;
+                case OP_NEG:    for (int k = 0; k < m; k++) d[k] = -a[k];                     break;
+                case OP_EXP:    BlockExp(a, d, m);                                            break;
+                case OP_LOG:    for (int k = 0; k < m; k++) d[k] = std::log(a[k]);            break;
+                case OP_SQRT:   for (int k = 0; k < m; k++) d[k] = std::sqrt(a[k]);           break;
+                case OP_ABS:    for (int k = 0; k < m; k++) d[k] = std::abs(a[k]);            break;
+                case OP_SIN:    for (int k = 0; k < m; k++) d[k] = std::sin(a[k]);            break;
+                case OP_COS:    for (int k = 0; k < m; k++) d[k] = std::cos(a[k]);            break;
+                case OP_TAN:    for (int k = 0; k < m; k++) d[k] = std::tan(a[k]);            break;
+                case OP_SINH:   for (int k = 0; k < m; k++) d[k] = std::sinh(a[k]);           break;
+                case OP_COSH:   for (int k = 0; k < m; k++) d[k] = std::cosh(a[k]);           break;
+                case OP_TANH:   for (int k = 0; k < m; k++) d[k] = std::tanh(a[k]);           break;
+                case OP_ATAN:   for (int k = 0; k < m; k++) d[k] = std::atan(a[k]);           break;
+                case OP_STEP:   for (int k = 0; k < m; k++) d[k] = (a[k] >= 0.0) ? 1.0 : 0.0; break;
+            }
+        }
+
+        for (int k = 0; k < m; k++)
+        {
+            out[start + k] = file[k];
+        }
+    }
+}
+
+bool LoadExprEnvelope(const json& input, EnvelopeFunction& scalar)
+{
+    std::shared_ptr<ExprProgram> program = ExprProgram::Compile(input["expr"], input);
+    if (!program)
+    {
+        return false;
+    }
+    std::cout << "Envelope formula compiled: " << program->Instructions() << " instructions, "
+              << program->Registers() << " registers\n";
+
+    scalar = [program](const json&, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    {
+        program->Evaluate(tvec, 3, env.data());
+        env2[0] = env2[1] = env2[2] = 0.0;
+    };
+    EnvelopeBlocks()["expr"] = [program](const json&, const double* tvec, int n, double* env, double* env2)
+    {
+        program->Evaluate(tvec, n, env);
+        for (int k = 0; k < n; k++)
+        {
+            env2[k] = 0.0;
+        }
+    };
+    return true;
+}
@@ -0,0 +1,322 @@
+#include "floquet.h"
+#include "potentials.h"
+#include "envelopes.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+# define M_PPI           3.14159265358979323846  /* pi */
+
+//carriers must complete a whole number of cycles per period within this fraction of a cycle
+static const double cycleTolerance = 1.0e-6;
+
+//period of the drive: "period" or one cycle of w1
+static double DrivePeriod(const json& input)
+{
+    if (input.contains("period"))
+    {
+        return input["period"];
+    }
+    return 2.0*M_PPI/(double)input["w1"];
+}
+
+//whole periods in [ti, tf] and the time left after them
+static long WholePeriods(const json& input, double period, double& remainder)
+{
+    double length = (double)input["tf"] - (double)input["ti"];
+    long periods = (long)std::floor(length/period + 1.0e-9);
+    remainder = length - periods*period;
+    if (remainder < 1.0e-9*period)
+    {
+        remainder = 0.0;
+    }
+    return periods;
+}
+
+bool CheckPeriod(const json& input, bool secondCarrier)
+{
+    if (input.contains("period") && !input["period"].is_number())
+    {
+        std::cerr << "Wrong type for input data 'period', expected 'number'!\n";
+        return false;
+    }
+    if (input.contains("period_steps") && !input["period_steps"].is_number_integer())
+    {
+        std::cerr << "Wrong type for input data 'period_steps', expected 'integer'!\n";
+        return false;
+    }
+    if (!input.contains("period") && (double)input["w1"] <= 0.0)
+    {
+        std::cerr << "The floquet integrator needs 'period' when 'w1' is not positive!\n";
+        return false;
+    }
+    double period = DrivePeriod(input);
+    double remainder;
+    if (period <= 0.0 || WholePeriods(input, period, remainder) < 1)
+    {
+        std::cerr << "The period " << period << " of the floquet integrator must be positive and fit in [ti, tf]!\n";
+        return false;
+    }
+
+    //carriers of the drive: w1, w2 if used, or those of the pulses
+    std::vector<std::pair<std::string, double>> carriers;
+    if (input["envelope"] == "pulses")
+    {
+        for (int k = 0; k < (int)input["pulses"].size(); k++)
+        {
+            carriers.push_back({"w of pulse " + std::to_string(k), input["pulses"][k].value("w", (double)input["w1"])});
+        }
+    }
+    else
+    {
+        carriers.push_back({"w1", input["w1"]});
+        if (secondCarrier)
+        {
+            carriers.push_back({"w2", input["w2"]});
+        }
+    }
+    for (const auto& carrier : carriers)
+    {
+        double cycles = carrier.second*period/(2.0*M_PPI);
+        if (std::abs(cycles - std::round(cycles)) > cycleTolerance)
+        {
+            std::cerr << "The carrier " << carrier.first << " makes " << cycles << " cycles per period: the drive is periodic "
+                      << "only if 'period' is a multiple of its cycle!\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void PeriodPropagator(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& t, ComplexMatrix& U)
+{
+    int D     = sys.D;
+    int Nstep = (int)(t.size()) - 1;
+
+    U = IdentityMatrix(D);
+    ComplexMatrix K0(D*D), K1(D*D), K2(D*D), K3(D*D), Ustage(D*D);
+
+    std::vector<double> env(3,0);
+    std::vector<double> env2(3,0);
+    std::vector<std::vector<std::complex<double>>> Vmatrices(3, std::vector<std::complex<double>>(D*D));
+
+    //stage k: K = V Ustage
+    auto stage = [&](const std::vector<std::complex<double>>& V, ComplexMatrix& K)
+    {
+        MatrixMultiply(D, V, Ustage, K);
+    };
+
+    for (int i = 1; i < Nstep+1; i++)
+    {
+        double dt = t[i] - t[i-1];
+
+        {
+            QQ_TIMER(PHASE_POTENTIAL);
+            PerfScope potentialCounters(PHASE_POTENTIAL);
+            potential(input, D, t[i-1], dt, sys.wl, sys.wr, envelope, Vmatrices, env, env2);
+        }
+
+        ScopedTimer stagesTimer(PHASE_STAGES);
+        PerfScope stagesCounters(PHASE_STAGES);
+        Ustage = U;
+        stage(Vmatrices[0], K0);
+        for (int m = 0; m < D*D; m++)
+        {
+            Ustage[m] = U[m] + 0.5*dt*K0[m];
+        }
+        stage(Vmatrices[1], K1);
+        for (int m = 0; m < D*D; m++)
+        {
+            Ustage[m] = U[m] + 0.5*dt*K1[m];
+        }
+        stage(Vmatrices[1], K2);
+        for (int m = 0; m < D*D; m++)
+        {
+            Ustage[m] = U[m] + dt*K2[m];
+        }
+        stage(Vmatrices[2], K3);
+        for (int m = 0; m < D*D; m++)
+        {
+            U[m] += (dt/6.0)*(K0[m] + 2.0*K1[m] + 2.0*K2[m] + K3[m]);
+        }
+        stagesCounters.Stop();
+        stagesTimer.Stop();
+    }
+}
+
+void EvolveFloquet(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+    double ti          = input["ti"];
+    double tf          = input["tf"];
+
+    SystemData sys = LoadSystem(input);
+    int D = sys.D;
+
+    double period = DrivePeriod(input);
+    double remainder;
+    long periods = WholePeriods(input, period, remainder);
+
+    //the grid of one period: "period_steps", or the step asked for the whole run
+    json periodInput = input;
+    periodInput["tf"] = ti + period;
+    if (input.contains("period_steps"))
+    {
+        periodInput["Nstep"] = std::max(1, (int)input["period_steps"]);
+    }
+    else if (input["Nstep"].is_number())
+    {
+        periodInput["Nstep"] = std::max(1L, std::lround((double)input["Nstep"]*period/(tf-ti)));
+    }
+    setupTimer.Stop();
+
+    //the envelope of the run serves the first period, which the later ones repeat
+    std::vector<double> t = PrepareRun(periodInput, potential, envelope, sys);
+    int periodSteps = (int)t.size() - 1;
+    std::cout << "Periodic drive: " << periods << " periods of " << period << " integrated once with " << periodSteps << " steps\n";
+
+    ComplexMatrix Uinteraction;
+    PeriodPropagator(periodInput, potential, envelope, sys, t, Uinteraction);
+
+    //laboratory-frame propagator of one period: exp(-i H0 (ti+T)) U exp(i H0 ti), with H0 = wl/hbar
+    ScopedTimer floquetTimer(PHASE_SETUP);
+    ComplexMatrix F(D*D);
+    for (int j = 0; j < D; j++)
+    {
+        for (int k = 0; k < D; k++)
+        {
+            double angle = (-sys.wl[j]*(ti + period) + sys.wl[k]*ti)/hbar;
+            F[j*D + k] = Uinteraction[j*D + k]*std::complex<double>(std::cos(angle), std::sin(angle));
+        }
+    }
+    //RK4 is not unitary: F is replaced by the closest unitary matrix, or its powers would lose norm at about
+    //unitarityError per period
+    double unitarityError = UnitarityError(D, F);
+    ComplexMatrix unitaryF;
+    PolarUnitary(D, F, unitaryF);
+    F.swap(unitaryF);
+
+    //quasi-energies: F = exp(-i eps T/hbar) on the Floquet modes, with the weights of the initial state
+    std::vector<double> phases;
+    ComplexMatrix modes;
+    UnitaryEigen(D, F, phases, modes);
+    std::vector<std::complex<double>> psiLab = sys.psi0;
+    FramePhase(sys, ti, -1.0, psiLab);
+    std::vector<std::pair<double, double>> quasiEnergies(D);
+    for (int k = 0; k < D; k++)
+    {
+        std::complex<double> overlap = 0.0;
+        for (int i = 0; i < D; i++)
+        {
+            overlap += std::conj(modes[i*D + k])*psiLab[i];
+        }
+        quasiEnergies[k] = {-hbar*phases[k]/period, std::norm(overlap)};
+    }
+    std::sort(quasiEnergies.begin(), quasiEnergies.end());
+
+    //propagators of Nprint periods and of the periods left after the last full stride
+    ComplexMatrix stride = MatrixPower(D, F, std::min<long>(Nprint, periods));
+    ComplexMatrix last   = MatrixPower(D, F, periods % Nprint);
+    floquetTimer.Stop();
+
+    RunOutput out;
+    std::vector<double> env(3,0);
+    std::vector<double> env2(3,0);
+    std::vector<std::vector<std::complex<double>>> Vmatrices(3, std::vector<std::complex<double>>(D*D));
+    potential(periodInput, D, t[0], t[1]-t[0], sys.wl, sys.wr, envelope, Vmatrices, env, env2);
+    double envStart = env[0] + env2[0];
+    out.t.push_back(ti);
+    out.env.push_back(envStart);
+    out.psi.push_back(sys.psi0);
+
+    //rows every Nprint periods; the envelope repeats its value at the start of the period. The rounding of the
+    //powers is removed by normalizing each row, the largest correction is reported
+    std::vector<std::complex<double>> psiNext(D);
+    double normError = 0.0;
+    for (long done = 0; done < periods; )
+    {
+        long advance = std::min<long>(Nprint, periods - done);
+        MatrixVector(D, (advance == Nprint) ? stride : last, psiLab, psiNext);
+        psiLab.swap(psiNext);
+        done += advance;
+
+        double norm = 0.0;
+        for (const auto& c : psiLab)
+        {
+            norm += std::norm(c);
+        }
+        norm = std::sqrt(norm);
+        normError = std::max(normError, std::abs(norm - 1.0));
+        for (auto& c : psiLab)
+        {
+            c /= norm;
+        }
+
+        std::vector<std::complex<double>> psi = psiLab;
+        FramePhase(sys, ti + done*period, 1.0, psi);
+        out.t.push_back(ti + done*period);
+        out.env.push_back(envStart);
+        out.psi.push_back(psi);
+    }
+
+    //time left after the whole periods: the drive of [ti, ti+remainder] integrated directly
+    int remainderSteps = 0;
+    if (remainder > 0.0)
+    {
+        remainderSteps = std::max(1, (int)std::ceil(periodSteps*remainder/period));
+        std::vector<double> tRemainder = TimeGrid(ti, ti + remainder, remainderSteps);
+        std::vector<std::complex<double>> psi = psiLab;
+        FramePhase(sys, ti, 1.0, psi);
+        RunOutput tail;
+        PropagateRK4(periodInput, potential, envelope, sys, tRemainder, psi, remainderSteps, &tail);
+        FramePhase(sys, ti + remainder, -1.0, psi);
+        FramePhase(sys, tf, 1.0, psi);
+        out.t.push_back(tf);
+        out.env.push_back(tail.env.back());
+        out.psi.push_back(psi);
+    }
+
+    std::cout << "Calculation completed...\n";
+
+    //quasi-energies (meV, in (-pi hbar/T, pi hbar/T]) and weight of the initial state on each Floquet mode
+    std::string floquetFile = prefix + "_floquet.txt";
+    FILE* f = std::fopen(floquetFile.c_str(), "w");
+    if (!f)
+    {
+        std::cerr << "Impossible to write the quasi-energies to " << floquetFile << "\n";
+    }
+    else
+    {
+        for (const auto& mode : quasiEnergies)
+        {
+            std::fprintf(f, "%.12g %.12g\n", mode.first, mode.second);
+        }
+        std::fclose(f);
+    }
+
+    std::vector<double> energies;
+    for (const auto& mode : quasiEnergies)
+    {
+        energies.push_back(mode.first);
+    }
+    RunReport()["integrator"] = "floquet";
+    RunReport()["Dstates"]    = D;
+    RunReport()["steps"]      = periodSteps + remainderSteps;
+    RunReport()["floquet"]    = {{"period", period}, {"periods", periods}, {"period_steps", periodSteps},
+                                 {"remainder", remainder}, {"unitarity_error", unitarityError},
+                                 {"row_norm_error", normError}, {"quasi_energies", energies}};
+    //stages of the period propagator: 4 products of D*D matrices, plus the combinations
+    double stageFlops = 32.0*D*D*D + 14.0*D*D;
+    double stageBytes = 16.0*(4.0*D*D + 16.0*D*D);
+    ReportKernelWork("period_stages", PhaseName(PHASE_STAGES), (double)periodSteps, stageFlops*periodSteps, stageBytes*periodSteps);
+
+    WriteOutput(prefix, D, out);
+}
@@ -0,0 +1,923 @@
+#include "kernels.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+//the undefined registers of the gcc 12 AVX-512 intrinsics are reported as uninitialized (gcc PR 105593)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+
+//compiled once per instruction set with QQEVOL_KERNELS naming the table (see the Makefile): everything but the
+//table has internal linkage, so that no inline function of one variant can be linked into another. No std template
+//is instantiated here either, as its members would be weak symbols that the linker takes from any one variant
+#ifndef QQEVOL_KERNELS
+#error "QQEVOL_KERNELS must name the kernel table of the instruction set"
+#endif
+
+namespace
+{
+
+//exp: x = k ln2 + r, |r| <= ln2/2 (ln2hi has trailing zero bits, k*ln2hi is exact)
+static const double log2e = 1.4426950408889634;
+static const double ln2hi = 6.93147180369123816490e-01;
+static const double ln2lo = 1.90821492927058770002e-10;
+
+//sincos: x = k pi/2 + r, |r| <= pi/4, with pi/2 = pio2hi + pio2lo
+static const double twoOverPi = 6.36619772367581382433e-01;
+static const double pio2hi    = 1.57079632679489655800e+00;
+static const double pio2lo    = 6.12323399573676603587e-17;
+//largest |x| reduced in the kernels, libm beyond
+static const double sinCosLimit = 1099511627776.0;    //2^40
+
+//minimax polynomials of sin and cos on [-pi/4, pi/4] (fdlibm __kernel_sin, __kernel_cos)
+static const double S1 = -1.66666666666666324348e-01;
+static const double S2 =  8.33333333332248946124e-03;
+static const double S3 = -1.98412698298579493134e-04;
+static const double S4 =  2.75573137070700676789e-06;
+static const double S5 = -2.50507602534068634195e-08;
+static const double S6 =  1.58969099521155010221e-10;
+static const double C1 =  4.16666666666666019037e-02;
+static const double C2 = -1.38888888888741095749e-03;
+static const double C3 =  2.48015872894767294178e-05;
+static const double C4 = -2.75573143513906633035e-07;
+static const double C5 =  2.08757232129817482790e-09;
+static const double C6 = -1.13596475577881948265e-11;
+
+//k + magic has the integer k in the low bits of its mantissa (|k| < 2^51)
+static const double magic = 6755399441055744.0;
+
+//operations on the lanes of the widest vector register: doubles, masks and 64-bit integers share the type V
+#if defined(__AVX2__) && defined(__FMA__)
+struct Lanes256
+{
+    typedef __m256d V;
+    typedef double Scalar;
+    static const int width = 4;
+    static V Load(const double* p) { return _mm256_loadu_pd(p); }
+    static void Store(double* p, V a) { _mm256_storeu_pd(p, a); }
+    static V Set(double a) { return _mm256_set1_pd(a); }
+    static V SetBits(std::int64_t a) { return _mm256_castsi256_pd(_mm256_set1_epi64x(a)); }
+    static V Add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V Sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V Mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V Fma(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+    static V Fnma(V a, V b, V c) { return _mm256_fnmadd_pd(a, b, c); }
+    static V Min(V a, V b) { return _mm256_min_pd(a, b); }
+    static V Max(V a, V b) { return _mm256_max_pd(a, b); }
+    static V Round(V a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static V Less(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static bool AnyGreater(V a, V b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ)) != 0; }
+    static V And(V a, V b) { return _mm256_and_pd(a, b); }
+    static V AndNot(V a, V b) { return _mm256_andnot_pd(a, b); }
+    static V Xor(V a, V b) { return _mm256_xor_pd(a, b); }
+    static V AddI(V a, V b) { return _mm256_castsi256_pd(_mm256_add_epi64(_mm256_castpd_si256(a), _mm256_castpd_si256(b))); }
+    static V SubI(V a, V b) { return _mm256_castsi256_pd(_mm256_sub_epi64(_mm256_castpd_si256(a), _mm256_castpd_si256(b))); }
+    template <int n> static V ShiftI(V a) { return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(a), n)); }
+    static V SwapPairs(V a) { return _mm256_permute_pd(a, 0x5); }
+    //(a0, b0, a1, b1): half-width loads, as the parts are written by 128-bit stores
+    static V LoadZip(const double* a, const double* b)
+    {
+        __m128d ra = _mm_loadu_pd(a);
+        __m128d rb = _mm_loadu_pd(b);
+        return _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_unpacklo_pd(ra, rb)), _mm_unpackhi_pd(ra, rb), 1);
+    }
+    //a, b rounded to floats by one store: the loads of the float lanes would wait for two half-width stores
+    static void StoreFloats(float* p, V a, V b)
+    {
+        _mm256_storeu_ps(p, _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(a)), _mm256_cvtpd_ps(b), 1));
+    }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct Lanes512
+{
+    typedef __m512d V;
+    typedef double Scalar;
+    static const int width = 8;
+    static V Load(const double* p) { return _mm512_loadu_pd(p); }
+    static void Store(double* p, V a) { _mm512_storeu_pd(p, a); }
+    static V Set(double a) { return _mm512_set1_pd(a); }
+    static V SetBits(std::int64_t a) { return _mm512_castsi512_pd(_mm512_set1_epi64(a)); }
+    static V Add(V a, V b) { return _mm512_add_pd(a, b); }
+    static V Sub(V a, V b) { return _mm512_sub_pd(a, b); }
+    static V Mul(V a, V b) { return _mm512_mul_pd(a, b); }
+    static V Fma(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+    static V Fnma(V a, V b, V c) { return _mm512_fnmadd_pd(a, b, c); }
+    static V Min(V a, V b) { return _mm512_min_pd(a, b); }
+    static V Max(V a, V b) { return _mm512_max_pd(a, b); }
+    static V Round(V a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static V Less(V a, V b) { return _mm512_castsi512_pd(_mm512_maskz_set1_epi64(_mm512_cmp_pd_mask(a, b, _CMP_LT_OQ), -1)); }
+    static bool AnyGreater(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ) != 0; }
+    static V And(V a, V b) { return _mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b))); }
+    static V AndNot(V a, V b) { return _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b))); }
+    static V Xor(V a, V b) { return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b))); }
+    static V AddI(V a, V b) { return _mm512_castsi512_pd(_mm512_add_epi64(_mm512_castpd_si512(a), _mm512_castpd_si512(b))); }
+    static V SubI(V a, V b) { return _mm512_castsi512_pd(_mm512_sub_epi64(_mm512_castpd_si512(a), _mm512_castpd_si512(b))); }
+    template <int n> static V ShiftI(V a) { return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_castpd_si512(a), n)); }
+    static V SwapPairs(V a) { return _mm512_permute_pd(a, 0x55); }
+};
+//the matrices use 256-bit rows: their rows are not aligned to 64 bytes and the 512-bit loads were slower
+typedef Lanes512 Lanes;
+typedef Lanes256 MatrixLanes;
+#elif defined(__AVX2__) && defined(__FMA__)
+typedef Lanes256 Lanes;
+typedef Lanes256 MatrixLanes;
+#elif defined(__SSE2__)
+//two lanes without fused multiply-add: the exp reduction keeps the exact products of ln2hi, sincos calls libm
+#define KERNELS_LIBM_SINCOS
+struct Lanes128
+{
+    typedef __m128d V;
+    typedef double Scalar;
+    static const int width = 2;
+    static V Load(const double* p) { return _mm_loadu_pd(p); }
+    static void Store(double* p, V a) { _mm_storeu_pd(p, a); }
+    static V Set(double a) { return _mm_set1_pd(a); }
+    static V SetBits(std::int64_t a) { return _mm_castsi128_pd(_mm_set1_epi64x(a)); }
+    static V Add(V a, V b) { return _mm_add_pd(a, b); }
+    static V Sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V Mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V Fma(V a, V b, V c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static V Fnma(V a, V b, V c) { return _mm_sub_pd(c, _mm_mul_pd(a, b)); }
+    static V Min(V a, V b) { return _mm_min_pd(a, b); }
+    static V Max(V a, V b) { return _mm_max_pd(a, b); }
+    //round to nearest by the magic number (|a| < 2^51)
+    static V Round(V a) { return _mm_sub_pd(_mm_add_pd(a, _mm_set1_pd(magic)), _mm_set1_pd(magic)); }
+    static V Less(V a, V b) { return _mm_cmplt_pd(a, b); }
+    static bool AnyGreater(V a, V b) { return _mm_movemask_pd(_mm_cmpgt_pd(a, b)) != 0; }
+    static V And(V a, V b) { return _mm_and_pd(a, b); }
+    static V AndNot(V a, V b) { return _mm_andnot_pd(a, b); }
+    static V Xor(V a, V b) { return _mm_xor_pd(a, b); }
+    static V AddI(V a, V b) { return _mm_castsi128_pd(_mm_add_epi64(_mm_castpd_si128(a), _mm_castpd_si128(b))); }
+    static V SubI(V a, V b) { return _mm_castsi128_pd(_mm_sub_epi64(_mm_castpd_si128(a), _mm_castpd_si128(b))); }
+    template <int n> static V ShiftI(V a) { return _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(a), n)); }
+    static V SwapPairs(V a) { return _mm_shuffle_pd(a, a, 1); }
+    //(a0, b0)
+    static V LoadZip(const double* a, const double* b) { return _mm_unpacklo_pd(_mm_load_sd(a), _mm_load_sd(b)); }
+    static void StoreFloats(float* p, V a, V b) { _mm_storeu_ps(p, _mm_movelh_ps(_mm_cvtpd_ps(a), _mm_cvtpd_ps(b))); }
+};
+typedef Lanes128 Lanes;
+typedef Lanes128 MatrixLanes;
+#else
+#error "the kernels need at least SSE2"
+#endif
+
+//lanes of floats for the complex<float> matrices of the mixed precision stages: twice the elements of MatrixLanes
+#if defined(__AVX2__) && defined(__FMA__)
+struct FloatLanes256
+{
+    typedef __m256 V;
+    typedef float Scalar;
+    static const int width = 8;
+    static V Load(const float* p) { return _mm256_loadu_ps(p); }
+    static void Store(float* p, V a) { _mm256_storeu_ps(p, a); }
+    static V Set(float a) { return _mm256_set1_ps(a); }
+    static V Fma(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+    static V SwapPairs(V a) { return _mm256_permute_ps(a, 0xB1); }
+    //(sums of a with alternating signs, sums of b) as in Reduce, in float from the pairs (a0 - a1, b0 + b1), ...
+    static __m128d Sums(V a, V b)
+    {
+        V pairs = _mm256_blend_ps(_mm256_sub_ps(a, SwapPairs(a)), _mm256_add_ps(b, SwapPairs(b)), 0xAA);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(pairs), _mm256_extractf128_ps(pairs, 1));
+        return _mm_cvtps_pd(_mm_add_ps(half, _mm_movehl_ps(half, half)));
+    }
+};
+typedef FloatLanes256 FloatMatrixLanes;
+#else
+struct FloatLanes128
+{
+    typedef __m128 V;
+    typedef float Scalar;
+    static const int width = 4;
+    static V Load(const float* p) { return _mm_loadu_ps(p); }
+    static void Store(float* p, V a) { _mm_storeu_ps(p, a); }
+    static V Set(float a) { return _mm_set1_ps(a); }
+    static V Fma(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static V SwapPairs(V a) { return _mm_shuffle_ps(a, a, 0xB1); }
+    static __m128d Sums(V a, V b)
+    {
+        //(a0 - a1, a2 - a3, b0 + b1, b2 + b3)
+        V pairs = _mm_shuffle_ps(_mm_sub_ps(a, SwapPairs(a)), _mm_add_ps(b, SwapPairs(b)), _MM_SHUFFLE(2, 0, 2, 0));
+        V sums  = _mm_add_ps(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtps_pd(_mm_shuffle_ps(sums, sums, _MM_SHUFFLE(3, 3, 2, 0)));
+    }
+};
+typedef FloatLanes128 FloatMatrixLanes;
+#endif
+
+//lanes of the matrices of elements T
+template <class T> struct MatrixLanesOf;
+template <> struct MatrixLanesOf<double> { typedef MatrixLanes L; };
+template <> struct MatrixLanesOf<float>  { typedef FloatMatrixLanes L; };
+
+typedef Lanes::V V;
+const int W = Lanes::width;
+
+template <bool fast>
+static inline V ExpLanes(V x)
+{
+    //out of range: exp(709) above, 0 below -708
+    V xc = Lanes::Min(Lanes::Max(x, Lanes::Set(-708.0)), Lanes::Set(709.0));
+    V k  = Lanes::Round(Lanes::Mul(xc, Lanes::Set(log2e)));
+    V r  = Lanes::Fnma(k, Lanes::Set(ln2hi), xc);
+    r    = Lanes::Fnma(k, Lanes::Set(ln2lo), r);
+
+    //Taylor polynomial of degree 13 (9 in fast mode)
+    V p;
+    if (fast)
+    {
+        p = Lanes::Set(1.0/362880.0);
+    }
+    else
+    {
+        p = Lanes::Set(1.0/6227020800.0);
+        p = Lanes::Fma(p, r, Lanes::Set(1.0/479001600.0));
+        p = Lanes::Fma(p, r, Lanes::Set(1.0/39916800.0));
+        p = Lanes::Fma(p, r, Lanes::Set(1.0/3628800.0));
+        p = Lanes::Fma(p, r, Lanes::Set(1.0/362880.0));
+    }
+    p = Lanes::Fma(p, r, Lanes::Set(1.0/40320.0));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0/5040.0));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0/720.0));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0/120.0));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0/24.0));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0/6.0));
+    p = Lanes::Fma(p, r, Lanes::Set(0.5));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0));
+    p = Lanes::Fma(p, r, Lanes::Set(1.0));
+
+    //multiply by 2^k adding k to the exponent bits
+    V kbits = Lanes::SubI(Lanes::Add(k, Lanes::Set(magic)), Lanes::Set(magic));
+    V value = Lanes::AddI(p, Lanes::ShiftI<52>(kbits));
+    return Lanes::AndNot(Lanes::Less(x, Lanes::Set(-708.0)), value);
+}
+
+template <bool fast>
+static inline void SinCosLanes(V x, V& sinx, V& cosx)
+{
+    V k = Lanes::Round(Lanes::Mul(x, Lanes::Set(twoOverPi)));
+    V r = Lanes::Fnma(k, Lanes::Set(pio2hi), x);
+    r   = Lanes::Fnma(k, Lanes::Set(pio2lo), r);
+    V z = Lanes::Mul(r, r);
+
+    //sin r = r + r^3 P(r^2), cos r = 1 - r^2/2 + r^4 Q(r^2); the fast mode drops the last coefficient
+    V P = fast ? Lanes::Set(S5) : Lanes::Fma(z, Lanes::Set(S6), Lanes::Set(S5));
+    P = Lanes::Fma(z, P, Lanes::Set(S4));
+    P = Lanes::Fma(z, P, Lanes::Set(S3));
+    P = Lanes::Fma(z, P, Lanes::Set(S2));
+    P = Lanes::Fma(z, P, Lanes::Set(S1));
+    V s = Lanes::Fma(Lanes::Mul(z, r), P, r);
+
+    V Q = fast ? Lanes::Set(C5) : Lanes::Fma(z, Lanes::Set(C6), Lanes::Set(C5));
+    Q = Lanes::Fma(z, Q, Lanes::Set(C4));
+    Q = Lanes::Fma(z, Q, Lanes::Set(C3));
+    Q = Lanes::Fma(z, Q, Lanes::Set(C2));
+    Q = Lanes::Fma(z, Q, Lanes::Set(C1));
+    V hz = Lanes::Mul(Lanes::Set(0.5), z);
+    V w  = Lanes::Sub(Lanes::Set(1.0), hz);
+    //w + ((1 - w) - hz) recovers the rounding of 1 - hz
+    V c  = Lanes::Add(w, Lanes::Fma(Lanes::Mul(z, z), Q, Lanes::Sub(Lanes::Sub(Lanes::Set(1.0), w), hz)));
+
+    //quadrant q = k mod 4: odd quadrants swap sin and cos, sin changes sign for q = 2, 3 and cos for q = 1, 2
+    V q    = Lanes::SubI(Lanes::Add(k, Lanes::Set(magic)), Lanes::Set(magic));
+    V one  = Lanes::SetBits(1);
+    V two  = Lanes::SetBits(2);
+    V swap = Lanes::SubI(Lanes::SetBits(0), Lanes::And(q, one));
+    V diff = Lanes::And(Lanes::Xor(s, c), swap);
+    sinx = Lanes::Xor(Lanes::Xor(s, diff), Lanes::ShiftI<62>(Lanes::And(q, two)));
+    cosx = Lanes::Xor(Lanes::Xor(c, diff), Lanes::ShiftI<62>(Lanes::And(Lanes::AddI(q, one), two)));
+}
+
+template <bool fast>
+void ExpArray(const double* x, double* y, int n)
+{
+    int i = 0;
+    for (; i + W <= n; i += W)
+    {
+        Lanes::Store(y + i, ExpLanes<fast>(Lanes::Load(x + i)));
+    }
+    if (i < n)
+    {
+        //the remainder through a padded vector
+        double buffer[W] = {};
+        for (int l = 0; l < n - i; l++)
+        {
+            buffer[l] = x[i + l];
+        }
+        Lanes::Store(buffer, ExpLanes<fast>(Lanes::Load(buffer)));
+        for (int l = 0; l < n - i; l++)
+        {
+            y[i + l] = buffer[l];
+        }
+    }
+}
+
+void Exp(const double* x, double* y, int n, bool fast)
+{
+    if (fast)
+    {
+        ExpArray<true>(x, y, n);
+    }
+    else
+    {
+        ExpArray<false>(x, y, n);
+    }
+}
+
+#ifdef KERNELS_LIBM_SINCOS
+void SinCos(const double* x, double* s, double* c, int n, bool)
+{
+    for (int i = 0; i < n; i++)
+    {
+        double xi = x[i];
+        s[i] = std::sin(xi);
+        c[i] = std::cos(xi);
+    }
+}
+#else
+template <bool fast>
+void SinCosArray(const double* x, double* s, double* c, int n)
+{
+    V limit = Lanes::Set(sinCosLimit);
+    V absMask = Lanes::SetBits(0x7fffffffffffffffLL);
+    for (int i = 0; i < n; i += W)
+    {
+        int m = (n - i < W) ? n - i : W;
+        double xb[W] = {};
+        double sb[W];
+        double cb[W];
+        V xv;
+        if (m == W)
+        {
+            xv = Lanes::Load(x + i);
+        }
+        else
+        {
+            for (int l = 0; l < m; l++)
+            {
+                xb[l] = x[i + l];
+            }
+            xv = Lanes::Load(xb);
+        }
+        V sv, cv;
+        SinCosLanes<fast>(xv, sv, cv);
+        bool large = Lanes::AnyGreater(Lanes::And(xv, absMask), limit);
+        if (m == W && !large)
+        {
+            Lanes::Store(s + i, sv);
+            Lanes::Store(c + i, cv);
+            continue;
+        }
+
+        //remainder, or arguments beyond the reduction
+        Lanes::Store(sb, sv);
+        Lanes::Store(cb, cv);
+        for (int l = 0; l < m; l++)
+        {
+            if (x[i + l] > sinCosLimit || x[i + l] < -sinCosLimit)
+            {
+                sb[l] = std::sin(x[i + l]);
+                cb[l] = std::cos(x[i + l]);
+            }
+            s[i + l] = sb[l];
+            c[i + l] = cb[l];
+        }
+    }
+}
+
+void SinCos(const double* x, double* s, double* c, int n, bool fast)
+{
+    if (fast)
+    {
+        SinCosArray<true>(x, s, c, n);
+    }
+    else
+    {
+        SinCosArray<false>(x, s, c, n);
+    }
+}
+#endif
+
+//sums of the lanes: a with alternating signs (re*re - im*im of the products) and b
+template <class L>
+inline void Reduce(typename L::V a, typename L::V b, double& re, double& im)
+{
+    typename L::Scalar la[L::width];
+    typename L::Scalar lb[L::width];
+    L::Store(la, a);
+    L::Store(lb, b);
+    for (int l = 0; l < L::width; l += 2)
+    {
+        re += la[l] - la[l + 1];
+        im += lb[l] + lb[l + 1];
+    }
+}
+
+//the float lanes summed in float, without storing them
+template <>
+inline void Reduce<FloatMatrixLanes>(FloatMatrixLanes::V a, FloatMatrixLanes::V b, double& re, double& im)
+{
+    double sums[2];
+    _mm_storeu_pd(sums, FloatMatrixLanes::Sums(a, b));
+    re += sums[0];
+    im += sums[1];
+}
+
+//-conj(v) x_j = v (-xr, xr) + swap(v) (-xi, -xi): the pair of factors of the lower triangle update by x_j
+template <class L>
+inline void LowerFactors(typename L::Scalar xr, typename L::Scalar xi, typename L::V& ca, typename L::V& cb)
+{
+    typename L::Scalar pattern[L::width];
+    for (int l = 0; l < L::width; l += 2)
+    {
+        pattern[l]     = -xr;
+        pattern[l + 1] =  xr;
+    }
+    ca = L::Load(pattern);
+    cb = L::Set(-xi);
+}
+
+//distance of the regions of n elements T in the scratch: beyond 4 KiB a multiple of 4 KiB plus 128 bytes, as loads
+//from one region after stores to another at the same offset in a 4 KiB page would wait for the stores (4K aliasing)
+template <class T>
+inline int ScratchStride(int n)
+{
+    const int page = 4096/sizeof(T);
+    return (n < page) ? n : (n + page - 1)/page*page + 128/sizeof(T);
+}
+
+//bytes of the scratch of the stages kept on the stack (the per-thread scratch costs more than the product of small systems)
+const int stackScratch = 2048;
+
+//per-thread scratch of the stages, grown to the largest size asked. A plain buffer: the members of a std::vector
+//instantiated here would be weak symbols compiled for this instruction set, and the linker could pick them for all
+struct ScratchBuffer
+{
+    void* data = nullptr;
+    std::size_t bytes = 0;
+    ~ScratchBuffer() { std::free(data); }
+};
+
+//scratch of the stages (n elements): local if large enough, per thread otherwise
+template <class T, int size>
+inline T* Scratch(int n, T (&local)[size])
+{
+    if (n <= size)
+    {
+        return local;
+    }
+    thread_local ScratchBuffer scratch;
+    std::size_t bytes = (std::size_t)n*sizeof(T);
+    if (scratch.bytes < bytes)
+    {
+        //whole cache lines, as aligned_alloc needs a multiple of the alignment
+        bytes = (bytes + 63)/64*64;
+        std::free(scratch.data);
+        scratch.data = std::aligned_alloc(64, bytes);
+        scratch.bytes = (scratch.data != nullptr) ? bytes : 0;
+        if (scratch.data == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+    }
+    return static_cast<T*>(scratch.data);
+}
+
+//x interleaved from its parts: the rows of the matrices are interleaved, and one load of x (with its parts swapped
+//in a register) serves both products, where the parts would take a load each. Written by whole vectors, as the
+//loads of the stages wait for the scalar stores of the same vector to reach the cache
+inline void Interleave(int D, const double* xr, const double* xi, double* x)
+{
+    typedef MatrixLanes L;
+    const int H = L::width/2;
+    int k = 0;
+    for (; k + H <= D; k += H)
+    {
+        L::Store(x + 2*k, L::LoadZip(xr + k, xi + k));
+    }
+    for (; k < D; k++)
+    {
+        x[2*k]     = xr[k];
+        x[2*k + 1] = xi[k];
+    }
+}
+
+//K_j, K_j+1 to the parts by one 128-bit store each: the 2-wide loads of the callers find them whole in the store buffer
+inline void StorePair(double* Kr, double* Ki, double re0, double im0, double re1, double im1)
+{
+    _mm_storeu_pd(Kr, _mm_set_pd(re1, re0));
+    _mm_storeu_pd(Ki, _mm_set_pd(im1, im0));
+}
+
+//K_j, K_j+1 written to K (the stage kernels)
+struct StoreOutput
+{
+    double* Kr;
+    double* Ki;
+
+    void Pair(int j, double re0, double im0, double re1, double im1) { StorePair(Kr + j, Ki + j, re0, im0, re1, im1); }
+    void Single(int j, double re, double im)
+    {
+        Kr[j] = re;
+        Ki[j] = im;
+    }
+};
+
+//K_j, K_j+1 written to K and to A (first stage of the fused step)
+struct StartOutput
+{
+    double* Kr;
+    double* Ki;
+    double* Ar;
+    double* Ai;
+
+    void Pair(int j, double re0, double im0, double re1, double im1)
+    {
+        StorePair(Kr + j, Ki + j, re0, im0, re1, im1);
+        StorePair(Ar + j, Ai + j, re0, im0, re1, im1);
+    }
+    void Single(int j, double re, double im)
+    {
+        Kr[j] = Ar[j] = re;
+        Ki[j] = Ai[j] = im;
+    }
+};
+
+//K_j, K_j+1 written to K and added to A with the weight w (middle stages)
+struct AccumulateOutput
+{
+    double* Kr;
+    double* Ki;
+    double* Ar;
+    double* Ai;
+    double w;
+
+    void Pair(int j, double re0, double im0, double re1, double im1)
+    {
+        StorePair(Kr + j, Ki + j, re0, im0, re1, im1);
+        __m128d wv = _mm_set1_pd(w);
+        _mm_storeu_pd(Ar + j, _mm_add_pd(_mm_loadu_pd(Ar + j), _mm_mul_pd(wv, _mm_set_pd(re1, re0))));
+        _mm_storeu_pd(Ai + j, _mm_add_pd(_mm_loadu_pd(Ai + j), _mm_mul_pd(wv, _mm_set_pd(im1, im0))));
+    }
+    void Single(int j, double re, double im)
+    {
+        Kr[j] = re;
+        Ki[j] = im;
+        Ar[j] += w*re;
+        Ai[j] += w*im;
+    }
+};
+
+//y_j = s y_j + w (A_j + K_j) and its norm, in place of K (last stage)
+struct FinishOutput
+{
+    double* yr;
+    double* yi;
+    const double* Ar;
+    const double* Ai;
+    double s;
+    double w;
+    __m128d norm;
+
+    void Pair(int j, double re0, double im0, double re1, double im1)
+    {
+        __m128d sv = _mm_set1_pd(s);
+        __m128d wv = _mm_set1_pd(w);
+        __m128d r = _mm_add_pd(_mm_mul_pd(sv, _mm_loadu_pd(yr + j)), _mm_mul_pd(wv, _mm_add_pd(_mm_loadu_pd(Ar + j), _mm_set_pd(re1, re0))));
+        __m128d i = _mm_add_pd(_mm_mul_pd(sv, _mm_loadu_pd(yi + j)), _mm_mul_pd(wv, _mm_add_pd(_mm_loadu_pd(Ai + j), _mm_set_pd(im1, im0))));
+        _mm_storeu_pd(yr + j, r);
+        _mm_storeu_pd(yi + j, i);
+        norm = _mm_add_pd(norm, _mm_add_pd(_mm_mul_pd(r, r), _mm_mul_pd(i, i)));
+    }
+    void Single(int j, double re, double im)
+    {
+        double r = s*yr[j] + w*(Ar[j] + re);
+        double i = s*yi[j] + w*(Ai[j] + im);
+        yr[j] = r;
+        yi[j] = i;
+        norm = _mm_add_sd(norm, _mm_set_sd(r*r + i*i));
+    }
+    double Norm() const
+    {
+        double lanes[2];
+        _mm_storeu_pd(lanes, norm);
+        return lanes[0] + lanes[1];
+    }
+};
+
+//x_k, x_k+1, ... = value(k) by whole vectors of doubles, or of floats rounded from two lanes of doubles; the
+//index of the first element left
+template <class Value>
+inline int StoreLanes(int D, double* x, Value value)
+{
+    const int H = MatrixLanes::width/2;
+    int k = 0;
+    for (; k + H <= D; k += H)
+    {
+        MatrixLanes::Store(x + 2*k, value(k));
+    }
+    return k;
+}
+
+template <class Value>
+inline int StoreLanes(int D, float* x, Value value)
+{
+    const int H = MatrixLanes::width/2;
+    int k = 0;
+    for (; k + 2*H <= D; k += 2*H)
+    {
+        MatrixLanes::StoreFloats(x + 2*k, value(k), value(k + H));
+    }
+    return k;
+}
+
+//x = s y + c p, interleaved as in Interleave (p is not read if c is zero)
+template <class T>
+inline void FormInput(int D, const FusedStage& f, T* x)
+{
+    typedef MatrixLanes L;
+    L::V s = L::Set(f.s);
+    if (f.c == 0.0)
+    {
+        int k = StoreLanes(D, x, [&](int k) { return L::Mul(s, L::LoadZip(f.yr + k, f.yi + k)); });
+        for (; k < D; k++)
+        {
+            x[2*k]     = f.s*f.yr[k];
+            x[2*k + 1] = f.s*f.yi[k];
+        }
+        return;
+    }
+    L::V c = L::Set(f.c);
+    int k = StoreLanes(D, x, [&](int k) { return L::Add(L::Mul(s, L::LoadZip(f.yr + k, f.yi + k)), L::Mul(c, L::LoadZip(f.pr + k, f.pi + k))); });
+    for (; k < D; k++)
+    {
+        x[2*k]     = f.s*f.yr[k] + f.c*f.pr[k];
+        x[2*k + 1] = f.s*f.yi[k] + f.c*f.pi[k];
+    }
+}
+
+//K_j = sum_k M_jk x_k for the interleaved x: the products of a row with x give (Vr xr, Vi xi) in a and, with re and
+//im of x swapped, (Vr xi, Vi xr) in b. Rows are taken in pairs, which share the loads of x and overlap the latency
+//of the multiply-adds. L gives the element type of M and x (MatrixLanesOf), the products are summed in it
+template <class L, class Output>
+inline void StageRows(int D, const typename L::Scalar* M, const typename L::Scalar* x, Output& out)
+{
+    typedef typename L::V V;
+    const int W = L::width;
+    const int n = 2*D;
+    int j = 0;
+    for (; j + 1 < D; j += 2)
+    {
+        const typename L::Scalar* row0 = M + (long)j*n;
+        const typename L::Scalar* row1 = row0 + n;
+        V a0 = L::Set(0.0), b0 = L::Set(0.0);
+        V a1 = L::Set(0.0), b1 = L::Set(0.0);
+        int k = 0;
+        for (; k + W <= n; k += W)
+        {
+            V xk = L::Load(x + k);
+            V xw = L::SwapPairs(xk);
+            V v0 = L::Load(row0 + k);
+            V v1 = L::Load(row1 + k);
+            a0 = L::Fma(v0, xk, a0);
+            b0 = L::Fma(v0, xw, b0);
+            a1 = L::Fma(v1, xk, a1);
+            b1 = L::Fma(v1, xw, b1);
+        }
+        double re0 = 0.0, im0 = 0.0;
+        double re1 = 0.0, im1 = 0.0;
+        Reduce<L>(a0, b0, re0, im0);
+        Reduce<L>(a1, b1, re1, im1);
+        for (; k < n; k += 2)
+        {
+            re0 += row0[k]*x[k] - row0[k + 1]*x[k + 1];
+            im0 += row0[k]*x[k + 1] + row0[k + 1]*x[k];
+            re1 += row1[k]*x[k] - row1[k + 1]*x[k + 1];
+            im1 += row1[k]*x[k + 1] + row1[k + 1]*x[k];
+        }
+        out.Pair(j, re0, im0, re1, im1);
+    }
+    //last row of odd D
+    if (j < D)
+    {
+        const typename L::Scalar* row = M + (long)j*n;
+        V a = L::Set(0.0), b = L::Set(0.0);
+        int k = 0;
+        for (; k + W <= n; k += W)
+        {
+            V v = L::Load(row + k);
+            V xk = L::Load(x + k);
+            a = L::Fma(v, xk, a);
+            b = L::Fma(v, L::SwapPairs(xk), b);
+        }
+        double re = 0.0;
+        double im = 0.0;
+        Reduce<L>(a, b, re, im);
+        for (; k < n; k += 2)
+        {
+            re += row[k]*x[k] - row[k + 1]*x[k + 1];
+            im += row[k]*x[k + 1] + row[k + 1]*x[k];
+        }
+        out.Single(j, re, im);
+    }
+}
+
+//K = V x for the anti-Hermitian V (V_kj = -conj(V_jk)) given by the rows of its upper triangle, packed one after the
+//other from the diagonal: each element V_jk of row j is read once, for the dot product of K_j and for the update
+//-conj(V_jk) x_j of K_k (the lower triangle), as in the BLAS hemv. Rows are taken in pairs: the updates are summed
+//in the interleaved scratch K (stride doubles after x), read and written once per pair, and those of consecutive
+//pairs start a whole vector apart (no store forwarding stalls; half a vector for floats with AVX2, which only matters
+//at small D)
+template <class L, class Output>
+inline void PackedStageRows(int D, const typename L::Scalar* M, const typename L::Scalar* x, typename L::Scalar* K, Output& out)
+{
+    typedef typename L::Scalar T;
+    typedef typename L::V V;
+    const int W = L::width;
+    const int n = 2*D;
+    //the first pair writes K, the others add to it (zeroing K first costs a call to memset, more than the product at small D)
+    const T* row0 = M;
+    int j = 0;
+    for (; j + 1 < D; j += 2)
+    {
+        const bool first = (j == 0);
+        const T* row1 = row0 + 2*(D - j);
+        T x0r = x[2*j];
+        T x0i = x[2*j + 1];
+        T x1r = x[2*j + 2];
+        T x1i = x[2*j + 3];
+        //the 2 x 2 block on the diagonal: V_jj, V_j,j+1 and V_j+1,j = -conj(V_j,j+1), V_j+1,j+1
+        double re0 = (first ? 0.0 : K[2*j])     + row0[0]*x0r - row0[1]*x0i + row0[2]*x1r - row0[3]*x1i;
+        double im0 = (first ? 0.0 : K[2*j + 1]) + row0[0]*x0i + row0[1]*x0r + row0[2]*x1i + row0[3]*x1r;
+        double re1 = (first ? 0.0 : K[2*j + 2]) - row0[2]*x0r - row0[3]*x0i + row1[0]*x1r - row1[1]*x1i;
+        double im1 = (first ? 0.0 : K[2*j + 3]) + row0[3]*x0r - row0[2]*x0i + row1[0]*x1i + row1[1]*x1r;
+
+        //columns right of the block
+        const T* v0 = row0 + 4;
+        const T* v1 = row1 + 2;
+        const T* xs = x + 2*(j + 2);
+        T* Ks = K + 2*(j + 2);
+        const int m = n - 2*(j + 2);
+        int k = 0;
+        if (m >= W)
+        {
+            V ca0, cb0, ca1, cb1;
+            LowerFactors<L>(x0r, x0i, ca0, cb0);
+            LowerFactors<L>(x1r, x1i, ca1, cb1);
+            V a0 = L::Set(0.0), b0 = L::Set(0.0);
+            V a1 = L::Set(0.0), b1 = L::Set(0.0);
+            for (; k + W <= m; k += W)
+            {
+                V w0 = L::Load(v0 + k);
+                V w1 = L::Load(v1 + k);
+                V xk = L::Load(xs + k);
+                V xw = L::SwapPairs(xk);
+                a0 = L::Fma(w0, xk, a0);
+                b0 = L::Fma(w0, xw, b0);
+                a1 = L::Fma(w1, xk, a1);
+                b1 = L::Fma(w1, xw, b1);
+                V Kk = first ? L::Set(0.0) : L::Load(Ks + k);
+                Kk = L::Fma(w0, ca0, Kk);
+                Kk = L::Fma(L::SwapPairs(w0), cb0, Kk);
+                Kk = L::Fma(w1, ca1, Kk);
+                Kk = L::Fma(L::SwapPairs(w1), cb1, Kk);
+                L::Store(Ks + k, Kk);
+            }
+            Reduce<L>(a0, b0, re0, im0);
+            Reduce<L>(a1, b1, re1, im1);
+        }
+        for (; k < m; k += 2)
+        {
+            re0 += v0[k]*xs[k] - v0[k + 1]*xs[k + 1];
+            im0 += v0[k]*xs[k + 1] + v0[k + 1]*xs[k];
+            re1 += v1[k]*xs[k] - v1[k + 1]*xs[k + 1];
+            im1 += v1[k]*xs[k + 1] + v1[k + 1]*xs[k];
+            Ks[k]     = (first ? 0.0 : Ks[k])     - v0[k]*x0r - v0[k + 1]*x0i - v1[k]*x1r - v1[k + 1]*x1i;
+            Ks[k + 1] = (first ? 0.0 : Ks[k + 1]) + v0[k + 1]*x0r - v0[k]*x0i + v1[k + 1]*x1r - v1[k]*x1i;
+        }
+        out.Pair(j, re0, im0, re1, im1);
+        row0 = row1 + 2*(D - j - 1);
+    }
+    //last row of odd D: only its diagonal element
+    if (j < D)
+    {
+        double re = (j == 0) ? 0.0 : K[2*j];
+        double im = (j == 0) ? 0.0 : K[2*j + 1];
+        out.Single(j, re + row0[0]*x[2*j] - row0[1]*x[2*j + 1], im + row0[0]*x[2*j + 1] + row0[1]*x[2*j]);
+    }
+}
+
+void Stage(int D, const double* M, const double* xr, const double* xi, double* Kr, double* Ki)
+{
+    double local[stackScratch/sizeof(double)];
+    double* x = Scratch(2*D, local);
+    Interleave(D, xr, xi, x);
+    StoreOutput out = {Kr, Ki};
+    StageRows<MatrixLanes>(D, M, x, out);
+}
+
+void PackedStage(int D, const double* M, const double* xr, const double* xi, double* Kr, double* Ki)
+{
+    const int stride = ScratchStride<double>(2*D);
+    double local[stackScratch/sizeof(double)];
+    double* x = Scratch(2*stride, local);
+    Interleave(D, xr, xi, x);
+    StoreOutput out = {Kr, Ki};
+    PackedStageRows<MatrixLanes>(D, M, x, x + stride, out);
+}
+
+//the output of the fused stage f on the rows given by rows(out)
+template <class Rows>
+inline double FusedOutputs(const FusedStage& f, Rows rows)
+{
+    if (f.output == FUSED_START)
+    {
+        StartOutput out = {f.Kr, f.Ki, f.Ar, f.Ai};
+        rows(out);
+        return 0.0;
+    }
+    if (f.output == FUSED_ACCUMULATE)
+    {
+        AccumulateOutput out = {f.Kr, f.Ki, f.Ar, f.Ai, f.w};
+        rows(out);
+        return 0.0;
+    }
+    FinishOutput out = {f.yr, f.yi, f.Ar, f.Ai, f.s, f.w, _mm_setzero_pd()};
+    rows(out);
+    return out.Norm();
+}
+
+//fused stage on matrices of elements T: for float, x is rounded to float and the products are summed in float,
+//while the state, the stages and their sum stay in double
+template <class T>
+double FusedStep(int D, const T* M, const FusedStage& f)
+{
+    typedef typename MatrixLanesOf<T>::L L;
+    T local[stackScratch/sizeof(T)];
+    T* x = Scratch(2*D, local);
+    FormInput(D, f, x);
+    return FusedOutputs(f, [&](auto& out) { StageRows<L>(D, M, x, out); });
+}
+
+template <class T>
+double PackedFusedStep(int D, const T* M, const FusedStage& f)
+{
+    typedef typename MatrixLanesOf<T>::L L;
+    const int stride = ScratchStride<T>(2*D);
+    T local[stackScratch/sizeof(T)];
+    T* x = Scratch(2*stride, local);
+    FormInput(D, f, x);
+    return FusedOutputs(f, [&](auto& out) { PackedStageRows<L>(D, M, x, x + stride, out); });
+}
+
+//out_j = a wr_j conj(p_j) for j < n, rounded to T
+template <class T>
+inline void DriveRow(double ar, double ai, const double* w, const double* p, T* out, int n)
+{
+    for (int j = 0; j < n; j++)
+    {
+        double br = ar*w[2*j] - ai*w[2*j + 1];
+        double bi = ar*w[2*j + 1] + ai*w[2*j];
+        out[2*j]     = br*p[2*j] + bi*p[2*j + 1];
+        out[2*j + 1] = bi*p[2*j] - br*p[2*j + 1];
+    }
+}
+
+//V_ij = a_i wr_ij conj(p_j) with a_i = -i drive p_i
+template <class T>
+void Drive(int D, double drive, const double* wr, const double* p, T* V)
+{
+    for (int i = 0; i < D; i++)
+    {
+        DriveRow(drive*p[2*i + 1], -drive*p[2*i], wr + (long)i*2*D, p, V + (long)i*2*D, D);
+    }
+}
+
+//Drive on the rows of the upper triangles of wr and V, packed as in PackedStage
+template <class T>
+void PackedDrive(int D, double drive, const double* wr, const double* p, T* V)
+{
+    long offset = 0;
+    for (int i = 0; i < D; i++)
+    {
+        DriveRow(drive*p[2*i + 1], -drive*p[2*i], wr + offset, p + 2*i, V + offset, D - i);
+        offset += 2*(D - i);
+    }
+}
+
+}
+
+namespace QQEVOL_KERNELS
+{
+#if defined(__AVX512F__)
+extern const KernelTable table = {"avx512", Stage, PackedStage, FusedStep<double>, PackedFusedStep<double>, FusedStep<float>, PackedFusedStep<float>,
+                                  Drive<double>, PackedDrive<double>, Drive<float>, PackedDrive<float>, Exp, SinCos};
+#elif defined(__AVX2__)
+extern const KernelTable table = {"avx2", Stage, PackedStage, FusedStep<double>, PackedFusedStep<double>, FusedStep<float>, PackedFusedStep<float>,
+                                  Drive<double>, PackedDrive<double>, Drive<float>, PackedDrive<float>, Exp, SinCos};
+#else
+extern const KernelTable table = {"sse2", Stage, PackedStage, FusedStep<double>, PackedFusedStep<double>, FusedStep<float>, PackedFusedStep<float>,
+                                  Drive<double>, PackedDrive<double>, Drive<float>, PackedDrive<float>, Exp, SinCos};
+#endif
+}
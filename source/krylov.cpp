@@ -0,0 +1,427 @@
+#include "krylov.h"
+#include "linalg.h"
+#include "potentials.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+//halvings of tau tried when the largest subspace is not enough
+static const int maxHalvings = 60;
+
+//exp(-i tau T) e_1 for the tridiagonal T of the Lanczos coefficients alpha (diagonal) and beta (off-diagonal)
+static std::vector<std::complex<double>> TridiagonalExp(const std::vector<double>& alpha, const std::vector<double>& beta, int m, double tau)
+{
+    ComplexMatrix T(m*m, 0.0);
+    for (int i = 0; i < m; i++)
+    {
+        T[i*m + i] = alpha[i];
+        if (i+1 < m)
+        {
+            T[i*m + i+1] = beta[i];
+            T[(i+1)*m + i] = beta[i];
+        }
+    }
+    std::vector<double> values;
+    ComplexMatrix vectors;
+    HermitianEigen(m, T, values, vectors);
+
+    std::vector<std::complex<double>> c(m, 0.0);
+    for (int k = 0; k < m; k++)
+    {
+        std::complex<double> weight = std::complex<double>(std::cos(tau*values[k]), -std::sin(tau*values[k]))*std::conj(vectors[k]);
+        for (int i = 0; i < m; i++)
+        {
+            c[i] += vectors[i*m + k]*weight;
+        }
+    }
+    return c;
+}
+
+bool KrylovExp(int D, MatVecFunction apply, double tau, std::vector<std::complex<double>>& psi, int maxDimension, double tol, KrylovStats& stats)
+{
+    stats.exponentials++;
+    //Lanczos basis kept between calls: two exponentials per step would otherwise allocate it each time
+    static thread_local std::vector<std::vector<std::complex<double>>> V;
+    if ((int)V.size() < maxDimension + 1 || (int)V[0].size() != D)
+    {
+        V.assign(maxDimension + 1, std::vector<std::complex<double>>(D));
+    }
+    std::vector<double> alpha(maxDimension);
+    std::vector<double> beta(maxDimension);
+    std::vector<std::complex<double>> w(D);
+
+    double left = tau;
+    while (left > 0.0)
+    {
+        double norm = 0.0;
+        for (const auto& value : psi)
+        {
+            norm += std::norm(value);
+        }
+        norm = std::sqrt(norm);
+        if (norm == 0.0)
+        {
+            return true;
+        }
+        for (int i = 0; i < D; i++)
+        {
+            V[0][i] = psi[i]/norm;
+        }
+
+        //Lanczos with reorthogonalization, until the estimate meets tol or the subspace is full
+        int m = 0;
+        double piece = left;
+        double estimate = 0.0;
+        double scale = 0.0;
+        std::vector<std::complex<double>> c;
+        for (int j = 0; j < maxDimension; j++)
+        {
+            apply(V[j].data(), w.data());
+            stats.matvecs++;
+            std::complex<double> projection = 0.0;
+            for (int i = 0; i < D; i++)
+            {
+                projection += std::conj(V[j][i])*w[i];
+            }
+            alpha[j] = projection.real();
+            for (int i = 0; i < D; i++)
+            {
+                w[i] -= alpha[j]*V[j][i];
+            }
+            if (j > 0)
+            {
+                for (int i = 0; i < D; i++)
+                {
+                    w[i] -= beta[j-1]*V[j-1][i];
+                }
+            }
+            //one pass against the whole basis keeps it orthogonal to round-off
+            for (int k = 0; k <= j; k++)
+            {
+                std::complex<double> overlap = 0.0;
+                for (int i = 0; i < D; i++)
+                {
+                    overlap += std::conj(V[k][i])*w[i];
+                }
+                for (int i = 0; i < D; i++)
+                {
+                    w[i] -= overlap*V[k][i];
+                }
+            }
+            double b = 0.0;
+            for (const auto& value : w)
+            {
+                b += std::norm(value);
+            }
+            b = std::sqrt(b);
+            beta[j] = b;
+            m = j + 1;
+            scale = std::max(scale, std::abs(alpha[j]) + b);
+
+            c = TridiagonalExp(alpha, beta, m, piece);
+            //invariant subspace: the exponential is exact
+            if (b <= 1.0e-14*scale || m == D)
+            {
+                estimate = 0.0;
+                break;
+            }
+            estimate = norm*piece*b*std::abs(c[m-1]);
+            if (estimate <= tol)
+            {
+                break;
+            }
+            for (int i = 0; i < D; i++)
+            {
+                V[j+1][i] = w[i]/b;
+            }
+        }
+
+        //subspace too small for the whole interval: the largest piece (halving) that meets tol
+        for (int halving = 0; estimate > tol && halving < maxHalvings; halving++)
+        {
+            piece *= 0.5;
+            c = TridiagonalExp(alpha, beta, m, piece);
+            estimate = norm*piece*beta[m-1]*std::abs(c[m-1]);
+        }
+        //not even the smallest piece meets tol: psi is left at the start of the piece
+        if (estimate > tol)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < D; i++)
+        {
+            std::complex<double> sum = 0.0;
+            for (int k = 0; k < m; k++)
+            {
+                sum += V[k][i]*c[k];
+            }
+            psi[i] = norm*sum;
+        }
+        stats.substeps++;
+        stats.errorEstimate += estimate;
+        left = (piece == left) ? 0.0 : left - piece;
+    }
+    return true;
+}
+
+std::shared_ptr<LabHamiltonian> LabHamiltonian::Load(const json& input, const SystemData& sys)
+{
+    int D = sys.D;
+    std::shared_ptr<LabHamiltonian> H(new LabHamiltonian());
+    H->D_ = D;
+    H->levels_.resize(D);
+    for (int i = 0; i < D; i++)
+    {
+        H->levels_[i] = sys.wl[i]/hbar;
+    }
+
+    //nonzero couplings by rows, from either input layout
+    std::vector<std::vector<std::pair<int, std::complex<double>>>> rows(D);
+    if (input.contains("wr_sparse"))
+    {
+        for (const auto& entry : input["wr_sparse"])
+        {
+            if (!entry.is_array() || entry.size() != 3 || !entry[0].is_number_integer() || !entry[1].is_number_integer() || !entry[2].is_number())
+            {
+                std::cerr << "Wrong entry " << entry << " of 'wr_sparse', expected [row, column, value]!\n";
+                return nullptr;
+            }
+            int i = entry[0];
+            int j = entry[1];
+            double value = entry[2];
+            if (i < 0 || i >= D || j < 0 || j >= D)
+            {
+                std::cerr << "Entry " << entry << " of 'wr_sparse' is outside the " << D << " states!\n";
+                return nullptr;
+            }
+            rows[i].push_back({j, value});
+            if (i != j)
+            {
+                rows[j].push_back({i, value});
+            }
+        }
+        for (int i = 0; i < D; i++)
+        {
+            std::sort(rows[i].begin(), rows[i].end(), [](const std::pair<int, std::complex<double>>& a, const std::pair<int, std::complex<double>>& b) { return a.first < b.first; });
+            for (int k = 1; k < (int)rows[i].size(); k++)
+            {
+                if (rows[i][k].first == rows[i][k-1].first)
+                {
+                    std::cerr << "The coupling (" << i << ", " << rows[i][k].first << ") is given twice in 'wr_sparse': "
+                              << "each coupling is listed once, the symmetric entry is implied!\n";
+                    return nullptr;
+                }
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; i < D; i++)
+        {
+            for (int j = 0; j < D; j++)
+            {
+                if (sys.wr[i*D + j] != std::conj(sys.wr[j*D + i]))
+                {
+                    std::cerr << "The matrix 'wr' must be symmetric for the krylov integrator!\n";
+                    return nullptr;
+                }
+                if (sys.wr[i*D + j] != 0.0)
+                {
+                    rows[i].push_back({j, sys.wr[i*D + j]});
+                }
+            }
+        }
+    }
+
+    long nonzeros = 0;
+    for (const auto& row : rows)
+    {
+        nonzeros += (long)row.size();
+    }
+    std::string layout = input.value("wr_layout", std::string("auto"));
+    H->sparse_ = (layout == "sparse") || (layout == "auto" && 4*nonzeros <= (long)D*D);
+
+    H->rowStart_.assign(1, 0);
+    for (int i = 0; i < D; i++)
+    {
+        for (const auto& entry : rows[i])
+        {
+            H->column_.push_back(entry.first);
+            H->values_.push_back(entry.second);
+        }
+        H->rowStart_.push_back((long)H->values_.size());
+    }
+    if (!H->sparse_)
+    {
+        H->dense_.assign((long)D*D, 0.0);
+        for (int i = 0; i < D; i++)
+        {
+            for (long k = H->rowStart_[i]; k < H->rowStart_[i+1]; k++)
+            {
+                H->dense_[(long)i*D + H->column_[k]] = H->values_[k];
+            }
+        }
+        H->rowStart_.clear();
+        H->column_.clear();
+    }
+    return H;
+}
+
+void LabHamiltonian::Apply(double level, double drive, const std::complex<double>* x, std::complex<double>* y) const
+{
+    int D = D_;
+    for (int i = 0; i < D; i++)
+    {
+        std::complex<double> sum = 0.0;
+        if (sparse_)
+        {
+            for (long k = rowStart_[i]; k < rowStart_[i+1]; k++)
+            {
+                sum += values_[k]*x[column_[k]];
+            }
+        }
+        else
+        {
+            const std::complex<double>* row = &dense_[(long)i*D];
+            for (int j = 0; j < D; j++)
+            {
+                sum += row[j]*x[j];
+            }
+        }
+        y[i] = level*levels_[i]*x[i] + drive*sum;
+    }
+}
+
+bool CheckCouplings(const json& input)
+{
+    if (input.contains("krylov_dim") && (!input["krylov_dim"].is_number_integer() || input["krylov_dim"] < 1))
+    {
+        std::cerr << "Wrong value " << input["krylov_dim"] << " for input data 'krylov_dim', expected a positive integer!\n";
+        return false;
+    }
+    if (input.contains("krylov_tol") && (!input["krylov_tol"].is_number() || input["krylov_tol"] <= 0))
+    {
+        std::cerr << "Wrong value " << input["krylov_tol"] << " for input data 'krylov_tol', expected a positive number!\n";
+        return false;
+    }
+    if (input.contains("wr_layout") && input["wr_layout"] != "auto" && input["wr_layout"] != "dense" && input["wr_layout"] != "sparse")
+    {
+        std::cerr << "Wrong value " << input["wr_layout"] << " for input data 'wr_layout', expected 'auto', 'dense' or 'sparse'!\n";
+        return false;
+    }
+    SystemData sys = LoadSystem(input);
+    return LabHamiltonian::Load(input, sys) != nullptr;
+}
+
+void EvolveKrylov(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+    int maxDimension   = input.value("krylov_dim", 30);
+    double tol         = input.value("krylov_tol", 1.0e-12);
+
+    SystemData sys = LoadSystem(input);
+    int D = sys.D;
+    std::shared_ptr<LabHamiltonian> H = LabHamiltonian::Load(input, sys);
+    setupTimer.Stop();
+
+    //the drive is sampled at the Gauss points of each step by the scalar envelope: the grid comes from a copy
+    EnvelopeFunction streamed = envelope;
+    std::vector<double> t = PrepareRun(input, potential, streamed, sys);
+    int Nstep = (int)t.size() - 1;
+
+    //drive factor d(s) and envelope from the potential of a single level with unit coupling (-i d(s))
+    std::vector<double> unitWl(1, 0.0);
+    std::vector<std::complex<double>> unitWr(1, std::complex<double>(1.0, 0.0));
+    std::vector<std::vector<std::complex<double>>> Vdrive(3, std::vector<std::complex<double>>(1));
+    std::vector<double> env(3, 0.0);
+    std::vector<double> env2(3, 0.0);
+    auto drive = [&](double s)
+    {
+        QQ_TIMER(PHASE_POTENTIAL);
+        potential(input, 1, s, 0.0, unitWl, unitWr, envelope, Vdrive, env, env2);
+        return -Vdrive[0][0].imag();
+    };
+
+    //commutator-free Magnus 4: Gauss points and weights of the two exponentials
+    const double node1  = 0.5 - std::sqrt(3.0)/6.0;
+    const double node2  = 0.5 + std::sqrt(3.0)/6.0;
+    const double alpha1 = (3.0 - 2.0*std::sqrt(3.0))/12.0;
+    const double alpha2 = (3.0 + 2.0*std::sqrt(3.0))/12.0;
+
+    std::vector<std::complex<double>> psi = sys.psi0;
+    FramePhase(sys, t[0], -1.0, psi);
+    RunOutput out;
+    drive(t[0]);
+    out.t.push_back(t[0]);
+    out.env.push_back(env[2]);
+    out.psi.push_back(sys.psi0);
+
+    KrylovStats stats;
+    for (int i = 1; i < Nstep+1; i++)
+    {
+        double h = t[i] - t[i-1];
+        double d1 = drive(t[i-1] + node1*h);
+        double d2 = drive(t[i-1] + node2*h);
+
+        ScopedTimer stagesTimer(PHASE_STAGES);
+        PerfScope stagesCounters(PHASE_STAGES);
+        //the weights of each exponential sum to 1/2 on the levels
+        double s1 = alpha2*d1 + alpha1*d2;
+        double s2 = alpha1*d1 + alpha2*d2;
+        if (!KrylovExp(D, [&](const std::complex<double>* x, std::complex<double>* y) { H->Apply(0.5, s1, x, y); }, h, psi, maxDimension, tol, stats) ||
+            !KrylovExp(D, [&](const std::complex<double>* x, std::complex<double>* y) { H->Apply(0.5, s2, x, y); }, h, psi, maxDimension, tol, stats))
+        {
+            std::cerr << "The Krylov exponential of step " << i << " does not reach krylov_tol " << tol << " with krylov_dim "
+                      << maxDimension << " after " << maxHalvings << " halvings of the step!\n";
+            std::exit(1);
+        }
+        stagesCounters.Stop();
+        stagesTimer.Stop();
+
+        //rows in the interaction picture of the other integrators
+        if (i % Nprint == 0 || i == Nstep)
+        {
+            QQ_TIMER(PHASE_OUTPUT);
+            std::vector<std::complex<double>> row = psi;
+            FramePhase(sys, t[i], 1.0, row);
+            drive(t[i]);
+            out.psi.push_back(row);
+            out.env.push_back(env[2]);
+            out.t.push_back(t[i]);
+        }
+    }
+
+    std::cout << "Calculation completed...\n";
+
+    double norm = 0.0;
+    for (const auto& value : psi)
+    {
+        norm += std::norm(value);
+    }
+    double normError = std::abs(std::sqrt(norm) - 1.0);
+    std::cout << "Krylov steps: " << (double)stats.matvecs/std::max(1L, stats.substeps) << " matvecs per exponential, "
+              << stats.substeps - stats.exponentials << " extra substeps, error estimate " << stats.errorEstimate
+              << ", norm error " << normError << "\n";
+
+    RunReport()["integrator"] = "krylov";
+    RunReport()["Dstates"]    = D;
+    RunReport()["steps"]      = Nstep;
+    RunReport()["krylov"]     = {{"layout", H->Sparse() ? "sparse" : "dense"}, {"nonzeros", H->Nonzeros()},
+                                 {"max_dimension", maxDimension}, {"tol", tol}, {"exponentials", stats.exponentials},
+                                 {"substeps", stats.substeps}, {"matvecs", stats.matvecs},
+                                 {"error_estimate", stats.errorEstimate}, {"norm_error", normError}};
+    //a matvec is 8 flops per stored coupling and 4 for the level; Lanczos adds the reorthogonalization
+    double matvecFlops = 8.0*(H->Sparse() ? (double)H->Nonzeros() : (double)D*D) + 4.0*D;
+    double matvecBytes = H->Sparse() ? 16.0*H->Nonzeros() + 4.0*H->Nonzeros() + 32.0*D : 16.0*D*D + 32.0*D;
+    ReportKernelWork("krylov_matvecs", PhaseName(PHASE_STAGES), (double)Nstep, matvecFlops*stats.matvecs, matvecBytes*stats.matvecs);
+
+    WriteOutput(prefix, D, out);
+}
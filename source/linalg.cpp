@@ -0,0 +1,313 @@
+#include "linalg.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+//sweeps of the Jacobi eigensolver before giving up on convergence
+static const int maxSweeps = 64;
+
+ComplexMatrix IdentityMatrix(int D)
+{
+    ComplexMatrix I(D*D, 0.0);
+    for (int k = 0; k < D; k++)
+    {
+        I[k*D + k] = 1.0;
+    }
+    return I;
+}
+
+void MatrixMultiply(int D, const ComplexMatrix& A, const ComplexMatrix& B, ComplexMatrix& C)
+{
+    C.assign(D*D, 0.0);
+    for (int i = 0; i < D; i++)
+    {
+        for (int k = 0; k < D; k++)
+        {
+            std::complex<double> a = A[i*D + k];
+            for (int j = 0; j < D; j++)
+            {
+                C[i*D + j] += a*B[k*D + j];
+            }
+        }
+    }
+}
+
+void MatrixVector(int D, const ComplexMatrix& A, const std::vector<std::complex<double>>& x, std::vector<std::complex<double>>& y)
+{
+    y.assign(D, 0.0);
+    for (int i = 0; i < D; i++)
+    {
+        for (int k = 0; k < D; k++)
+        {
+            y[i] += A[i*D + k]*x[k];
+        }
+    }
+}
+
+ComplexMatrix MatrixPower(int D, const ComplexMatrix& A, long n)
+{
+    ComplexMatrix result = IdentityMatrix(D);
+    ComplexMatrix square = A;
+    ComplexMatrix product;
+    while (n > 0)
+    {
+        if (n & 1)
+        {
+            MatrixMultiply(D, result, square, product);
+            result.swap(product);
+        }
+        n >>= 1;
+        if (n > 0)
+        {
+            MatrixMultiply(D, square, square, product);
+            square.swap(product);
+        }
+    }
+    return result;
+}
+
+double UnitarityError(int D, const ComplexMatrix& U)
+{
+    double error = 0.0;
+    for (int i = 0; i < D; i++)
+    {
+        for (int j = 0; j < D; j++)
+        {
+            std::complex<double> sum = 0.0;
+            for (int k = 0; k < D; k++)
+            {
+                sum += std::conj(U[k*D + i])*U[k*D + j];
+            }
+            error = std::max(error, std::abs(sum - ((i == j) ? 1.0 : 0.0)));
+        }
+    }
+    return error;
+}
+
+void HermitianEigen(int D, const ComplexMatrix& H, std::vector<double>& values, ComplexMatrix& vectors)
+{
+    ComplexMatrix A = H;
+    ComplexMatrix V = IdentityMatrix(D);
+
+    double total = 0.0;
+    for (const auto& a : A)
+    {
+        total += std::norm(a);
+    }
+
+    for (int sweep = 0; sweep < maxSweeps; sweep++)
+    {
+        double off = 0.0;
+        for (int p = 0; p < D; p++)
+        {
+            for (int q = p+1; q < D; q++)
+            {
+                off += std::norm(A[p*D + q]);
+            }
+        }
+        if (off <= 1.0e-30*total)
+        {
+            break;
+        }
+
+        for (int p = 0; p < D; p++)
+        {
+            for (int q = p+1; q < D; q++)
+            {
+                std::complex<double> apq = A[p*D + q];
+                double b = std::abs(apq);
+                if (b == 0.0)
+                {
+                    continue;
+                }
+                //the phase of apq is moved to column q, then a real rotation zeroes the pair:
+                //G = [[c, s], [-s e^{-i phi}, c e^{-i phi}]], tan(2 theta) = 2|apq|/(aqq - app)
+                std::complex<double> phase = std::conj(apq)/b;
+                double theta = 0.5*std::atan2(2.0*b, A[q*D + q].real() - A[p*D + p].real());
+                double c = std::cos(theta);
+                double s = std::sin(theta);
+                std::complex<double> gpp = c;
+                std::complex<double> gpq = s;
+                std::complex<double> gqp = -s*phase;
+                std::complex<double> gqq = c*phase;
+
+                //A <- A G
+                for (int k = 0; k < D; k++)
+                {
+                    std::complex<double> akp = A[k*D + p];
+                    std::complex<double> akq = A[k*D + q];
+                    A[k*D + p] = akp*gpp + akq*gqp;
+                    A[k*D + q] = akp*gpq + akq*gqq;
+                }
+                //A <- G^H A
+                for (int k = 0; k < D; k++)
+                {
+                    std::complex<double> apk = A[p*D + k];
+                    std::complex<double> aqk = A[q*D + k];
+                    A[p*D + k] = std::conj(gpp)*apk + std::conj(gqp)*aqk;
+                    A[q*D + k] = std::conj(gpq)*apk + std::conj(gqq)*aqk;
+                }
+                A[p*D + q] = 0.0;
+                A[q*D + p] = 0.0;
+                //V <- V G
+                for (int k = 0; k < D; k++)
+                {
+                    std::complex<double> vkp = V[k*D + p];
+                    std::complex<double> vkq = V[k*D + q];
+                    V[k*D + p] = vkp*gpp + vkq*gqp;
+                    V[k*D + q] = vkp*gpq + vkq*gqq;
+                }
+            }
+        }
+    }
+
+    //ascending order
+    std::vector<int> order(D);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int i, int j) { return A[i*D + i].real() < A[j*D + j].real(); });
+    values.resize(D);
+    vectors.assign(D*D, 0.0);
+    for (int k = 0; k < D; k++)
+    {
+        values[k] = A[order[k]*D + order[k]].real();
+        for (int i = 0; i < D; i++)
+        {
+            vectors[i*D + k] = V[i*D + order[k]];
+        }
+    }
+}
+
+void PolarUnitary(int D, const ComplexMatrix& A, ComplexMatrix& U)
+{
+    //A^H A = W diag(s^2) W^H
+    ComplexMatrix G(D*D);
+    for (int i = 0; i < D; i++)
+    {
+        for (int j = 0; j < D; j++)
+        {
+            std::complex<double> sum = 0.0;
+            for (int k = 0; k < D; k++)
+            {
+                sum += std::conj(A[k*D + i])*A[k*D + j];
+            }
+            G[i*D + j] = sum;
+        }
+    }
+    std::vector<double> values;
+    ComplexMatrix W;
+    HermitianEigen(D, G, values, W);
+
+    //(A^H A)^-1/2 = W diag(1/s) W^H
+    ComplexMatrix root(D*D);
+    for (int i = 0; i < D; i++)
+    {
+        for (int j = 0; j < D; j++)
+        {
+            std::complex<double> sum = 0.0;
+            for (int k = 0; k < D; k++)
+            {
+                sum += W[i*D + k]*std::conj(W[j*D + k])/std::sqrt(values[k]);
+            }
+            root[i*D + j] = sum;
+        }
+    }
+    U.resize(D*D);
+    MatrixMultiply(D, A, root, U);
+}
+
+void UnitaryEigen(int D, const ComplexMatrix& U, std::vector<double>& phases, ComplexMatrix& vectors)
+{
+    //U is normal: (U + U^H)/2 and (U - U^H)/2i commute and share its eigenvectors; an irrational
+    //weight of the second keeps the eigenvalues of the combination apart unless those of U coincide
+    const double weight = 0.5*(std::sqrt(5.0) - 1.0);
+    const std::complex<double> im(0.0, 1.0);
+    ComplexMatrix K(D*D);
+    for (int i = 0; i < D; i++)
+    {
+        for (int j = 0; j < D; j++)
+        {
+            std::complex<double> uij = U[i*D + j];
+            std::complex<double> uji = std::conj(U[j*D + i]);
+            K[i*D + j] = 0.5*(uij + uji) + weight*(uij - uji)/(2.0*im);
+        }
+    }
+    std::vector<double> values;
+    HermitianEigen(D, K, values, vectors);
+
+    //eigenvalue of U on each eigenvector: v^H U v
+    phases.resize(D);
+    for (int k = 0; k < D; k++)
+    {
+        std::complex<double> lambda = 0.0;
+        for (int i = 0; i < D; i++)
+        {
+            std::complex<double> uv = 0.0;
+            for (int j = 0; j < D; j++)
+            {
+                uv += U[i*D + j]*vectors[j*D + k];
+            }
+            lambda += std::conj(vectors[i*D + k])*uv;
+        }
+        phases[k] = std::arg(lambda);
+    }
+}
+
+bool LUFactor(int D, ComplexMatrix& A, std::vector<int>& pivot)
+{
+    pivot.resize(D);
+    for (int k = 0; k < D; k++)
+    {
+        //largest entry of the column as pivot
+        int p = k;
+        for (int i = k+1; i < D; i++)
+        {
+            if (std::abs(A[i*D + k]) > std::abs(A[p*D + k]))
+            {
+                p = i;
+            }
+        }
+        pivot[k] = p;
+        if (A[p*D + k] == 0.0)
+        {
+            return false;
+        }
+        if (p != k)
+        {
+            std::swap_ranges(A.begin() + k*D, A.begin() + (k+1)*D, A.begin() + p*D);
+        }
+        std::complex<double> inverse = 1.0/A[k*D + k];
+        for (int i = k+1; i < D; i++)
+        {
+            std::complex<double> factor = A[i*D + k]*inverse;
+            A[i*D + k] = factor;
+            for (int j = k+1; j < D; j++)
+            {
+                A[i*D + j] -= factor*A[k*D + j];
+            }
+        }
+    }
+    return true;
+}
+
+void LUSolve(int D, const ComplexMatrix& LU, const std::vector<int>& pivot, std::vector<std::complex<double>>& b)
+{
+    for (int k = 0; k < D; k++)
+    {
+        std::swap(b[k], b[pivot[k]]);
+    }
+    for (int i = 1; i < D; i++)
+    {
+        for (int j = 0; j < i; j++)
+        {
+            b[i] -= LU[i*D + j]*b[j];
+        }
+    }
+    for (int i = D-1; i >= 0; i--)
+    {
+        for (int j = i+1; j < D; j++)
+        {
+            b[i] -= LU[i*D + j]*b[j];
+        }
+        b[i] /= LU[i*D + i];
+    }
+}
@@ -15,10 +15,31 @@
 #include <complex>
 #include <vector>
 #include <ctime>
+#include <chrono>
 #include "json.hpp"
 #include "algorithms.h"
+#include "stepsize.h"
 #include "potentials.h"
 #include "envelopes.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include "sampledenv.h"
+#include "exprenv.h"
+#include "pluginenv.h"
+#include "pulses.h"
+#include "qubit.h"
+#include "floquet.h"
+#include "krylov.h"
+#include "cayley.h"
+#include "explicitrk.h"
+#include "richardson.h"
+#include "diagonal.h"
+#include "phasecache.h"
+#include "vecmath.h"
+#include "precision.h"
+#include "pipeline.h"
+#include "kernels.h"
 
 using json = nlohmann::json;
 //define possible types for input data
@@ -86,11 +107,9 @@ bool validateFields(const json& input, const std::vector<FieldRequirement>& fiel
         return false;
     }
     //check if qbmode and D are an allowed combination
-    if (input["qbmode"] == "on") //&& D != 2) 
+    if (input["qbmode"] == "on" && D != 2) 
     {
-        std::cerr << "Only supported value for 'qbmode' is 'off'!\n";
-
-        //std::cerr << "Only allowed dimension for 'qbmode' = 'on' is 2!\n";
+        std::cerr << "Only allowed dimension for 'qbmode' = 'on' is 2!\n";
         return false;
     }
     //check if mandatory data are given as input
@@ -152,7 +171,7 @@ bool validateFields(const json& input, const std::vector<FieldRequirement>& fiel
                     }
                 }
             }
-            else if (input["qbmode"] == "off") 
+            else if (field.name == "wl" && input["qbmode"] == "off") 
             {
                 if ((int)(val.size()) != D) 
                 {
@@ -202,6 +221,13 @@ bool validateFields(const json& input, const std::vector<FieldRequirement>& fiel
         }
     }
 
+    //the two-level engine needs a Hermitian (real symmetric) coupling matrix
+    if (input["qbmode"] == "on" && input["wr"][0][1] != input["wr"][1][0])
+    {
+        std::cerr << "The matrix 'wr' must be symmetric for 'qbmode' = 'on'!\n";
+        return false;
+    }
+
     return true;  //all fields pass the check
 }
 
@@ -223,6 +249,7 @@ int main(int argc, char* argv[])
     time(&timestamp);
     std::cout << "qqEvol execution started: " << ctime(&timestamp) << "\n";
 
+    ScopedTimer setupTimer(PHASE_SETUP);
 
     //check if input file exists
     if (argc < 2) 
@@ -260,12 +287,6 @@ int main(int argc, char* argv[])
         << "' for input data 'qbmode', expected 'string'!\n";
         return 1;           
     }
-    if (input["qbmode"] == "on")
-    {
-        std::cerr << "The specified qbmode " << input["qbmode"] << " is not supported\n";
-        return 1;
-
-    }
 
     //check if envelope is specified in input file
     if (!input.contains("envelope"))
@@ -296,6 +317,13 @@ int main(int argc, char* argv[])
     //assign qbmode, envelope, Dstates to local variables
     std::string qbmode   = input["qbmode"];
     std::string envelope = input["envelope"];
+    //"plugin:/path/libpulse.so" selects an envelope compiled in a shared library (see common/qqevol_plugin.h)
+    std::string pluginPath;
+    if (envelope.rfind("plugin:", 0) == 0)
+    {
+        pluginPath = envelope.substr(7);
+        envelope   = "plugin";
+    }
     //int dimension        = input["Dstates"];
 
 
@@ -303,7 +331,18 @@ int main(int argc, char* argv[])
     std::unordered_map<std::string, SimulationFunction> qbmodes = 
     {
         {"off", EvolveRK4},
-        {"on", EvolveRK4}
+        {"on", EvolveQubit}
+    };
+
+    //map of integrators selectable with "integrator" (default: the one of the qbmode)
+    std::unordered_map<std::string, SimulationFunction> integrators = 
+    {
+        {"rk4", EvolveRK4},
+        {"rk6", EvolveExplicitRK},
+        {"rk8", EvolveExplicitRK},
+        {"floquet", EvolveFloquet},
+        {"krylov", EvolveKrylov},
+        {"cayley", EvolveCayley}
     };
 
     //map of envelope functions
@@ -314,7 +353,15 @@ int main(int argc, char* argv[])
         {"impulse", {impulse, {{"F1", FLOAT},{"t1", FLOAT},{"t2", FLOAT}}}},
         {"gauss" ,  {gauss, {{"F1", FLOAT}, {"t1", FLOAT}, {"sigma1", FLOAT} }}},
         {"double_impulse", {double_impulse, {{"F1", FLOAT},{"t1", FLOAT},{"t2", FLOAT},{"w2", FLOAT},{"t3", FLOAT},{"t4", FLOAT},{"F2",FLOAT}}}},
-        {"double_gauss", {double_gauss, {{"F1", FLOAT},{"t1", FLOAT},{"w2", FLOAT},{"F2",FLOAT},{"sigma2", FLOAT}}}}
+        {"double_gauss", {double_gauss, {{"F1", FLOAT},{"t1", FLOAT},{"w2", FLOAT},{"F2",FLOAT},{"sigma2", FLOAT}}}},
+        //sampled envelope, loaded from "table_file" once the input is validated
+        {"table", {nullptr, {{"table_file", STRING},{"table_dt", FLOAT}}}},
+        //formula of the time, compiled once the input is validated
+        {"expr", {nullptr, {{"expr", STRING}}}},
+        //native envelope, loaded from the plugin library once the input is validated
+        {"plugin", {nullptr, {}}},
+        //train of pulses with their own carriers, indexed once the input is validated
+        {"pulses", {nullptr, {{"pulses", ARRAY}}}}
 
     };
 
@@ -322,15 +369,33 @@ int main(int argc, char* argv[])
     std::unordered_map<std::string, PotentialFunction> potentials = 
     {
         {"off:off",   UpdatePotential},
+        {"off:on",    UpdatePotential},
   
         {"const:off",   UpdatePotential},
+        {"const:on",    UpdatePotential},
 
         {"impulse:off",   UpdatePotential},
+        {"impulse:on",    UpdatePotential},
 
         {"gauss:off",   UpdatePotential},
+        {"gauss:on",    UpdatePotential},
 
         {"double_impulse:off", UpdatePotential2},
-        {"double_gauss:off",   UpdatePotential2}
+        {"double_impulse:on",  UpdatePotential2},
+        {"double_gauss:off",   UpdatePotential2},
+        {"double_gauss:on",    UpdatePotential2},
+
+        {"table:off",   UpdatePotential},
+        {"table:on",    UpdatePotential},
+
+        {"expr:off",   UpdatePotential},
+        {"expr:on",    UpdatePotential},
+
+        {"plugin:off",   UpdatePotential},
+        {"plugin:on",    UpdatePotential},
+
+        {"pulses:off",   nullptr},
+        {"pulses:on",    nullptr}
     };
 
 
@@ -368,6 +433,45 @@ int main(int argc, char* argv[])
     //     return 1;
     // }
 
+    //check if specified integrator is supported
+    SimulationFunction simulation = qbmodes[qbmode];
+    if (input.contains("integrator"))
+    {
+        if (!input["integrator"].is_string())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["integrator"])
+            << "' for input data 'integrator', expected 'string'!\n";
+            return 1;
+        }
+        std::string integrator = input["integrator"];
+        if (integrators.find(integrator) == integrators.end())
+        {
+            std::cerr << "The specified integrator '" << integrator << "' is not supported!\n";
+            return 1;
+        }
+        simulation = integrators[integrator];
+    }
+
+    //"richardson" = true: the RK4 run at dt and dt/2 on two threads, extrapolated
+    if (input.contains("richardson"))
+    {
+        if (!input["richardson"].is_boolean())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["richardson"])
+            << "' for input data 'richardson', expected 'boolean'!\n";
+            return 1;
+        }
+        if (input["richardson"] && input.value("integrator", qbmode == "off" ? "rk4" : qbmode) != "rk4")
+        {
+            std::cerr << "The option 'richardson' needs the 'rk4' integrator!\n";
+            return 1;
+        }
+        if (input["richardson"])
+        {
+            simulation = EvolveRichardson;
+        }
+    }
+
     std::string potential;
     potential = envelope + ":" + qbmode ;
     //check if enveope and qbmode specified are compatible
@@ -377,6 +481,44 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    //"Nstep" can be "auto": the number of steps is then chosen from the problem (see stepsize.cpp)
+    if (input.contains("Nstep") && input["Nstep"].is_string())
+    {
+        if (input["Nstep"] != "auto")
+        {
+            std::cerr << "The specified Nstep " << input["Nstep"] << " is not supported, expected an integer or 'auto'!\n";
+            return 1;
+        }
+        for (auto& field : baseFields)
+        {
+            if (field.name == "Nstep")
+            {
+                field.type = STRING;
+            }
+        }
+    }
+    if (!CheckNstepAuto(input))
+    {
+        return 1;
+    }
+
+    //"wr_sparse" lists the nonzero couplings of large systems instead of the dense "wr" (krylov integrator only)
+    if (input.contains("wr_sparse"))
+    {
+        if (input.value("integrator", "") != "krylov" || qbmode != "off" || !input["Nstep"].is_number_integer())
+        {
+            std::cerr << "The couplings 'wr_sparse' need 'integrator' = 'krylov', 'qbmode' = 'off' and an integer 'Nstep'!\n";
+            return 1;
+        }
+        for (auto& field : baseFields)
+        {
+            if (field.name == "wr")
+            {
+                field = {"wr_sparse", ARRAY};
+            }
+        }
+    }
+
     //list of needed input data (base+optional)
     const auto& potFields = envelopes[envelope].second;
     auto totalFields = mergeFields(baseFields, potFields);
@@ -386,17 +528,226 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    //read the samples of the table envelope
+    if (envelope == "table")
+    {
+        if (input.contains("table_t0") && !input["table_t0"].is_number())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["table_t0"])
+            << "' for input data 'table_t0', expected 'number'!\n";
+            return 1;
+        }
+        if (input.contains("table_interp") && !input["table_interp"].is_string())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["table_interp"])
+            << "' for input data 'table_interp', expected 'string'!\n";
+            return 1;
+        }
+        if (!LoadSampledEnvelope(input, envelopes[envelope].first))
+        {
+            return 1;
+        }
+    }
+    //compile the formula of the expr envelope
+    if (envelope == "expr" && !LoadExprEnvelope(input, envelopes[envelope].first))
+    {
+        return 1;
+    }
+
+    //load the envelope plugin, which drives the second carrier w2 too if it fills env2
+    bool twoEnvelopes = (envelope == "double_impulse" || envelope == "double_gauss");
+    if (envelope == "plugin")
+    {
+        if (!LoadPluginEnvelope(input, pluginPath, envelopes[envelope].first, twoEnvelopes))
+        {
+            return 1;
+        }
+        if (twoEnvelopes)
+        {
+            if (!validateFields(input, {{"w2", FLOAT}}))
+            {
+                return 1;
+            }
+            potentials[potential] = UpdatePotential2;
+        }
+    }
+
+    //index the pulses of the pulse train
+    if (envelope == "pulses" && !LoadPulseTrain(input, envelopes[envelope].first, potentials[potential]))
+    {
+        return 1;
+    }
+
+    //couplings of the krylov integrator
+    if (input.value("integrator", "") == "krylov" && !CheckCouplings(input))
+    {
+        return 1;
+    }
+
+    //order and linear solver of the cayley integrator
+    if (input.value("integrator", "") == "cayley" && !CheckCayley(input))
+    {
+        return 1;
+    }
+
+    //diagonal drive integrated by RK4 or exactly
+    if (!CheckDiagonalDrive(input))
+    {
+        return 1;
+    }
+
+    //potential matrices and stage products in single precision
+    if (!CheckPrecision(input))
+    {
+        return 1;
+    }
+
+    //potentials built ahead of the integrator by producer threads
+    if (!CheckPipeline(input))
+    {
+        return 1;
+    }
+
+    //propagator of the segments of constant drive
+    if (input.contains("segment_propagator") && input["segment_propagator"] != "rk4" && input["segment_propagator"] != "chebyshev")
+    {
+        std::cerr << "The specified segment_propagator " << input["segment_propagator"] << " is not supported, expected 'rk4' or 'chebyshev'!\n";
+        return 1;
+    }
+    if (input.contains("chebyshev_tol") && (!input["chebyshev_tol"].is_number() || input["chebyshev_tol"] <= 0))
+    {
+        std::cerr << "Wrong value " << input["chebyshev_tol"] << " for input data 'chebyshev_tol', expected a positive number!\n";
+        return 1;
+    }
+
+    //period of the floquet integrator
+    if (input.value("integrator", "") == "floquet" && !CheckPeriod(input, twoEnvelopes))
+    {
+        return 1;
+    }
+
+    //comparison of the explicit integrators before the run
+    if (input.contains("rk_compare") && !input["rk_compare"].is_boolean())
+    {
+        std::cerr << "Wrong type '" << getTypeName(input["rk_compare"])
+        << "' for input data 'rk_compare', expected 'boolean'!\n";
+        return 1;
+    }
+    if (input.contains("rk_compare_tol") && (!input["rk_compare_tol"].is_number() || input["rk_compare_tol"] <= 0))
+    {
+        std::cerr << "Wrong value " << input["rk_compare_tol"] << " for input data 'rk_compare_tol', expected a positive number!\n";
+        return 1;
+    }
+
+    //upper triangle of symmetric couplings in the potentials and stages of the explicit integrators
+    if (input.contains("wr_packed") && !input["wr_packed"].is_boolean())
+    {
+        std::cerr << "Wrong type '" << getTypeName(input["wr_packed"])
+        << "' for input data 'wr_packed', expected 'boolean'!\n";
+        return 1;
+    }
+
+    //steps aligned to the jumps of the envelope
+    if (input.contains("segment_edges") && !input["segment_edges"].is_boolean())
+    {
+        std::cerr << "Wrong type '" << getTypeName(input["segment_edges"])
+        << "' for input data 'segment_edges', expected 'boolean'!\n";
+        return 1;
+    }
+
+    //phase factors of the potentials advanced by fixed rotors on uniform steps
+    if (input.contains("phase_cache") && !input["phase_cache"].is_boolean())
+    {
+        std::cerr << "Wrong type '" << getTypeName(input["phase_cache"])
+        << "' for input data 'phase_cache', expected 'boolean'!\n";
+        return 1;
+    }
+
+    //envelope evaluated by blocks of steps, from a table if asked
+    if (input.contains("envelope_block") && (!input["envelope_block"].is_number_integer() || input["envelope_block"] < 0))
+    {
+        std::cerr << "Wrong value " << input["envelope_block"] << " for input data 'envelope_block', expected a non-negative integer!\n";
+        return 1;
+    }
+    if (input.contains("envelope_table") && !input["envelope_table"].is_boolean())
+    {
+        std::cerr << "Wrong type '" << getTypeName(input["envelope_table"])
+        << "' for input data 'envelope_table', expected 'boolean'!\n";
+        return 1;
+    }
+    if (input.contains("envelope_table_tol") && (!input["envelope_table_tol"].is_number() || input["envelope_table_tol"] <= 0))
+    {
+        std::cerr << "Wrong value " << input["envelope_table_tol"] << " for input data 'envelope_table_tol', expected a positive number!\n";
+        return 1;
+    }
+
+    //accuracy of the batched exp and sincos of the envelopes and potentials
+    if (input.contains("vecmath"))
+    {
+        if (!input["vecmath"].is_string())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["vecmath"])
+            << "' for input data 'vecmath', expected 'string'!\n";
+            return 1;
+        }
+        if (!SetVecMathMode(input["vecmath"]))
+        {
+            std::cerr << "The specified vecmath " << input["vecmath"] << " is not supported, expected 'accurate' or 'fast'!\n";
+            return 1;
+        }
+    }
+
+    //instruction set of the hot kernels, the widest one supported by the cpu unless forced
+    if (input.contains("isa"))
+    {
+        if (!input["isa"].is_string())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["isa"])
+            << "' for input data 'isa', expected 'string'!\n";
+            return 1;
+        }
+        if (!SelectKernels(input["isa"]))
+        {
+            std::cerr << "The specified isa " << input["isa"] << " is not supported, expected 'auto' or one of the instruction sets of this cpu:";
+            for (const std::string& name : SupportedKernels())
+            {
+                std::cerr << " '" << name << "'";
+            }
+            std::cerr << "!\n";
+            return 1;
+        }
+    }
+
+    //optional hardware performance counters around the phases of the run
+    if (input.contains("perf_counters"))
+    {
+        if (!input["perf_counters"].is_boolean())
+        {
+            std::cerr << "Wrong type '" << getTypeName(input["perf_counters"])
+            << "' for input data 'perf_counters', expected 'boolean'!\n";
+            return 1;
+        }
+        EnablePerfCounters(input["perf_counters"]);
+    }
+
     //start simulation
     std::cout << "Starting the calculation with prefix " << input["prefix"] << "...\n";
 
-    clock_t tStart = clock();
-    qbmodes[qbmode](input,  potentials[potential], envelopes[envelope].first);
+    setupTimer.Stop();
+    auto tStart = std::chrono::steady_clock::now();
+    simulation(input,  potentials[potential], envelopes[envelope].first);
     
 
-    clock_t tEnd = clock();
+    auto tEnd = std::chrono::steady_clock::now();
+
+    double took = std::chrono::duration<double>(tEnd-tStart).count(); 
 
-    double took = (double)(tEnd-tStart)/CLOCKS_PER_SEC; 
+    if (input.value("phase_cache", false))
+    {
+        RunReport()["phase_cache"] = PhaseCacheReport();
+    }
 
+    WriteRunReport(input, took);
 
     time(&timestamp);
     std::cout << "qqEvol execution terminated: " << ctime(&timestamp) << "\n";
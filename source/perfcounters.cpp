@@ -0,0 +1,306 @@
+#include "perfcounters.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//description of a counter: events of the same group are scheduled together on the PMU
+struct PerfEvent
+{
+    const char* name;
+    unsigned int type;
+    unsigned long long config;
+    int group;
+    bool intelOnly;
+};
+
+#ifdef __linux__
+#define QQ_CACHE_EVENT(cache, op, result) ((cache) | ((op) << 8) | ((result) << 16))
+static const PerfEvent perfEvents[] =
+{
+    {"cycles",                  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       0, false},
+    {"instructions",            PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     0, false},
+    {"branch_misses",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    0, false},
+    {"l1d_read_misses",         PERF_TYPE_HW_CACHE, QQ_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1, false},
+    {"llc_read_misses",         PERF_TYPE_HW_CACHE, QQ_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL,  PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 1, false},
+    //FP_ARITH_INST_RETIRED (event 0xC7) of Intel cores since Broadwell
+    {"fp_scalar_double",        PERF_TYPE_RAW,      0x01C7,                         2, true},
+    {"fp_128b_packed_double",   PERF_TYPE_RAW,      0x04C7,                         2, true},
+    {"fp_256b_packed_double",   PERF_TYPE_RAW,      0x10C7,                         2, true},
+    {"fp_512b_packed_double",   PERF_TYPE_RAW,      0x40C7,                         2, true},
+};
+#else
+static const PerfEvent perfEvents[] = {{"cycles", 0, 0, 0, false}};
+#endif
+static const int perfEventCount = sizeof(perfEvents)/sizeof(perfEvents[0]);
+static const int perfGroupCount = 3;
+
+//counters opened by one thread and their accumulated deltas per phase
+struct ThreadPerf
+{
+    struct Group
+    {
+        int leader = -1;
+        std::vector<int> fds;
+        std::vector<int> events;
+    };
+    bool opened = false;
+    std::vector<Group> groups;
+    double totals[PHASE_COUNT][PERF_MAX_EVENTS] = {};
+    long long scopes[PHASE_COUNT] = {};
+    bool available[PERF_MAX_EVENTS] = {};
+};
+
+static std::atomic<bool> perfEnabled(false);
+static std::mutex perfMutex;
+static std::string perfError;
+static std::vector<std::unique_ptr<ThreadPerf>>& PerfRegistry()
+{
+    static std::vector<std::unique_ptr<ThreadPerf>> registry;
+    return registry;
+}
+
+void EnablePerfCounters(bool enable)
+{
+    perfEnabled = enable;
+}
+
+bool PerfCountersEnabled()
+{
+    return perfEnabled.load(std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+static bool IsIntelCpu()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.rfind("vendor_id", 0) == 0)
+        {
+            return line.find("GenuineIntel") != std::string::npos;
+        }
+    }
+    return false;
+}
+
+static int OpenEvent(const PerfEvent& event, int groupFd)
+{
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = event.type;
+    attr.config         = event.config;
+    attr.disabled       = (groupFd == -1) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+#endif
+
+//open the counters of the calling thread (once); on failure the thread keeps no groups
+static ThreadPerf& ThreadCounters()
+{
+    thread_local ThreadPerf* perf = nullptr;
+    if (perf != nullptr)
+    {
+        return *perf;
+    }
+    {
+        std::lock_guard<std::mutex> lock(perfMutex);
+        PerfRegistry().push_back(std::make_unique<ThreadPerf>());
+        perf = PerfRegistry().back().get();
+    }
+    perf->opened = true;
+
+#ifdef __linux__
+    bool intel = IsIntelCpu();
+    std::string error;
+    for (int g = 0; g < perfGroupCount; g++)
+    {
+        ThreadPerf::Group group;
+        for (int e = 0; e < perfEventCount; e++)
+        {
+            if (perfEvents[e].group != g || (perfEvents[e].intelOnly && !intel))
+            {
+                continue;
+            }
+            int fd = OpenEvent(perfEvents[e], group.leader);
+            if (fd < 0)
+            {
+                if (error.empty())
+                {
+                    error = std::string("perf_event_open(") + perfEvents[e].name + "): " + std::strerror(errno);
+                }
+                continue;
+            }
+            if (group.leader == -1)
+            {
+                group.leader = fd;
+            }
+            group.fds.push_back(fd);
+            group.events.push_back(e);
+            perf->available[e] = true;
+        }
+        if (group.leader != -1)
+        {
+            ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            perf->groups.push_back(group);
+        }
+    }
+    if (perf->groups.empty() || !error.empty())
+    {
+        std::lock_guard<std::mutex> lock(perfMutex);
+        if (perfError.empty())
+        {
+            perfError = error.empty() ? "no counter could be opened" : error;
+        }
+    }
+#else
+    std::lock_guard<std::mutex> lock(perfMutex);
+    perfError = "perf_event_open is only available on Linux";
+#endif
+    return *perf;
+}
+
+PerfSample ReadPerfCounters()
+{
+    PerfSample sample;
+    ThreadPerf& perf = ThreadCounters();
+    if (perf.groups.empty())
+    {
+        return sample;
+    }
+#ifdef __linux__
+    for (const auto& group : perf.groups)
+    {
+        //layout of a group read: nr, time_enabled, time_running, values[nr]
+        unsigned long long buffer[3 + PERF_MAX_EVENTS];
+        ssize_t bytes = read(group.leader, buffer, sizeof(buffer));
+        if (bytes < (ssize_t)(3*sizeof(unsigned long long)))
+        {
+            return sample;
+        }
+        unsigned long long nr = buffer[0];
+        double scale = (buffer[2] > 0) ? (double)buffer[1]/(double)buffer[2] : 0.0;
+        for (unsigned long long k = 0; k < nr && k < group.events.size(); k++)
+        {
+            sample.values[group.events[k]] = (double)buffer[3 + k]*scale;
+        }
+    }
+    sample.valid = true;
+#endif
+    return sample;
+}
+
+void AddPerfDelta(TimerPhase phase, const PerfSample& start)
+{
+    PerfSample end = ReadPerfCounters();
+    if (!end.valid)
+    {
+        return;
+    }
+    ThreadPerf& perf = ThreadCounters();
+    for (int e = 0; e < perfEventCount; e++)
+    {
+        perf.totals[phase][e] += end.values[e] - start.values[e];
+    }
+    perf.scopes[phase] += 1;
+}
+
+json PerfReport()
+{
+    json report;
+    report["enabled"] = PerfCountersEnabled();
+    if (!PerfCountersEnabled())
+    {
+        return report;
+    }
+
+    std::lock_guard<std::mutex> lock(perfMutex);
+    bool available[PERF_MAX_EVENTS] = {};
+    for (const auto& perf : PerfRegistry())
+    {
+        for (int e = 0; e < perfEventCount; e++)
+        {
+            available[e] = available[e] || perf->available[e];
+        }
+    }
+    if (!perfError.empty())
+    {
+        report["warning"] = perfError;
+    }
+
+    json events = json::array();
+    for (int e = 0; e < perfEventCount; e++)
+    {
+        if (available[e])
+        {
+            events.push_back(perfEvents[e].name);
+        }
+    }
+    report["events"] = events;
+    if (events.empty())
+    {
+        report["available"] = false;
+        return report;
+    }
+    report["available"] = true;
+
+    json phases = json::object();
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        double totals[PERF_MAX_EVENTS] = {};
+        long long scopes = 0;
+        for (const auto& perf : PerfRegistry())
+        {
+            for (int e = 0; e < perfEventCount; e++)
+            {
+                totals[e] += perf->totals[p][e];
+            }
+            scopes += perf->scopes[p];
+        }
+        if (scopes == 0)
+        {
+            continue;
+        }
+
+        json entry;
+        entry["scopes"] = scopes;
+        for (int e = 0; e < perfEventCount; e++)
+        {
+            if (available[e])
+            {
+                entry[perfEvents[e].name] = totals[e];
+            }
+        }
+#ifdef __linux__
+        //events 0 and 1 are cycles and instructions, 5..8 the FP instructions of width 1, 2, 4, 8 doubles
+        if (available[0] && available[1] && totals[0] > 0.0)
+        {
+            entry["ipc"] = totals[1]/totals[0];
+        }
+        if (available[5])
+        {
+            entry["fp_ops"] = totals[5] + 2.0*totals[6] + 4.0*totals[7] + 8.0*totals[8];
+        }
+#endif
+        phases[PhaseName((TimerPhase)p)] = entry;
+    }
+    report["phases"] = phases;
+    return report;
+}
@@ -0,0 +1,113 @@
+#include "phasecache.h"
+#include "potentials.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+//steps advanced by the rotors between exact evaluations: the first interval is short and doubles up to reseedSteps
+static const int firstInterval = 8;
+static const int reseedSteps = 256;
+
+//statistics of all the threads
+static std::mutex statsMutex;
+static long totalReseeds = 0;
+static long totalRestarts = 0;
+static double totalDrift = 0.0;
+
+void PhaseCache::Seed(double t, double dt, double rotorDt)
+{
+    for (int f = 0; f < n_; f++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            phasors_[k*n_ + f] = std::polar(1.0, freq_[f]*(t + 0.5*k*dt));
+        }
+        rotors_[f] = std::polar(1.0, 0.5*freq_[f]*rotorDt);
+    }
+    sinceSeed_ = 0;
+    seeded_ = true;
+}
+
+void PhaseCache::Update(const std::vector<double>& wl, const double* carriers, int nCarriers, double t, double dt)
+{
+    int levels = (int)wl.size();
+    int n = levels + nCarriers;
+    bool same = seeded_ && n == n_ && levels == levels_;
+    if (!same)
+    {
+        n_ = n;
+        levels_ = levels;
+        freq_.assign(n, 0.0);
+        phasors_.resize(3*n);
+        rotors_.resize(n);
+        advanced_.resize(3*n);
+    }
+    for (int f = 0; f < n; f++)
+    {
+        double w = (f < levels) ? (wl[f] - wl[0])/hbar : carriers[f - levels];
+        same = same && (w == freq_[f]);
+        freq_[f] = w;
+    }
+
+    //steps of a uniform grid differ by the rounding of its times
+    double tol = 1.0e-9*std::abs(dt_);
+    bool uniform = same && std::abs(dt - dt_) <= tol;
+
+    //the same step again
+    if (uniform && std::abs(t - t_) <= tol)
+    {
+        return;
+    }
+    bool consecutive = uniform && std::abs(t - (t_ + dt_)) <= tol;
+    t_ = t;
+    dt_ = dt;
+    if (!consecutive)
+    {
+        tStart_ = t;
+        steps_ = 0;
+        interval_ = firstInterval;
+        Seed(t, dt, dt);
+        std::lock_guard<std::mutex> lock(statsMutex);
+        totalRestarts++;
+        return;
+    }
+
+    //the new step starts at the end of the previous one
+    for (int f = 0; f < n; f++)
+    {
+        advanced_[f]       = phasors_[2*n + f];
+        advanced_[n + f]   = advanced_[f]*rotors_[f];
+        advanced_[2*n + f] = advanced_[n + f]*rotors_[f];
+    }
+    steps_++;
+    if (++sinceSeed_ < interval_)
+    {
+        phasors_.swap(advanced_);
+        return;
+    }
+
+    //the step of the rotors from the whole run of steps: the difference of two rounded times, times
+    //the phase of a step, would drift by far more than the rounding of the exact phases
+    Seed(t, dt, (t - tStart_)/steps_);
+    interval_ = std::min(2*interval_, reseedSteps);
+    double drift = 0.0;
+    for (int f = 0; f < 3*n; f++)
+    {
+        drift = std::max(drift, std::abs(advanced_[f] - phasors_[f]));
+    }
+    std::lock_guard<std::mutex> lock(statsMutex);
+    totalReseeds++;
+    totalDrift = std::max(totalDrift, drift);
+}
+
+PhaseCache& ThreadPhaseCache()
+{
+    thread_local PhaseCache cache;
+    return cache;
+}
+
+json PhaseCacheReport()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return {{"reseed_steps", reseedSteps}, {"reseeds", totalReseeds}, {"restarts", totalRestarts}, {"max_drift", totalDrift}};
+}
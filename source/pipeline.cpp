@@ -0,0 +1,142 @@
+#include "pipeline.h"
+#include "chebyshev.h"
+#include "potentials.h"
+#include "precision.h"
+#include "timers.h"
+#include "perfcounters.h"
+#include <iostream>
+#include <string>
+#include <utility>
+
+//steps in the ring of each producer unless given
+static const int defaultDepth = 2;
+
+PotentialPipeline::PotentialPipeline(const json& input, PotentialFunction potential, const std::vector<EnvelopeFunction>& envelopes, SystemData& sys, const std::vector<double>& t, const StaticSegments* segments)
+    : input_(input), potential_(potential), envelopes_(envelopes), sys_(sys), t_(t), segments_(segments),
+      depth_(input.value("pipeline_depth", defaultDepth)),
+      mixed_(input.value("precision", std::string("double")) == "mixed"),
+      resync_(input.value("precision_resync", 0))
+{
+    StepPotential prototype;
+    prototype.Vmatrices.assign(3, std::vector<std::complex<double>>(StageElements(sys)));
+    if (mixed_)
+    {
+        prototype.floatMatrices.assign(3, std::vector<std::complex<float>>(StageElements(sys)));
+    }
+    prototype.env.assign(3, 0.0);
+    prototype.env2.assign(3, 0.0);
+    for (size_t k = 0; k < envelopes_.size(); k++)
+    {
+        rings_.emplace_back(new StepRing(depth_, prototype));
+    }
+
+    //the producers wait for the integrator and the other way round unless each has a cpu of its own
+    unsigned cpus = std::thread::hardware_concurrency();
+    if (cpus != 0 && (int)cpus <= Producers())
+    {
+        std::cerr << "Warning: the " << Producers() << " producers of 'potential_pipeline' and the integrator share "
+                  << cpus << " logical cpus\n";
+    }
+}
+
+PotentialPipeline::~PotentialPipeline()
+{
+    stop_.store(true, std::memory_order_relaxed);
+    for (std::thread& thread : threads_)
+    {
+        thread.join();
+    }
+}
+
+void PotentialPipeline::Start()
+{
+    for (int producer = 0; producer < Producers(); producer++)
+    {
+        threads_.emplace_back(&PotentialPipeline::Produce, this, producer);
+    }
+}
+
+void PotentialPipeline::Produce(int producer)
+{
+    StepRing& ring = *rings_[producer];
+    EnvelopeFunction& envelope = envelopes_[producer];
+    std::vector<std::complex<double>>& wr = sys_.packed ? sys_.wrPacked : sys_.wr;
+    long step = 0;
+    for (int i = 1; i < (int)t_.size(); i++)
+    {
+        if (segments_ != nullptr && segments_->Contains(i))
+        {
+            continue;
+        }
+        if ((step++/depth_) % Producers() != producer)
+        {
+            continue;
+        }
+
+        //a free slot, or the end of the run if the integrator is gone
+        StepPotential* slot;
+        while ((slot = ring.Free()) == nullptr)
+        {
+            if (stop_.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        {
+            QQ_TIMER(PHASE_POTENTIAL);
+            PerfScope potentialCounters(PHASE_POTENTIAL);
+            SetFloatDrive(SinglePrecisionStep(mixed_, resync_, i) ? &slot->floatMatrices : nullptr);
+            potential_(input_, sys_.D, t_[i-1], t_[i] - t_[i-1], sys_.wl, wr, envelope, slot->Vmatrices, slot->env, slot->env2);
+            SetFloatDrive(nullptr);
+        }
+        ring.Publish();
+    }
+}
+
+void PotentialPipeline::Take(std::vector<std::vector<std::complex<double>>>& Vmatrices, std::vector<std::vector<std::complex<float>>>& floatMatrices, std::vector<double>& env, std::vector<double>& env2)
+{
+    StepRing& ring = *rings_[(taken_++/depth_) % Producers()];
+    StepPotential* slot;
+    while ((slot = ring.Filled()) == nullptr)
+    {
+        std::this_thread::yield();
+    }
+
+    //the slot is filled next with the arrays of the previous step
+    std::swap(Vmatrices, slot->Vmatrices);
+    std::swap(floatMatrices, slot->floatMatrices);
+    std::swap(env, slot->env);
+    std::swap(env2, slot->env2);
+    ring.Release();
+}
+
+int PipelineProducers(const json& input)
+{
+    return input.value("potential_pipeline", 0);
+}
+
+bool CheckPipeline(const json& input)
+{
+    if (input.contains("potential_pipeline") && (!input["potential_pipeline"].is_number_integer() || input["potential_pipeline"] < 0))
+    {
+        std::cerr << "Wrong value " << input["potential_pipeline"] << " for input data 'potential_pipeline', expected a non-negative integer!\n";
+        return false;
+    }
+    if (input.contains("pipeline_depth") && (!input["pipeline_depth"].is_number_integer() || input["pipeline_depth"] < 1))
+    {
+        std::cerr << "Wrong value " << input["pipeline_depth"] << " for input data 'pipeline_depth', expected a positive integer!\n";
+        return false;
+    }
+    if (PipelineProducers(input) == 0)
+    {
+        return true;
+    }
+    std::string integrator = input.value("integrator", input["qbmode"] == "off" ? std::string("rk4") : std::string("qubit"));
+    if (integrator != "rk4" || input.value("richardson", false))
+    {
+        std::cerr << "'potential_pipeline' needs the 'rk4' integrator without 'richardson'!\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+#include "pluginenv.h"
+#include "qqevol_plugin.h"
+#include <dlfcn.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+//loaded plugin and its envelope state, released when the last envelope function using it is gone
+class PluginEnvelope
+{
+public:
+    ~PluginEnvelope()
+    {
+        if (state_ != nullptr && plugin_->destroy != nullptr)
+        {
+            plugin_->destroy(state_);
+        }
+        //the library stays loaded: code of the plugin may still be referenced at exit
+    }
+
+    void Evaluate(const double* tvec, int n, double* env, double* env2) const
+    {
+        plugin_->evaluate(state_, tvec, n, env, env2);
+        if (!plugin_->two_envelopes)
+        {
+            for (int k = 0; k < n; k++)
+            {
+                env2[k] = 0.0;
+            }
+        }
+    }
+
+    const qqevol_envelope* plugin_ = nullptr;
+    void* state_ = nullptr;
+};
+
+bool LoadPluginEnvelope(const json& input, const std::string& path, EnvelopeFunction& scalar, bool& twoEnvelopes)
+{
+    void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr)
+    {
+        std::cerr << "Impossible to load the envelope plugin '" << path << "': " << dlerror() << "\n";
+        return false;
+    }
+    qqevol_envelope_entry entry = (qqevol_envelope_entry)dlsym(library, "qqevol_envelope_plugin");
+    const qqevol_envelope* plugin = (entry != nullptr) ? entry() : nullptr;
+    if (plugin == nullptr)
+    {
+        std::cerr << "The library '" << path << "' is not an envelope plugin (missing qqevol_envelope_plugin)!\n";
+        return false;
+    }
+    if (plugin->abi_version != QQEVOL_PLUGIN_ABI)
+    {
+        std::cerr << "The envelope plugin '" << path << "' was built for interface version " << plugin->abi_version
+                  << ", expected " << QQEVOL_PLUGIN_ABI << "!\n";
+        return false;
+    }
+    if (plugin->create == nullptr || plugin->evaluate == nullptr)
+    {
+        std::cerr << "The envelope plugin '" << path << "' does not provide create and evaluate!\n";
+        return false;
+    }
+
+    //numbers of the input file
+    std::vector<std::string> names;
+    std::vector<double> values;
+    for (auto& item : input.items())
+    {
+        if (item.value().is_number())
+        {
+            names.push_back(item.key());
+            values.push_back(item.value());
+        }
+    }
+    std::vector<const char*> namePointers;
+    for (const auto& name : names)
+    {
+        namePointers.push_back(name.c_str());
+    }
+    qqevol_params params = {(int)names.size(), namePointers.data(), values.data()};
+
+    char error[256] = "";
+    std::shared_ptr<PluginEnvelope> envelope(new PluginEnvelope());
+    envelope->plugin_ = plugin;
+    envelope->state_  = plugin->create(&params, error, sizeof(error));
+    if (envelope->state_ == nullptr)
+    {
+        std::cerr << "The envelope plugin '" << path << "' rejected the input: " << error << "\n";
+        return false;
+    }
+
+    twoEnvelopes = (plugin->two_envelopes != 0);
+    std::cout << "Envelope plugin '" << (plugin->name ? plugin->name : path.c_str()) << "' loaded from " << path << "\n";
+
+    scalar = [envelope](const json&, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    {
+        envelope->Evaluate(tvec, 3, env.data(), env2.data());
+    };
+    EnvelopeBlocks()[input["envelope"]] = [envelope](const json&, const double* tvec, int n, double* env, double* env2)
+    {
+        envelope->Evaluate(tvec, n, env, env2);
+    };
+    return true;
+}
@@ -1,10 +1,73 @@
 #include "potentials.h"
+#include "vecmath.h"
+#include "kernels.h"
 #include <iostream>
 #include <complex>
 #include <vector>
 
 
-const double hbar = 6.582119569e-13;
+//complex<float> matrices filled in place of Vmatrices on this thread (SetFloatDrive)
+static thread_local std::vector<std::vector<std::complex<float>>>* floatDrive = nullptr;
+
+void SetFloatDrive(std::vector<std::vector<std::complex<float>>>* target)
+{
+    floatDrive = target;
+}
+
+//potential matrices -i*drive[k]*wr_ij*p_i(k)*conj(p_j(k)) for the scalar drive factors drive[k] and the phase factors
+//p_i(k) = exp(i(wl_i-wl_0)t_k/hbar) of the levels at the three points of the step; couplings of D(D+1)/2 elements
+//are the packed upper triangle of symmetric ones (SystemData::packed), and only that triangle of V is built
+static void FillDrive(int D, const double* drive, const std::vector<std::complex<double>>& wr, const std::complex<double>* const* phases, std::vector<std::vector<std::complex<double>>>& Vmatrices)
+{
+    const KernelTable& kernels = Kernels();
+    bool dense = ((int)wr.size() == D*D);
+    if (floatDrive != nullptr)
+    {
+        auto fill = dense ? kernels.driveFloat : kernels.drivePackedFloat;
+        for (int k = 0; k < 3; k++) 
+        {
+            fill(D, drive[k], reinterpret_cast<const double*>(wr.data()), reinterpret_cast<const double*>(phases[k]), reinterpret_cast<float*>((*floatDrive)[k].data()));
+        }
+        return;
+    }
+    auto fill = dense ? kernels.drive : kernels.drivePacked;
+    for (int k = 0; k < 3; k++) 
+    {
+        fill(D, drive[k], reinterpret_cast<const double*>(wr.data()), reinterpret_cast<const double*>(phases[k]), reinterpret_cast<double*>(Vmatrices[k].data()));
+    }
+}
+
+//potential matrices -i*drive[k]*wr_ij*exp(i(wl_i-wl_j)t_k/hbar) for the scalar drive factors drive[k] at tvec[k]:
+//the 3D phases of the levels are evaluated in one batch, exp(i(wl_i-wl_j)t) = p_i*conj(p_j)
+void ApplyDrive(int D, const double* tvec, const double* drive, const std::vector<double>& wl, const std::vector<std::complex<double>>& wr, std::vector<std::vector<std::complex<double>>>& Vmatrices)
+{
+    thread_local std::vector<double> angles, sines, cosines;
+    thread_local std::vector<std::complex<double>> phases;
+    angles.resize(3*D);
+    sines.resize(3*D);
+    cosines.resize(3*D);
+    phases.resize(3*D);
+    for (int k = 0; k < 3; k++) 
+    {
+        for (int i = 0; i < D; i++) 
+        {
+            angles[k*D + i] = (wl[i]-wl[0])/hbar*tvec[k];
+        }
+    }
+    BlockSinCos(angles.data(), sines.data(), cosines.data(), 3*D);
+    for (int i = 0; i < 3*D; i++) 
+    {
+        phases[i] = std::complex<double>(cosines[i], sines[i]);
+    }
+    const std::complex<double>* p[3] = {&phases[0], &phases[D], &phases[2*D]};
+    FillDrive(D, drive, wr, p, Vmatrices);
+}
+
+void ApplyDriveCached(int D, const double* drive, const std::vector<std::complex<double>>& wr, const PhaseCache& cache, std::vector<std::vector<std::complex<double>>>& Vmatrices)
+{
+    const std::complex<double>* p[3] = {cache.Levels(0), cache.Levels(1), cache.Levels(2)};
+    FillDrive(D, drive, wr, p, Vmatrices);
+}
 
 //update potential matrix for qbmode = off
 void UpdatePotential(const json& input, int D, double t, double dt, std::vector<double>& wl, std::vector<std::complex<double>>& wr, EnvelopeFunction envelope, std::vector<std::vector<std::complex<double>>>& Vmatrices , std::vector<double>& env, std::vector<double>& env2)
@@ -12,8 +75,6 @@ void UpdatePotential(const json& input, int D, double t, double dt, std::vector<
     //env should be a vector with envelope function at times [t, t + 0.5dt, t+dt] 
 
     double w1 = input["w1"];
-    std::complex<double> im;
-    im = std::complex<double>(0.0, 1.0);
     
     double tvec[3];
     tvec[0] = t;
@@ -22,41 +83,41 @@ void UpdatePotential(const json& input, int D, double t, double dt, std::vector<
 
 
     envelope(input, tvec, env, env2);
-    
-    for (int k = 0; k < 3; k++) 
+
+    double drive[3];
+    if (input.value("phase_cache", false))
     {
-        for (int i = 0; i < D; i++) 
+        //cos(w1 t) is the real part of the carrier phasor
+        PhaseCache& cache = ThreadPhaseCache();
+        cache.Update(wl, &w1, 1, t, dt);
+        for (int k = 0; k < 3; k++) 
         {
-            for (int j = 0; j < D; j++) 
-            {
-                Vmatrices[k][i*D + j] = -im*env[k]*wr[i*D + j] * std::exp((im/hbar)*(wl[i]-wl[j])*tvec[k])*std::cos(w1*tvec[k]);
-            }
+            drive[k] = env[k]*cache.Carrier(k, 0).real();
         }
+        ApplyDriveCached(D, drive, wr, cache, Vmatrices);
+        return;
     }
-
-    
+    double angles[3], sines[3], cosines[3];
+    for (int k = 0; k < 3; k++) 
+    {
+        angles[k] = w1*tvec[k];
+    }
+    BlockSinCos(angles, sines, cosines, 3);
+    for (int k = 0; k < 3; k++) 
+    {
+        drive[k] = env[k]*cosines[k];
+    }
+    ApplyDrive(D, tvec, drive, wl, wr, Vmatrices);
 }
 
+//update potential matrix for two envelopes with carriers w1 and w2: both drive the same couplings,
+//so the drive factors are summed before the phase matrix is computed once
 void UpdatePotential2(const json& input, int D, double t, double dt, std::vector<double>& wl, std::vector<std::complex<double>>& wr, EnvelopeFunction envelope, std::vector<std::vector<std::complex<double>>>& Vmatrices ,std::vector<double>& env, std::vector<double>& env2)
 {
     //env should be a vector with envelope function at times [t, t + 0.5dt, t+dt] 
-    //assert(env != nullptr);
-   // assert(Vmatrices != nullptr);
-    //assert(wl != nullptr);
-    //assert(wr != nullptr);
 
     double w1 = input["w1"];
     double w2 = input["w2"];
-    std::complex<double> im;
-    im = std::complex<double>(0.0, 1.0);
-
-    std::vector<std::vector<std::complex<double>>> Vmatrices1(3, std::vector<std::complex<double>>(D*D));
-    //std::complex<double>** Vmatrices1 = new std::complex<double>*[3];
-    
-    // for (int i = 0; i < 3; i++) 
-    // {
-    //     Vmatrices1[i] = new std::complex<double>[D * D];
-    // }
     
     double tvec[3];
     tvec[0] = t;
@@ -65,24 +126,34 @@ void UpdatePotential2(const json& input, int D, double t, double dt, std::vector
 
     envelope(input, tvec, env, env2);
 
-    for (int k = 0; k < 3; k++) 
+    double drive[3];
+    if (input.value("phase_cache", false))
     {
-        for (int i = 0; i < D; i++) 
+        PhaseCache& cache = ThreadPhaseCache();
+        double carriers[2] = {w1, w2};
+        cache.Update(wl, carriers, 2, t, dt);
+        for (int k = 0; k < 3; k++) 
+        {
+            drive[k] = env[k]*cache.Carrier(k, 0).real() + env2[k]*cache.Carrier(k, 1).real();
+        }
+        ApplyDriveCached(D, drive, wr, cache, Vmatrices);
+    }
+    else
+    {
+        double angles[6], sines[6], cosines[6];
+        for (int k = 0; k < 3; k++) 
         {
-            for (int j = 0; j < D; j++) 
-            {
-                Vmatrices1[k][i*D + j] = -im*env[k]*wr[i*D + j] * std::exp((im/hbar)*(wl[i]-wl[j])*tvec[k])*std::cos(w1*tvec[k]);
-                Vmatrices[k][i*D + j] = -im*env2[k]*wr[i*D + j] * std::exp((im/hbar)*(wl[i]-wl[j])*tvec[k])*std::cos(w2*tvec[k])+ Vmatrices1[k][i*D+j];
-            }
+            angles[k]     = w1*tvec[k];
+            angles[k + 3] = w2*tvec[k];
         }
+        BlockSinCos(angles, sines, cosines, 6);
+        for (int k = 0; k < 3; k++) 
+        {
+            drive[k] = env[k]*cosines[k] + env2[k]*cosines[k + 3];
+        }
+        ApplyDrive(D, tvec, drive, wl, wr, Vmatrices);
     }
 
+    //the saved envelope is the sum of both
     env[2] += env2[2];
-    // for (int i = 0; i < 3; ++i) 
-    // {
-    //     delete[] Vmatrices1[i];
-    // }
-    // delete[] Vmatrices1;
- 
-
 }
@@ -0,0 +1,76 @@
+#include "precision.h"
+#include "stepsize.h"
+#include "report.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+//steps of the calibration window unless given
+static const int defaultWindow = 200;
+
+bool CheckPrecision(const json& input)
+{
+    for (const char* key : {"precision_resync", "precision_window"})
+    {
+        if (input.contains(key) && (!input[key].is_number_integer() || input[key] < 0))
+        {
+            std::cerr << "Wrong value " << input[key] << " for input data '" << key << "', expected a non-negative integer!\n";
+            return false;
+        }
+    }
+    if (!input.contains("precision"))
+    {
+        return true;
+    }
+    if (input["precision"] != "double" && input["precision"] != "mixed")
+    {
+        std::cerr << "The specified precision " << input["precision"] << " is not supported, expected 'double' or 'mixed'!\n";
+        return false;
+    }
+    if (input["precision"] == "double")
+    {
+        return true;
+    }
+    std::string integrator = input.value("integrator", input["qbmode"] == "off" ? std::string("rk4") : std::string("qubit"));
+    if (integrator != "rk4" || input.value("richardson", false) || input.value("diagonal_drive", std::string("rk4")) != "rk4")
+    {
+        std::cerr << "'precision' = 'mixed' needs the 'rk4' integrator without 'richardson' and 'diagonal_drive' = 'rk4'!\n";
+        return false;
+    }
+    return true;
+}
+
+void CalibratePrecision(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& t)
+{
+    int steps = std::min((int)t.size() - 1, input.value("precision_window", defaultWindow));
+    json& report = RunReport()["precision"];
+    report = {{"mode", "mixed"}, {"resync", input.value("precision_resync", 0)}, {"window_steps", steps}};
+    if (steps <= 0)
+    {
+        return;
+    }
+
+    //steps of the grid around the largest envelope (found as for the Nstep probe), where the drive is active
+    double tPeak = EstimateFrequencyBound(input, envelope, sys).tPeak;
+    int Nstep = (int)t.size() - 1;
+    int peak = (int)(std::lower_bound(t.begin(), t.end(), tPeak) - t.begin());
+    int start = std::max(0, std::min(peak - steps/2, Nstep - steps));
+    report["window_start"] = t[start];
+    report["window_end"]   = t[start + steps];
+
+    //the same steps in both precisions from the initial state, every row saved
+    std::vector<double> window(t.begin() + start, t.begin() + start + steps + 1);
+    json reference = input;
+    reference["precision"] = "double";
+    std::vector<std::complex<double>> psiMixed  = sys.psi0;
+    std::vector<std::complex<double>> psiDouble = sys.psi0;
+    RunOutput mixed;
+    RunOutput exact;
+    PropagateRK4(input, potential, envelope, sys, window, psiMixed, 1, &mixed);
+    PropagateRK4(reference, potential, envelope, sys, window, psiDouble, 1, &exact);
+
+    double deviation = PopulationDifference(mixed, exact);
+    report["max_population_deviation"] = deviation;
+    std::cout << "Mixed precision: largest population deviation " << deviation << " from double precision over the "
+              << steps << " steps from " << t[start] << " to " << t[start + steps] << " s\n";
+}
@@ -0,0 +1,279 @@
+#include "pulses.h"
+#include "envstream.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+
+# define M_PPI           3.14159265358979323846  /* pi */
+
+//gauss pulses are cut at this number of sigma (exp(-32) ~ 1e-14)
+static const double pulseCutoff = 8.0;
+//largest number of buckets of a level of the interval index, and of buckets spanned by a pulse in it (longer
+//pulses go to the next level), so that a level holds at most maxSpan entries per pulse
+static const long maxBuckets = 1L << 20;
+static const int maxSpan = 16;
+
+//number field of pulse k, or fallback if missing and not required
+static bool PulseNumber(const json& entry, int k, const char* name, bool required, double fallback, double& value)
+{
+    if (!entry.contains(name))
+    {
+        if (required)
+        {
+            std::cerr << "Missing data '" << name << "' of type 'number' for pulse " << k << "!\n";
+            return false;
+        }
+        value = fallback;
+        return true;
+    }
+    if (!entry[name].is_number())
+    {
+        std::cerr << "Wrong type for data '" << name << "' of pulse " << k << ", expected 'number'!\n";
+        return false;
+    }
+    value = entry[name];
+    return true;
+}
+
+std::shared_ptr<PulseTrain> PulseTrain::Load(const json& input)
+{
+    std::shared_ptr<PulseTrain> train(new PulseTrain());
+    const json& list = input["pulses"];
+    double w1 = input["w1"];
+
+    for (int k = 0; k < (int)list.size(); k++)
+    {
+        const json& entry = list[k];
+        if (!entry.is_object())
+        {
+            std::cerr << "Wrong type for pulse " << k << ", expected an object!\n";
+            return nullptr;
+        }
+        std::string shape = entry.value("shape", std::string("square"));
+
+        Pulse pulse;
+        pulse.center = 0.0;
+        pulse.sigma  = 0.0;
+        if (!PulseNumber(entry, k, "amplitude", true, 0.0, pulse.amplitude) ||
+            !PulseNumber(entry, k, "w", false, w1, pulse.w) ||
+            !PulseNumber(entry, k, "phase", false, 0.0, pulse.phase))
+        {
+            return nullptr;
+        }
+        if (shape == "square" || shape == "hann")
+        {
+            pulse.shape = (shape == "square") ? PULSE_SQUARE : PULSE_HANN;
+            if (!PulseNumber(entry, k, "t_start", true, 0.0, pulse.start) ||
+                !PulseNumber(entry, k, "t_end", true, 0.0, pulse.end))
+            {
+                return nullptr;
+            }
+            if (pulse.end <= pulse.start)
+            {
+                std::cerr << "Invalid pulse " << k << ": 't_end' must be after 't_start'!\n";
+                return nullptr;
+            }
+        }
+        else if (shape == "gauss")
+        {
+            pulse.shape = PULSE_GAUSS;
+            if (!PulseNumber(entry, k, "center", true, 0.0, pulse.center) ||
+                !PulseNumber(entry, k, "sigma", true, 0.0, pulse.sigma))
+            {
+                return nullptr;
+            }
+            if (pulse.sigma <= 0.0)
+            {
+                std::cerr << "Invalid pulse " << k << ": 'sigma' must be positive!\n";
+                return nullptr;
+            }
+            pulse.start = pulse.center - pulseCutoff*pulse.sigma*1.0e-6;
+            pulse.end   = pulse.center + pulseCutoff*pulse.sigma*1.0e-6;
+        }
+        else
+        {
+            std::cerr << "The shape '" << shape << "' of pulse " << k << " is not supported, expected 'square', 'gauss' or 'hann'!\n";
+            return nullptr;
+        }
+        train->pulses_.push_back(pulse);
+    }
+
+    std::vector<Pulse>& pulses = train->pulses_;
+    std::sort(pulses.begin(), pulses.end(), [](const Pulse& a, const Pulse& b) { return a.start < b.start; });
+
+    //buckets as wide as the shortest pulse: each holds the pulses overlapping it, in order of start. Pulses spanning
+    //more than maxSpan buckets are indexed again in a level of wider buckets; the shortest pulse of a level spans at
+    //most 2 buckets, so every level takes at least one pulse
+    std::vector<int> remaining(pulses.size());
+    for (int p = 0; p < (int)pulses.size(); p++)
+    {
+        remaining[p] = p;
+    }
+    long nBuckets = 0;
+    while (!remaining.empty())
+    {
+        double first = pulses[remaining.front()].start;
+        double last  = first;
+        double shortest = pulses[remaining.front()].end - first;
+        for (int p : remaining)
+        {
+            last     = std::max(last, pulses[p].end);
+            shortest = std::min(shortest, pulses[p].end - pulses[p].start);
+        }
+        double width = std::max(shortest, (last - first)/(double)maxBuckets);
+        int buckets = (int)std::floor((last - first)/width) + 1;
+
+        IndexLevel level;
+        level.t0 = first;
+        level.inverseWidth = 1.0/width;
+        std::vector<std::vector<int>> members(buckets);
+        std::vector<int> longer;
+        for (int p : remaining)
+        {
+            int b0 = std::min(buckets-1, (int)((pulses[p].start - first)/width));
+            int b1 = std::min(buckets-1, (int)((pulses[p].end - first)/width));
+            if (b1 - b0 >= maxSpan)
+            {
+                longer.push_back(p);
+                continue;
+            }
+            for (int b = b0; b <= b1; b++)
+            {
+                members[b].push_back(p);
+            }
+        }
+        level.offsets.push_back(0);
+        for (const auto& bucket : members)
+        {
+            level.pulses.insert(level.pulses.end(), bucket.begin(), bucket.end());
+            level.offsets.push_back((int)level.pulses.size());
+        }
+        train->levels_.push_back(std::move(level));
+        nBuckets += buckets;
+        remaining.swap(longer);
+    }
+
+    std::cout << "Pulse train: " << pulses.size() << " pulses, " << nBuckets << " index buckets in " << train->levels_.size() << " levels\n";
+    return train;
+}
+
+std::vector<double> PulseTrain::Edges() const
+{
+    std::vector<double> edges;
+    for (const Pulse& pulse : pulses_)
+    {
+        if (pulse.shape == PULSE_SQUARE)
+        {
+            edges.push_back(pulse.start);
+            edges.push_back(pulse.end);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    return edges;
+}
+
+void PulseTrain::Evaluate(const double* tvec, int n, double* env, double* drive, const double* envTimes) const
+{
+    for (int k = 0; k < n; k++)
+    {
+        double t = (envTimes != nullptr) ? envTimes[k] : tvec[k];
+        double envelope = 0.0;
+        double factor   = 0.0;
+
+        for (const IndexLevel& level : levels_)
+        {
+            double u = (t - level.t0)*level.inverseWidth;
+            if (u < 0.0 || u >= (double)(level.offsets.size() - 1))
+            {
+                continue;
+            }
+            int b = (int)u;
+            for (int q = level.offsets[b]; q < level.offsets[b+1]; q++)
+            {
+                const Pulse& pulse = pulses_[level.pulses[q]];
+                if (t < pulse.start || t > pulse.end)
+                {
+                    continue;
+                }
+                double value;
+                switch (pulse.shape)
+                {
+                    case PULSE_GAUSS:
+                    {
+                        //same normalization as the gauss envelope
+                        double x = (t - pulse.center)*1.0e6/pulse.sigma;
+                        value = pulse.amplitude/(std::sqrt(2.0*M_PPI)*pulse.sigma)*std::exp(-0.5*x*x);
+                        break;
+                    }
+                    case PULSE_HANN:
+                    {
+                        double s = std::sin(M_PPI*(t - pulse.start)/(pulse.end - pulse.start));
+                        value = pulse.amplitude*s*s;
+                        break;
+                    }
+                    default:
+                        value = pulse.amplitude;
+                        break;
+                }
+                envelope += value;
+                if (drive != nullptr)
+                {
+                    factor += value*std::cos(pulse.w*tvec[k] + pulse.phase);
+                }
+            }
+        }
+        env[k] = envelope;
+        if (drive != nullptr)
+        {
+            drive[k] = factor;
+        }
+    }
+}
+
+bool LoadPulseTrain(const json& input, EnvelopeFunction& envelope, PotentialFunction& potential)
+{
+    std::shared_ptr<PulseTrain> train = PulseTrain::Load(input);
+    if (!train)
+    {
+        return false;
+    }
+
+    envelope = [train](const json&, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    {
+        train->Evaluate(tvec, 3, env.data(), nullptr);
+        env2[0] = env2[1] = env2[2] = 0.0;
+    };
+    EnvelopeBlocks()["pulses"] = [train](const json&, const double* tvec, int n, double* env, double* env2)
+    {
+        train->Evaluate(tvec, n, env, nullptr);
+        for (int k = 0; k < n; k++)
+        {
+            env2[k] = 0.0;
+        }
+    };
+
+    //every pulse has its own carrier: the drive factors come from the train, not from the envelope argument;
+    //steps ending on the edge of a square pulse see the pulse from inside the step
+    std::vector<double> edges = train->Edges();
+    potential = [train, edges](const json& input, int D, double t, double dt, std::vector<double>& wl, std::vector<std::complex<double>>& wr, EnvelopeFunction, std::vector<std::vector<std::complex<double>>>& Vmatrices, std::vector<double>& env, std::vector<double>& env2)
+    {
+        double tvec[3] = {t, t + 0.5*dt, t + dt};
+        double inside[3];
+        double drive[3];
+        InsideEdgeTimes(edges, tvec, inside);
+        train->Evaluate(tvec, 3, env.data(), drive, inside);
+        env2[0] = env2[1] = env2[2] = 0.0;
+        if (input.value("phase_cache", false))
+        {
+            //only the level phases: the carriers of the pulses are part of their drive factors
+            PhaseCache& cache = ThreadPhaseCache();
+            cache.Update(wl, nullptr, 0, t, dt);
+            ApplyDriveCached(D, drive, wr, cache, Vmatrices);
+            return;
+        }
+        ApplyDrive(D, tvec, drive, wl, wr, Vmatrices);
+    };
+    return true;
+}
@@ -0,0 +1,234 @@
+#include "qubit.h"
+#include "potentials.h"
+#include "timers.h"
+#include "report.h"
+#include "perfcounters.h"
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <vector>
+
+//steps between exact evaluations of the phase factors advanced by rotation
+static const int reseedSteps = 256;
+
+//exp(i omega t) on the half-step grid t, t+h/2, t+h, ... advanced by products with exp(i omega h/2)
+struct QubitRotor
+{
+    double omega;
+    std::complex<double> z;      //exp(i omega t) at the start of the step
+    std::complex<double> r;      //exp(i omega h/2)
+
+    void Seed(double t, double h)
+    {
+        z = std::complex<double>(std::cos(omega*t), std::sin(omega*t));
+        r = std::complex<double>(std::cos(0.5*omega*h), std::sin(0.5*omega*h));
+    }
+};
+
+//cos(x) and sin(x)/x, by their Taylor polynomials for the small angles of resolved steps
+static inline void CosSinc(double x, double& c, double& sinc)
+{
+    double x2 = x*x;
+    if (x2 < 1.0e-2)
+    {
+        c    = 1.0 + x2*(-1.0/2.0 + x2*(1.0/24.0 + x2*(-1.0/720.0 + x2*(1.0/40320.0 + x2*(-1.0/3628800.0)))));
+        sinc = 1.0 + x2*(-1.0/6.0 + x2*(1.0/120.0 + x2*(-1.0/5040.0 + x2*(1.0/362880.0 + x2*(-1.0/39916800.0)))));
+        return;
+    }
+    c    = std::cos(x);
+    sinc = std::sin(x)/x;
+}
+
+void PropagateQubit(const json& input, PotentialFunction potential, EnvelopeFunction envelope, const SystemData& sys, const std::vector<double>& t, std::vector<std::complex<double>>& psi, int Nprint, RunOutput* out)
+{
+    int Nstep = (int)(t.size()) - 1;
+
+    //drive factor d(t) = env cos(w1 t) + env2 cos(w2 t) from the envelope; pulse trains carry their own
+    //carriers, their drive factor is read from the potential of a single level with unit coupling (-i d(t))
+    bool fromPotential = (input["envelope"] == "pulses");
+    QubitRotor carrier1 = {input["w1"], 0.0, 0.0};
+    bool twoCarriers = input.contains("w2") && input["w2"].is_number();
+    QubitRotor carrier2 = {twoCarriers ? (double)input["w2"] : 0.0, 0.0, 0.0};
+    std::vector<double> unitWl(1, 0.0);
+    std::vector<std::complex<double>> unitWr(1, std::complex<double>(1.0, 0.0));
+    std::vector<std::vector<std::complex<double>>> Vdrive(3, std::vector<std::complex<double>>(1));
+    std::vector<double> env(3, 0.0);
+    std::vector<double> env2(3, 0.0);
+
+    //H(t) = d(t) [[wr00, wr01 exp(-i delta t)], [wr10 exp(i delta t), wr11]] = c I + hx X + hy Y + hz Z
+    const double cMean = 0.5*(sys.wr[0].real() + sys.wr[3].real());
+    const double cDiff = 0.5*(sys.wr[0].real() - sys.wr[3].real());
+    const std::complex<double> c01 = sys.wr[1];
+    QubitRotor levels = {-(sys.wl[1] - sys.wl[0])/hbar, 0.0, 0.0};
+
+    //drive factors at t0, t0+h/2, t0+h from the rotors seeded at t0
+    auto drive = [&](double t0, double h, double* d)
+    {
+        double times[3] = {t0, t0 + 0.5*h, t0 + h};
+        if (fromPotential)
+        {
+            potential(input, 1, t0, h, unitWl, unitWr, envelope, Vdrive, env, env2);
+            for (int k = 0; k < 3; k++)
+            {
+                d[k] = -Vdrive[k][0].imag();
+            }
+            return;
+        }
+        envelope(input, times, env, env2);
+        std::complex<double> z1 = carrier1.z;
+        std::complex<double> z2 = carrier2.z;
+        for (int k = 0; k < 3; k++)
+        {
+            d[k] = env[k]*z1.real();
+            z1 *= carrier1.r;
+        }
+        if (twoCarriers)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                d[k] += env2[k]*z2.real();
+                z2 *= carrier2.r;
+            }
+        }
+        //the saved envelope is the sum of both, as in UpdatePotential2
+        env[2] += env2[2];
+    };
+
+    std::complex<double> a = psi[0];
+    std::complex<double> b = psi[1];
+
+    if (out != nullptr && out->t.empty() && Nstep > 0)
+    {
+        double d[3];
+        carrier1.Seed(t[0], t[1]-t[0]);
+        carrier2.Seed(t[0], t[1]-t[0]);
+        drive(t[0], t[1]-t[0], d);
+        out->t.push_back(t[0]);
+        out->env.push_back(env[0] + env2[0]);
+        out->psi.push_back(psi);
+    }
+
+    //the step is a few hundred flops in registers: one timer around the loop instead of per-step phases
+    ScopedTimer stepsTimer(PHASE_STAGES);
+    PerfScope stepsCounters(PHASE_STAGES);
+    double hSeed = 0.0;
+    int sinceSeed = 0;
+    int untilPrint = Nprint;
+    for (int i = 1; i < Nstep+1; i++)
+    {
+        double t0 = t[i-1];
+        double h  = t[i] - t[i-1];
+
+        //exact phase factors when the step changes (beyond the rounding of the grid) and every reseedSteps steps
+        if (std::abs(h - hSeed) > 1.0e-12*h || sinceSeed == reseedSteps)
+        {
+            carrier1.Seed(t0, h);
+            carrier2.Seed(t0, h);
+            levels.Seed(t0, h);
+            hSeed = h;
+            sinceSeed = 0;
+        }
+        sinceSeed++;
+
+        double d[3];
+        drive(t0, h, d);
+
+        double c[3];
+        double hx[3];
+        double hy[3];
+        double hz[3];
+        std::complex<double> z = levels.z;
+        for (int k = 0; k < 3; k++)
+        {
+            std::complex<double> offDiagonal = d[k]*c01*z;
+            c[k]  = d[k]*cMean;
+            hx[k] = offDiagonal.real();
+            hy[k] = -offDiagonal.imag();
+            hz[k] = d[k]*cDiff;
+            z *= levels.r;
+        }
+        std::complex<double> r2 = levels.r*levels.r;
+        levels.z *= r2;
+        carrier1.z *= carrier1.r*carrier1.r;
+        if (twoCarriers)
+        {
+            carrier2.z *= carrier2.r*carrier2.r;
+        }
+
+        //Magnus-4: Omega = -i (a0 I + a.sigma), a = h/6 (h0 + 4 h1/2 + h1) - h^2/6 (h0 x h1)
+        double w  = h/6.0;
+        double w2 = h*h/6.0;
+        double a0 = w*(c[0] + 4.0*c[1] + c[2]);
+        double ax = w*(hx[0] + 4.0*hx[1] + hx[2]) - w2*(hy[0]*hz[2] - hz[0]*hy[2]);
+        double ay = w*(hy[0] + 4.0*hy[1] + hy[2]) - w2*(hz[0]*hx[2] - hx[0]*hz[2]);
+        double az = w*(hz[0] + 4.0*hz[1] + hz[2]) - w2*(hx[0]*hy[2] - hy[0]*hx[2]);
+
+        //exp(Omega) = exp(-i a0) (cos|a| I - i sin|a| a.sigma/|a|)
+        double theta = std::sqrt(ax*ax + ay*ay + az*az);
+        double cosT;
+        double sinc;
+        CosSinc(theta, cosT, sinc);
+        double cosA;
+        double sincA;
+        CosSinc(a0, cosA, sincA);
+        std::complex<double> phase(cosA, -sincA*a0);
+        std::complex<double> u00(cosT, -sinc*az);
+        std::complex<double> u01(-sinc*ay, -sinc*ax);
+        std::complex<double> u10(sinc*ay, -sinc*ax);
+        std::complex<double> u11(cosT, sinc*az);
+
+        std::complex<double> aNew = phase*(u00*a + u01*b);
+        std::complex<double> bNew = phase*(u10*a + u11*b);
+        a = aNew;
+        b = bNew;
+
+        //save every Nprint
+        if (--untilPrint == 0 || i == Nstep)
+        {
+            untilPrint = Nprint;
+            if (out == nullptr)
+            {
+                continue;
+            }
+            psi[0] = a;
+            psi[1] = b;
+            out->psi.push_back(psi);
+            out->env.push_back(env[2]);
+            out->t.push_back(t[i]);
+        }
+    }
+    stepsCounters.Stop();
+    stepsTimer.Stop();
+
+    psi[0] = a;
+    psi[1] = b;
+}
+
+//executes the two-level simulation for qbmode = on
+void EvolveQubit(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+
+    SystemData sys = LoadSystem(input);
+    setupTimer.Stop();
+
+    std::vector<double> t = PrepareRun(input, potential, envelope, sys);
+    int Nstep = (int)t.size() - 1;
+
+    std::vector<std::complex<double>> psi = sys.psi0;
+    RunOutput out;
+
+    PropagateQubit(input, potential, envelope, sys, t, psi, Nprint, &out);
+
+    std::cout << "Calculation completed...\n";
+
+    //about 150 flops per step on values kept in registers
+    RunReport()["integrator"] = "magnus4_su2";
+    RunReport()["Dstates"]    = 2;
+    RunReport()["steps"]      = Nstep;
+    ReportKernelWork("qubit_steps", PhaseName(PHASE_STAGES), (double)Nstep, 150.0*Nstep, 0.0);
+
+    WriteOutput(prefix, 2, out);
+}
@@ -0,0 +1,144 @@
+#include "report.h"
+#include "timers.h"
+#include "perfcounters.h"
+#include "vecmath.h"
+#include "kernels.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#ifndef QQEVOL_BUILD_FLAGS
+#define QQEVOL_BUILD_FLAGS "unknown"
+#endif
+
+json& RunReport()
+{
+    static json report = json::object();
+    return report;
+}
+
+void ReportKernelWork(const std::string& kernel, const std::string& phase, double steps, double flops, double bytes)
+{
+    json& entry = RunReport()["kernels"][kernel];
+    entry["phase"] = phase;
+    entry["steps"] = steps;
+    entry["flops"] = flops;
+    entry["bytes"] = bytes;
+}
+
+std::string InputHash(const json& input)
+{
+    std::string text = input.dump();
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : text)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+    return buffer;
+}
+
+//model name of the first cpu listed in /proc/cpuinfo
+static std::string CpuModel()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+    {
+        if (line.rfind("model name", 0) == 0)
+        {
+            auto pos = line.find(':');
+            if (pos != std::string::npos && pos + 2 <= line.size())
+            {
+                return line.substr(pos + 2);
+            }
+        }
+    }
+    return "unknown";
+}
+
+static json HostReport()
+{
+    json host;
+    char name[256] = {0};
+    if (gethostname(name, sizeof(name) - 1) == 0)
+    {
+        host["hostname"] = name;
+    }
+    struct utsname uts;
+    if (uname(&uts) == 0)
+    {
+        host["os"]      = std::string(uts.sysname) + " " + uts.release;
+        host["machine"] = uts.machine;
+    }
+    host["cpu"]          = CpuModel();
+    host["logical_cpus"] = std::thread::hardware_concurrency();
+    return host;
+}
+
+void WriteRunReport(const json& input, double wallSeconds)
+{
+    json& report = RunReport();
+
+    report["prefix"]       = input["prefix"];
+    report["input_hash"]   = InputHash(input);
+    report["wall_seconds"] = wallSeconds;
+    report["timers"]       = PhaseReport();
+    if (PerfCountersEnabled())
+    {
+        report["perf_counters"] = PerfReport();
+    }
+
+    //rates of the declared kernels over the time of their phase (or of the whole run without timers)
+    if (report.contains("kernels"))
+    {
+        for (auto& kernel : report["kernels"])
+        {
+            double seconds = wallSeconds;
+            std::string phase = kernel["phase"];
+            if (report["timers"]["enabled"] && report["timers"]["phases"].contains(phase))
+            {
+                seconds = report["timers"]["phases"][phase]["seconds"];
+            }
+            if (seconds > 0.0)
+            {
+                kernel["seconds"]        = seconds;
+                kernel["gflops_per_s"]   = (double)kernel["flops"] / seconds * 1.0e-9;
+                kernel["gbytes_per_s"]   = (double)kernel["bytes"] / seconds * 1.0e-9;
+            }
+        }
+    }
+    if (report.contains("steps") && wallSeconds > 0.0)
+    {
+        report["steps_per_s"] = (double)report["steps"] / wallSeconds;
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        report["peak_rss_kb"] = usage.ru_maxrss;
+    }
+
+    report["host"]  = HostReport();
+    report["build"] = {{"compiler", __VERSION__}, {"flags", QQEVOL_BUILD_FLAGS},
+                       {"kernels", {{"isa", Kernels().isa}, {"forced", KernelsForced()}, {"supported", SupportedKernels()}}},
+                       {"vecmath", VecMathModeName()}};
+
+    std::string prefix  = input["prefix"];
+    std::string outfile = prefix + "_report.json";
+    std::ofstream file(outfile);
+    if (!file)
+    {
+        std::cerr << "Impossible to write the run report '" << outfile << "'!\n";
+        return;
+    }
+    file << report.dump(2) << "\n";
+    std::cout << "Run report written to " << outfile << "\n";
+}
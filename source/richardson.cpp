@@ -0,0 +1,128 @@
+#include "richardson.h"
+#include "chebyshev.h"
+#include "envelopes.h"
+#include "timers.h"
+#include "report.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+//2^4 - 1: the RK4 error of the dt/2 run is its difference from the dt run over 15
+static const double richardsonFactor = 15.0;
+
+//write the estimated population error of each saved row to prefix_err.txt
+static void WriteErrors(const std::string& prefix, const std::vector<double>& t, const std::vector<std::vector<double>>& errors)
+{
+    QQ_TIMER(PHASE_OUTPUT);
+    std::string errfile = prefix + "_err.txt";
+    FILE* f = std::fopen(errfile.c_str(), "w");
+    if (!f)
+    {
+        std::cerr << "Cannot open the error file " << errfile << "\n";
+        return;
+    }
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        std::fprintf(f, "%g ", t[i]);
+        for (double error : errors[i])
+        {
+            std::fprintf(f, "%g ", error);
+        }
+        std::fprintf(f, "\n");
+    }
+    std::fclose(f);
+}
+
+void EvolveRichardson(const json& input, PotentialFunction potential, EnvelopeFunction envelope)
+{
+    ScopedTimer setupTimer(PHASE_SETUP);
+    std::string prefix = input["prefix"];
+    int Nprint         = input["Nprint"];
+
+    SystemData sys = LoadSystem(input);
+    int D = sys.D;
+    setupTimer.Stop();
+
+    //each thread streams its own envelope
+    std::vector<EnvelopeFunction> fineEnvelope(1);
+    std::vector<double> t = PrepareRun(input, potential, envelope, sys, &fineEnvelope);
+    int Nstep = (int)t.size() - 1;
+
+    //every step of the grid halved, so that the rows of the two runs fall on the same times
+    std::vector<double> fine(1, t[0]);
+    for (int i = 1; i <= Nstep; i++)
+    {
+        fine.push_back(0.5*(t[i-1] + t[i]));
+        fine.push_back(t[i]);
+    }
+
+    std::unique_ptr<StaticSegments> segments;
+    std::unique_ptr<StaticSegments> fineSegments;
+    SystemData fineSys = sys;
+    if (input.value("segment_propagator", std::string("rk4")) == "chebyshev")
+    {
+        segments.reset(new StaticSegments(input, sys, t, EnvelopeEdges(input)));
+        fineSegments.reset(new StaticSegments(input, fineSys, fine, EnvelopeEdges(input)));
+    }
+
+    std::vector<std::complex<double>> psi = sys.psi0;
+    std::vector<std::complex<double>> finePsi = sys.psi0;
+    RunOutput coarse;
+    RunOutput refined;
+    std::thread fineThread([&]()
+    {
+        PropagateRK4(input, potential, fineEnvelope[0], fineSys, fine, finePsi, 2*Nprint, &refined, fineSegments.get());
+    });
+    PropagateRK4(input, potential, envelope, sys, t, psi, Nprint, &coarse, segments.get());
+    fineThread.join();
+
+    std::cout << "Calculation completed...\n";
+
+    //extrapolated rows and the population error of the dt/2 run
+    RunOutput out = refined;
+    std::vector<std::vector<double>> errors(out.t.size(), std::vector<double>(D, 0.0));
+    double maxError = 0.0;
+    for (size_t row = 0; row < out.t.size() && row < coarse.t.size(); row++)
+    {
+        double norm = 0.0;
+        for (int k = 0; k < D; k++)
+        {
+            const std::complex<double>& a = coarse.psi[row][k];
+            const std::complex<double>& b = refined.psi[row][k];
+            out.psi[row][k] = b + (b - a)/richardsonFactor;
+            norm += std::norm(out.psi[row][k]);
+            errors[row][k] = std::abs(std::norm(b) - std::norm(a))/richardsonFactor;
+            maxError = std::max(maxError, errors[row][k]);
+        }
+        norm = std::sqrt(norm);
+        for (int k = 0; k < D; k++)
+        {
+            out.psi[row][k] /= norm;
+        }
+    }
+    std::cout << "Richardson extrapolation of " << Nstep << " and " << 2*Nstep << " steps: largest estimated population error " << maxError << "\n";
+
+    //work of the stage kernels as in EvolveRK4, for the steps of both runs
+    double stageFlops = 32.0*D*D + 40.0*D;
+    double stageBytes = 16.0*(4.0*StageElements(sys) + 18.0*D);
+    double kernelSteps = 3.0*Nstep + RunReport().value("/nstep_auto/probe_steps"_json_pointer, 0.0);
+    if (segments)
+    {
+        kernelSteps -= segments->Steps() + fineSegments->Steps();
+        RunReport()["static_segments"] = {{"segments", segments->Count()}, {"steps", segments->Steps() + fineSegments->Steps()},
+                                          {"chebyshev_terms", segments->Terms() + fineSegments->Terms()}};
+    }
+    RunReport()["integrator"] = "rk4";
+    RunReport()["Dstates"]    = D;
+    RunReport()["steps"]      = Nstep;
+    RunReport()["richardson"] = {{"coarse_steps", Nstep}, {"fine_steps", 2*Nstep}, {"max_population_error", maxError},
+                                 {"error_file", prefix + "_err.txt"}};
+    ReportKernelWork("rk4_stages", PhaseName(PHASE_STAGES), kernelSteps, stageFlops*kernelSteps, stageBytes*kernelSteps);
+
+    WriteOutput(prefix, D, out);
+    WriteErrors(prefix, out.t, errors);
+}
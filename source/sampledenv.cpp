@@ -0,0 +1,272 @@
+#include "sampledenv.h"
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SampledEnvelope::~SampledEnvelope()
+{
+    if (mapping_ != nullptr)
+    {
+        munmap(mapping_, mappingSize_);
+    }
+}
+
+bool SampledEnvelope::Map(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Impossible to open the envelope table '" << path << "'!\n";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        std::cerr << "Empty or unreadable envelope table '" << path << "'!\n";
+        close(fd);
+        return false;
+    }
+    mappingSize_ = (size_t)info.st_size;
+    mapping_ = mmap(nullptr, mappingSize_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping_ == MAP_FAILED)
+    {
+        mapping_ = nullptr;
+        std::cerr << "Impossible to map the envelope table '" << path << "'!\n";
+        return false;
+    }
+    madvise(mapping_, mappingSize_, MADV_SEQUENTIAL);
+    return true;
+}
+
+//value of key in the python dict literal of a .npy header, e.g. 'descr': '<f8'
+static std::string NpyHeaderValue(const std::string& header, const std::string& key)
+{
+    auto pos = header.find("'" + key + "'");
+    if (pos == std::string::npos)
+    {
+        return "";
+    }
+    pos = header.find(':', pos);
+    if (pos == std::string::npos)
+    {
+        return "";
+    }
+    pos++;
+    while (pos < header.size() && header[pos] == ' ')
+    {
+        pos++;
+    }
+    size_t end = pos;
+    if (pos < header.size() && header[pos] == '(')
+    {
+        end = header.find(')', pos);
+        return header.substr(pos, end == std::string::npos ? std::string::npos : end - pos + 1);
+    }
+    while (end < header.size() && header[end] != ',' && header[end] != '}')
+    {
+        end++;
+    }
+    std::string value = header.substr(pos, end - pos);
+    while (!value.empty() && value.back() == ' ')
+    {
+        value.pop_back();
+    }
+    return value;
+}
+
+std::shared_ptr<SampledEnvelope> SampledEnvelope::Load(const json& input)
+{
+    std::shared_ptr<SampledEnvelope> table(new SampledEnvelope());
+    std::string path = input["table_file"];
+    table->t0_    = input.contains("table_t0") ? (double)input["table_t0"] : (double)input["ti"];
+    table->dt_    = input["table_dt"];
+    table->scale_ = input.value("F1", 1.0);
+
+    std::string interp = input.value("table_interp", std::string("linear"));
+    if (interp != "linear" && interp != "cubic")
+    {
+        std::cerr << "The specified table_interp '" << interp << "' is not supported, expected 'linear' or 'cubic'!\n";
+        return nullptr;
+    }
+    table->cubic_ = (interp == "cubic");
+
+    if (table->dt_ <= 0.0)
+    {
+        std::cerr << "Invalid 'table_dt': must be positive!\n";
+        return nullptr;
+    }
+    if (!table->Map(path))
+    {
+        return nullptr;
+    }
+
+    const char* bytes = (const char*)table->mapping_;
+    size_t size = table->mappingSize_;
+    if (size >= 10 && std::memcmp(bytes, "\x93NUMPY", 6) == 0)
+    {
+        //.npy: magic, version, header length (2 bytes in version 1, 4 bytes after), header dict, data
+        int major = (unsigned char)bytes[6];
+        size_t headerLength;
+        size_t offset;
+        if (major == 1)
+        {
+            headerLength = (unsigned char)bytes[8] | ((unsigned char)bytes[9] << 8);
+            offset = 10;
+        }
+        else
+        {
+            std::uint32_t length;
+            std::memcpy(&length, bytes + 8, 4);
+            headerLength = length;
+            offset = 12;
+        }
+        if (offset + headerLength > size)
+        {
+            std::cerr << "Corrupted .npy header in envelope table '" << path << "'!\n";
+            return nullptr;
+        }
+        std::string header(bytes + offset, headerLength);
+        std::string descr = NpyHeaderValue(header, "descr");
+        std::string order = NpyHeaderValue(header, "fortran_order");
+        std::string shape = NpyHeaderValue(header, "shape");
+        offset += headerLength;
+
+        //only one-dimensional arrays (or a single column) of little-endian floats
+        long count = 0;
+        int columns = 1;
+        if (std::sscanf(shape.c_str(), "(%ld, %d)", &count, &columns) < 1 || (columns != 1) || order == "True")
+        {
+            std::cerr << "Unsupported .npy shape " << shape << " in envelope table '" << path << "', expected (N,)!\n";
+            return nullptr;
+        }
+        size_t width = (descr == "'<f8'") ? 8 : ((descr == "'<f4'") ? 4 : 0);
+        if (width == 0)
+        {
+            std::cerr << "Unsupported .npy type " << descr << " in envelope table '" << path << "', expected '<f8' or '<f4'!\n";
+            return nullptr;
+        }
+        if (offset + count*width > size)
+        {
+            std::cerr << "Truncated data in envelope table '" << path << "'!\n";
+            return nullptr;
+        }
+        table->count_ = count;
+        if (width == 8)
+        {
+            table->samples_ = (const double*)(bytes + offset);
+        }
+        else
+        {
+            table->converted_.resize(count);
+            for (long k = 0; k < count; k++)
+            {
+                float value;
+                std::memcpy(&value, bytes + offset + 4*k, 4);
+                table->converted_[k] = value;
+            }
+            table->samples_ = table->converted_.data();
+        }
+    }
+    else
+    {
+        //raw little-endian float64 samples
+        if (size % 8 != 0)
+        {
+            std::cerr << "The size of the envelope table '" << path << "' (" << size << " bytes) is not a multiple of 8, expected raw float64 samples!\n";
+            return nullptr;
+        }
+        table->count_   = (long)(size/8);
+        table->samples_ = (const double*)bytes;
+    }
+
+    if (table->count_ < 2)
+    {
+        std::cerr << "The envelope table '" << path << "' needs at least 2 samples!\n";
+        return nullptr;
+    }
+
+    if (table->cubic_)
+    {
+        //natural spline with unit spacing: M[i-1] + 4 M[i] + M[i+1] = 6 (y[i+1] - 2 y[i] + y[i-1]), M[0] = M[N-1] = 0
+        long N = table->count_;
+        const double* y = table->samples_;
+        std::vector<double>& M = table->second_;
+        M.assign(N, 0.0);
+        std::vector<double> c(N, 0.0);
+        for (long i = 1; i < N-1; i++)
+        {
+            double rhs = 6.0*(y[i+1] - 2.0*y[i] + y[i-1]);
+            double pivot = 4.0 - c[i-1];
+            c[i] = 1.0/pivot;
+            M[i] = (rhs - M[i-1])/pivot;
+        }
+        for (long i = N-3; i >= 1; i--)
+        {
+            M[i] -= c[i]*M[i+1];
+        }
+    }
+
+    std::cout << "Envelope table '" << path << "': " << table->count_ << " samples, "
+              << (table->cubic_ ? "cubic spline" : "linear") << " interpolation\n";
+    return table;
+}
+
+void SampledEnvelope::Evaluate(const double* tvec, int n, double* env) const
+{
+    //uniform sampling: the sample index follows from t in O(1)
+    const double inverse = 1.0/dt_;
+    const double last = (double)(count_ - 1);
+    const double* y = samples_;
+
+    for (int k = 0; k < n; k++)
+    {
+        double u = (tvec[k] - t0_)*inverse;
+        if (u < 0.0 || u > last)
+        {
+            env[k] = 0.0;
+            continue;
+        }
+        long i = (long)u;
+        if (i > count_ - 2)
+        {
+            i = count_ - 2;
+        }
+        double f = u - (double)i;
+        double g = 1.0 - f;
+        double value = g*y[i] + f*y[i+1];
+        if (cubic_)
+        {
+            value += ((g*g*g - g)*second_[i] + (f*f*f - f)*second_[i+1])/6.0;
+        }
+        env[k] = scale_*value;
+    }
+}
+
+bool LoadSampledEnvelope(const json& input, EnvelopeFunction& scalar)
+{
+    std::shared_ptr<SampledEnvelope> table = SampledEnvelope::Load(input);
+    if (!table)
+    {
+        return false;
+    }
+
+    scalar = [table](const json&, double* tvec, std::vector<double>& env, std::vector<double>& env2)
+    {
+        table->Evaluate(tvec, 3, env.data());
+        env2[0] = env2[1] = env2[2] = 0.0;
+    };
+    EnvelopeBlocks()["table"] = [table](const json&, const double* tvec, int n, double* env, double* env2)
+    {
+        table->Evaluate(tvec, n, env);
+        for (int k = 0; k < n; k++)
+        {
+            env2[k] = 0.0;
+        }
+    };
+    return true;
+}
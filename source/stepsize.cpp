@@ -0,0 +1,311 @@
+#include "stepsize.h"
+#include "potentials.h"
+#include "report.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+# define M_PPI           3.14159265358979323846  /* pi */
+
+//number of envelope samples used to find the largest amplitude
+static const int envelopeSamples = 3072;
+//safety factor on the error extrapolated from the probe window to the whole run
+static const double probeSafety = 2.0;
+
+FrequencyBound EstimateFrequencyBound(const json& input, EnvelopeFunction envelope, const SystemData& sys)
+{
+    int D     = sys.D;
+    double ti = input["ti"];
+    double tf = input["tf"];
+    double ppp = input.value("Nstep_ppp", 10.0);
+
+    FrequencyBound bound;
+    bound.envMax = 0.0;
+    bound.tPeak  = ti;
+    double env2Max = 0.0;
+
+    //largest envelope amplitude, sampled on the whole interval and at the pulse centers
+    std::vector<double> env(3, 0.0);
+    std::vector<double> env2(3, 0.0);
+    std::vector<double> times;
+    for (int k = 0; k < envelopeSamples; k++)
+    {
+        times.push_back(ti + (tf-ti)*k/(envelopeSamples-1));
+    }
+    for (const char* center : {"t1", "t2"})
+    {
+        if (input.contains(center) && input[center].is_number())
+        {
+            times.push_back(input[center]);
+        }
+    }
+    //pulse trains: centers of the pulses
+    bool train = (input["envelope"] == "pulses");
+    if (train)
+    {
+        for (const auto& pulse : input["pulses"])
+        {
+            if (pulse.contains("center"))
+            {
+                times.push_back(pulse["center"]);
+            }
+            else if (pulse.contains("t_start") && pulse.contains("t_end"))
+            {
+                times.push_back(0.5*((double)pulse["t_start"] + (double)pulse["t_end"]));
+            }
+        }
+    }
+    while (times.size() % 3 != 0)
+    {
+        times.push_back(tf);
+    }
+    for (size_t k = 0; k < times.size(); k += 3)
+    {
+        double tvec[3] = {times[k], times[k+1], times[k+2]};
+        std::fill(env.begin(), env.end(), 0.0);
+        std::fill(env2.begin(), env2.end(), 0.0);
+        envelope(input, tvec, env, env2);
+        for (int j = 0; j < 3; j++)
+        {
+            double amplitude = std::abs(env[j]) + std::abs(env2[j]);
+            env2Max = std::max(env2Max, std::abs(env2[j]));
+            if (amplitude > bound.envMax)
+            {
+                bound.envMax = amplitude;
+                bound.tPeak  = tvec[j];
+            }
+        }
+    }
+
+    //carrier frequencies (w2 only drives the second envelope)
+    double wMax = std::abs((double)input["w1"]);
+    if (env2Max > 0.0 && input.contains("w2") && input["w2"].is_number())
+    {
+        wMax = std::max(wMax, std::abs((double)input["w2"]));
+    }
+    if (train)
+    {
+        for (const auto& pulse : input["pulses"])
+        {
+            wMax = std::max(wMax, std::abs(pulse.value("w", (double)input["w1"])));
+        }
+    }
+
+    //interaction-picture frequencies of coupled levels, shifted by the carriers
+    //and the largest rate of the drive (amplitude times row sum of the couplings)
+    double omega    = 0.0;
+    double rowMax   = 0.0;
+    for (int i = 0; i < D; i++)
+    {
+        double rowSum = 0.0;
+        for (int j = 0; j < D; j++)
+        {
+            if (std::abs(sys.wr[i*D + j]) > 0.0)
+            {
+                omega = std::max(omega, std::abs(sys.wl[i] - sys.wl[j])/hbar + wMax);
+            }
+            rowSum += std::abs(sys.wr[i*D + j]);
+        }
+        rowMax = std::max(rowMax, rowSum);
+    }
+    omega = std::max(omega, bound.envMax*rowMax);
+
+    //pulse widths (sigma in microseconds)
+    for (const char* width : {"sigma1", "sigma2"})
+    {
+        if (input.contains(width) && input[width].is_number() && (double)input[width] > 0.0)
+        {
+            omega = std::max(omega, 1.0/((double)input[width]*1.0e-6));
+        }
+    }
+
+    if (train)
+    {
+        for (const auto& pulse : input["pulses"])
+        {
+            if (pulse.contains("sigma") && (double)pulse["sigma"] > 0.0)
+            {
+                omega = std::max(omega, 1.0/((double)pulse["sigma"]*1.0e-6));
+            }
+            else if (pulse.contains("t_start") && pulse.contains("t_end") && pulse.value("shape", std::string("square")) == "hann")
+            {
+                omega = std::max(omega, 2.0*M_PPI/((double)pulse["t_end"] - (double)pulse["t_start"]));
+            }
+        }
+    }
+
+    if (bound.envMax == 0.0)
+    {
+        //no drive: the interaction-picture state does not change
+        omega = 0.0;
+    }
+    bound.omegaMax = omega;
+    bound.dt = (omega > 0.0) ? 2.0*M_PPI/(ppp*omega) : (tf-ti);
+    return bound;
+}
+
+double PopulationDifference(const RunOutput& a, const RunOutput& b)
+{
+    double diff = 0.0;
+    size_t rows = std::min(a.psi.size(), b.psi.size());
+    for (size_t r = 0; r < rows; r++)
+    {
+        for (size_t k = 0; k < a.psi[r].size(); k++)
+        {
+            diff = std::max(diff, std::abs(std::norm(a.psi[r][k]) - std::norm(b.psi[r][k])));
+        }
+    }
+    return diff;
+}
+
+bool CheckNstepAuto(const json& input)
+{
+    for (const char* key : {"Nstep_tol", "Nstep_ppp"})
+    {
+        if (input.contains(key) && (!input[key].is_number() || input[key] <= 0))
+        {
+            std::cerr << "Wrong value " << input[key] << " for input data '" << key << "', expected a positive number!\n";
+            return false;
+        }
+    }
+    if (input.contains("Nstep_window") && (!input["Nstep_window"].is_number() || input["Nstep_window"] < 0 || input["Nstep_window"] > 1))
+    {
+        std::cerr << "Wrong value " << input["Nstep_window"] << " for input data 'Nstep_window', expected a number between 0 and 1!\n";
+        return false;
+    }
+    if (input.contains("Nstep_probe") && !input["Nstep_probe"].is_boolean())
+    {
+        std::cerr << "Wrong value " << input["Nstep_probe"] << " for input data 'Nstep_probe', expected true or false!\n";
+        return false;
+    }
+    return true;
+}
+
+int ResolveNstep(const json& input, PotentialFunction potential, EnvelopeFunction envelope, SystemData& sys, const std::vector<double>& edges)
+{
+    if (input["Nstep"].is_number_integer())
+    {
+        return input["Nstep"];
+    }
+
+    double ti     = input["ti"];
+    double tf     = input["tf"];
+    int Nprint    = input["Nprint"];
+    double tol    = input.value("Nstep_tol", 1.0e-6);
+    bool probe    = input.value("Nstep_probe", true);
+    double window = std::min(1.0, std::max(0.0, input.value("Nstep_window", 0.02)));
+
+    FrequencyBound bound = EstimateFrequencyBound(input, envelope, sys);
+    double dt = bound.dt;
+
+    json& report = RunReport()["nstep_auto"];
+    report["omega_max"]   = bound.omegaMax;
+    report["env_max"]     = bound.envMax;
+    report["dt_bound"]    = bound.dt;
+    report["tolerance"]   = tol;
+    report["probe"]       = json::array();
+
+    std::cout << "Choosing Nstep: largest frequency " << bound.omegaMax << " rad/s, time step bound " << bound.dt << " s\n";
+
+    long long probeSteps = 0;
+    if (probe && bound.envMax > 0.0 && window > 0.0)
+    {
+        //window of the run around the largest envelope, started from the initial state
+        double width = window*(tf-ti);
+        double a = std::max(ti, std::min(bound.tPeak - 0.5*width, tf - width));
+        double b = a + width;
+        double growth = (tf-ti)/width;
+
+        //edges of the run inside the window: the probe grids step on them as the run does
+        std::vector<double> windowEdges;
+        for (double edge : edges)
+        {
+            if (edge > a && edge < b)
+            {
+                windowEdges.push_back(edge);
+            }
+        }
+
+        bool refined = false;
+        double acceptedDt = 0.0;
+        int lastWindow = 0;
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            int nWindow = std::max(16, (int)std::ceil(width/dt));
+            nWindow = (nWindow + 3)/4*4;
+            dt = width/nWindow;
+            //clamped to the smallest window again: the probe would repeat the last one
+            if (nWindow == lastWindow)
+            {
+                break;
+            }
+            lastWindow = nWindow;
+
+            //every coarse step halved, so that the rows of the two runs fall on the same times
+            std::vector<double> tCoarse = windowEdges.empty() ? TimeGrid(a, b, nWindow) : TimeGrid(a, b, nWindow, windowEdges);
+            std::vector<double> tFine(1, a);
+            for (size_t i = 1; i < tCoarse.size(); i++)
+            {
+                tFine.push_back(0.5*(tCoarse[i-1] + tCoarse[i]));
+                tFine.push_back(tCoarse[i]);
+            }
+            int coarseSteps = (int)tCoarse.size() - 1;
+            int rowSteps = std::max(1, coarseSteps/4);
+
+            std::vector<std::complex<double>> psiCoarse = sys.psi0;
+            std::vector<std::complex<double>> psiFine   = sys.psi0;
+            RunOutput coarse;
+            RunOutput fine;
+            PropagateRK4(input, potential, envelope, sys, tCoarse, psiCoarse, rowSteps,   &coarse);
+            PropagateRK4(input, potential, envelope, sys, tFine,   psiFine,   2*rowSteps, &fine);
+            probeSteps += 3LL*coarseSteps;
+
+            //Richardson estimate of the error of the coarse run, grown linearly to the whole interval
+            double error = probeSafety*16.0/15.0*PopulationDifference(coarse, fine)*growth;
+            report["probe"].push_back({{"dt", dt}, {"window_steps", nWindow}, {"error", error}});
+            std::cout << "  probe dt = " << dt << " s: estimated population error " << error << "\n";
+
+            if (error <= tol)
+            {
+                acceptedDt = dt;
+                //the bound can be too conservative: coarsen while the predicted step is clearly larger
+                double growthDt = std::min(4.0, 0.9*std::pow(tol/std::max(error, 1.0e-300), 0.25));
+                if (!refined && growthDt > 1.25)
+                {
+                    dt *= growthDt;
+                    continue;
+                }
+                break;
+            }
+            if (acceptedDt > 0.0)
+            {
+                //coarsening went too far: keep the last accepted step
+                break;
+            }
+            refined = true;
+            dt *= std::max(0.1, 0.9*std::pow(tol/error, 0.25));
+        }
+        if (acceptedDt > 0.0)
+        {
+            dt = acceptedDt;
+        }
+        else
+        {
+            std::cerr << "Warning: the Nstep probe did not reach the tolerance " << tol << ", using the last refined time step\n";
+        }
+    }
+
+    long long steps = (long long)std::ceil((tf-ti)/dt);
+    steps = std::max<long long>(steps, std::max(1, Nprint));
+    if (steps > 2147483647LL)
+    {
+        std::cerr << "Warning: automatic Nstep exceeds the integer range, clamped\n";
+        steps = 2147483647LL;
+    }
+    int Nstep = (int)steps;
+
+    report["probe_steps"] = probeSteps;
+    report["nstep"]       = Nstep;
+    std::cout << "Nstep chosen automatically: " << Nstep << "\n";
+    return Nstep;
+}
@@ -0,0 +1,103 @@
+#include "timers.h"
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//accumulated time and number of measured scopes of each phase for one thread
+struct PhaseTotals
+{
+    std::string thread;
+    double seconds[PHASE_COUNT] = {};
+    long long calls[PHASE_COUNT] = {};
+};
+
+//registry of the accumulators of all threads that ever measured a phase
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<PhaseTotals>>& Registry()
+{
+    static std::vector<std::unique_ptr<PhaseTotals>> registry;
+    return registry;
+}
+
+//accumulator of the calling thread, registered at first use
+static PhaseTotals& ThreadTotals()
+{
+    thread_local PhaseTotals* totals = nullptr;
+    if (totals == nullptr)
+    {
+        std::ostringstream id;
+        id << std::this_thread::get_id();
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        Registry().push_back(std::make_unique<PhaseTotals>());
+        totals = Registry().back().get();
+        totals->thread = id.str();
+    }
+    return *totals;
+}
+
+const char* PhaseName(TimerPhase phase)
+{
+    switch (phase)
+    {
+        case PHASE_SETUP:         return "setup";
+        case PHASE_POTENTIAL:     return "potential";
+        case PHASE_STAGES:        return "stages";
+        case PHASE_NORMALIZATION: return "normalization";
+        case PHASE_OUTPUT:        return "output";
+        case PHASE_PIPELINE_WAIT: return "pipeline_wait";
+        default:                  return "unknown";
+    }
+}
+
+void AddPhaseTime(TimerPhase phase, std::chrono::steady_clock::duration elapsed)
+{
+    PhaseTotals& totals = ThreadTotals();
+    totals.seconds[phase] += std::chrono::duration<double>(elapsed).count();
+    totals.calls[phase]   += 1;
+}
+
+json PhaseReport()
+{
+    json report;
+#ifdef QQEVOL_TIMERS
+    report["enabled"] = true;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    json total   = json::object();
+    json threads = json::array();
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        double seconds = 0.0;
+        long long calls = 0;
+        for (const auto& totals : Registry())
+        {
+            seconds += totals->seconds[p];
+            calls   += totals->calls[p];
+        }
+        if (calls > 0)
+        {
+            total[PhaseName((TimerPhase)p)] = {{"seconds", seconds}, {"calls", calls}};
+        }
+    }
+    for (const auto& totals : Registry())
+    {
+        json phases = json::object();
+        for (int p = 0; p < PHASE_COUNT; p++)
+        {
+            if (totals->calls[p] > 0)
+            {
+                phases[PhaseName((TimerPhase)p)] = {{"seconds", totals->seconds[p]}, {"calls", totals->calls[p]}};
+            }
+        }
+        threads.push_back({{"thread", totals->thread}, {"phases", phases}});
+    }
+    report["phases"]  = total;
+    report["threads"] = threads;
+#else
+    report["enabled"] = false;
+#endif
+    return report;
+}
@@ -0,0 +1,41 @@
+#include "vecmath.h"
+#include "kernels.h"
+
+static VecMathMode vecMathMode = VECMATH_ACCURATE;
+
+bool SetVecMathMode(const std::string& name)
+{
+    if (name == "accurate")
+    {
+        vecMathMode = VECMATH_ACCURATE;
+    }
+    else if (name == "fast")
+    {
+        vecMathMode = VECMATH_FAST;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+VecMathMode GetVecMathMode()
+{
+    return vecMathMode;
+}
+
+const char* VecMathModeName()
+{
+    return vecMathMode == VECMATH_FAST ? "fast" : "accurate";
+}
+
+void BlockExp(const double* x, double* y, int n)
+{
+    Kernels().exp(x, y, n, vecMathMode == VECMATH_FAST);
+}
+
+void BlockSinCos(const double* x, double* s, double* c, int n)
+{
+    Kernels().sincos(x, s, c, n, vecMathMode == VECMATH_FAST);
+}